@@ -0,0 +1,43 @@
+/********************************
+ * Sample5: 使用协程池并行处理请求的Server
+*********************************/
+#include <ucorf/ucorf.h>
+#include "echo.rpc.h"
+#include <iostream>
+using namespace Echo;
+using namespace ucorf;
+
+// 1.继承代码生成器生成的类，并重写定义的rpc接口
+struct MyEcho : public ::Echo::UcorfEchoService
+{
+    virtual bool Echo(EchoRequest & request, EchoResponse & response)
+    {
+        // 模拟一个耗时的处理, 不会阻塞同一连接上的后续请求
+        co_sleep(100);
+        response.set_code(request.code());
+        return true;
+    }
+};
+
+int main()
+{
+    // 2.创建server对象, 默认使用协程池处理请求, 协程池最多1024个协程
+    boost::shared_ptr<Option> opt(new Option);
+    opt->dispatch_mode = eDispatchMode::coroutine;
+    opt->max_dispatch_coroutines = 1024;
+
+    ucorf::Server server;
+    server.SetOption(opt);
+
+    // 3.注册MyEcho服务, 并限制该服务最多同时处理100个请求
+    server.RegisterService(boost::shared_ptr<IService>(new MyEcho));
+    server.SetServiceDispatch("EchoService", eDispatchMode::coroutine, 100);
+
+    // 4.启动监听端口
+    server.Listen("tcp://127.0.0.1:8080");
+
+    // 5.启动协程框架主循环
+    co_sched.RunLoop();
+
+    return 0;
+}
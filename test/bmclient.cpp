@@ -1,12 +1,18 @@
 #include <ucorf/client.h>
 #include <ucorf/net_transport.h>
+#include <ucorf/shm_transport.h>
+#ifdef UCORF_HAVE_URING
+#include <ucorf/uring_transport.h>
+#endif
 #include <ucorf/dispatcher.h>
 #include <ucorf/server_finder.h>
 #include "echo.rpc.h"
+#include "syscall_counter.h"
 #include <iostream>
 #include <cstdio>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/thread.hpp>
+#include <boost/algorithm/string.hpp>
 using std::cout;
 using std::endl;
 using namespace Echo;
@@ -14,6 +20,8 @@ using namespace Echo;
 static int concurrecy = 256;
 static int thread_c = 1;
 static int connection_c = 1;
+static bool g_uring = false;
+static SyscallCounter *g_syscalls = nullptr;
 static std::atomic<size_t> g_count{0};
 static std::atomic<size_t> g_error{0};
 static int g_all_time{0};
@@ -45,6 +53,24 @@ void show_status()
             (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - last_time).count(),
             errinfo.c_str()
             );
+    // 两种后端都输出每秒和每个请求的系统调用数, 便于对比
+    static uint64_t last_syscalls = 0;
+    uint64_t syscalls = g_syscalls->Get();
+    uint64_t sps = syscalls - last_syscalls;
+    last_syscalls = syscalls;
+    std::printf("|  %s/s: %llu  per request: %.2f", g_syscalls->Name(),
+            (unsigned long long)sps, qps > 0 ? (double)sps / qps : 0.0);
+#ifdef UCORF_HAVE_URING
+    if (g_uring) {
+        static ucorf::IoUring::Stats last;
+        ucorf::IoUring::Stats stats = ucorf::IoUring::Default()->GetStats();
+        std::printf("  io_uring_enter/s: %llu  completions/s: %llu",
+                (unsigned long long)(stats.enters - last.enters),
+                (unsigned long long)(stats.completions - last.completions));
+        last = stats;
+    }
+#endif
+    std::printf("\n");
     last_time = now;
     g_all_time = g_max_time = 0;
 }
@@ -54,8 +80,12 @@ int main(int argc, char** argv)
     using namespace ucorf;
     getitimer(ITIMER_PROF, &g_itimer);
 
+    // 在创建其他线程之前开始统计
+    g_syscalls = new SyscallCounter;
+
     if (argc > 1 && std::string(argv[1]) == "-h") {
-        printf("Usage: bmclient.t [Coroutines] [ThreadCount] [Connections] [Address]\n");
+        printf("Usage: bmclient.t [Coroutines] [ThreadCount] [Connections] [Address] [BusyPollUs]\n"
+               "       Address: tcp://ip:port | uring+tcp://ip:port | unix:///path | shm://name\n");
         return 0;
     }
 
@@ -87,8 +117,24 @@ int main(int argc, char** argv)
     auto opt = boost::make_shared<Option>();
     opt->transport_opt = tp_opt;
     opt->rcv_timeout_ms = 0;
+    if (boost::starts_with(url, "shm://")) {
+        ShmTransportOption shm_opt;
+        if (argc > 5)
+            shm_opt.busy_poll_us = atoi(argv[5]);
+        opt->transport_opt = shm_opt;
+    }
 
     Client client;
+    if (boost::starts_with(url, "uring+")) {
+#ifdef UCORF_HAVE_URING
+        g_uring = true;
+        url = url.substr(6);
+        client.SetTransportFactory([]{ return (ITransportClient*)new UringTransportClient; });
+#else
+        std::printf("io_uring transport is not built\n");
+        return 1;
+#endif
+    }
     for (int i = 0; i < connection_c; ++i)
         client.SetServerFinder(std::unique_ptr<ServerFinder>(new ServerFinder));
     client.SetOption(opt).SetUrl(url);
@@ -128,8 +174,10 @@ int main(int argc, char** argv)
         }
     };
 
-    go []{
+    go [&]{
         co_sleep(10000);
+        for (auto &snap : client.GetStats())
+            std::printf("%s\n", snap.ToString().c_str());
         exit(0);
     };
 
@@ -1,9 +1,15 @@
 #include <ucorf/server.h>
 #include <ucorf/net_transport.h>
+#include <ucorf/shm_transport.h>
+#ifdef UCORF_HAVE_URING
+#include <ucorf/uring_transport.h>
+#endif
 #include "echo.rpc.h"
+#include "syscall_counter.h"
 #include <iostream>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/thread.hpp>
+#include <boost/algorithm/string.hpp>
 using std::cout;
 using std::endl;
 using namespace Echo;
@@ -20,20 +26,44 @@ struct MyEcho : public ::Echo::UcorfEchoService
     }
 };
 
+static bool g_uring = false;
+static SyscallCounter *g_syscalls = nullptr;
+
 void show_status()
 {
     static size_t last_count = 0;
+    static uint64_t last_syscalls = 0;
     size_t qps = g_count - last_count;
     last_count = g_count;
-    cout << "qps: " << qps << endl;
+    uint64_t syscalls = g_syscalls->Get();
+    uint64_t sps = syscalls - last_syscalls;
+    last_syscalls = syscalls;
+
+    // 两种后端都输出每秒和每个请求的系统调用数, 便于对比
+    cout << "qps: " << qps << "  " << g_syscalls->Name() << "/s: " << sps
+        << "  per request: " << (qps ? (double)sps / qps : 0);
+#ifdef UCORF_HAVE_URING
+    if (g_uring) {
+        static ucorf::IoUring::Stats last;
+        ucorf::IoUring::Stats stats = ucorf::IoUring::Default()->GetStats();
+        cout << "  io_uring_enter/s: " << stats.enters - last.enters
+            << "  completions/s: " << stats.completions - last.completions;
+        last = stats;
+    }
+#endif
+    cout << endl;
 }
 
 int main(int argc, char **argv)
 {
     using namespace ucorf;
 
+    // 在创建其他线程之前开始统计
+    g_syscalls = new SyscallCounter;
+
     if (argc > 1 && std::string(argv[1]) == "-h") {
-        printf("Usage: bmclient.t [ThreadCount] [Address]\n");
+        printf("Usage: bmserver.t [ThreadCount] [Address] [BusyPollUs]\n"
+               "       Address: tcp://ip:port | uring+tcp://ip:port | unix:///path | shm://name\n");
         return 0;
     }
 
@@ -49,10 +79,30 @@ int main(int argc, char **argv)
     tp_opt.max_pack_size_ = 40960;
     auto opt = boost::make_shared<Option>();
     opt->transport_opt = tp_opt;
+    if (boost::starts_with(url, "shm://")) {
+        ShmTransportOption shm_opt;
+        if (argc > 3)
+            shm_opt.busy_poll_us = atoi(argv[3]);
+        opt->transport_opt = shm_opt;
+    }
 
     Server server;
     server.SetOption(opt).RegisterService(boost::shared_ptr<IService>(new MyEcho));
-    boost_ec ec = server.Listen(url);
+    boost_ec ec;
+    if (boost::starts_with(url, "uring+")) {
+#ifdef UCORF_HAVE_URING
+        g_uring = true;
+        std::unique_ptr<ITransportServer> tp(new UringTransportServer);
+        ec = tp->Listen(url.substr(6));
+        if (!ec)
+            server.BindTransport(std::move(tp));
+#else
+        cout << "io_uring transport is not built" << endl;
+        return 1;
+#endif
+    } else {
+        ec = server.Listen(url);
+    }
     if (ec) {
         cout << "listen error: " << ec.message() << endl;
         return 1;
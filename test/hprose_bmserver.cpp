@@ -48,7 +48,7 @@ int main(int argc, char **argv)
     opt->transport_opt = tp_opt;
 
     Hprose_Service *hp_srv = new Hprose_Service;
-    hp_srv->RegisterFunction("add", boost::function<int(int)>(&add));
+    hp_srv->RegisterFunction("add", &add);
     boost::shared_ptr<IService> srv(hp_srv);
     Server server;
     server.SetOption(opt);
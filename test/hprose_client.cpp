@@ -9,6 +9,14 @@
 using std::cout;
 using std::endl;
 
+struct User
+{
+    std::string name;
+    int age;
+    std::string city;
+};
+ucorf_hprose_class(User, name, age, city)
+
 int main(int argc, char **argv)
 {
     using namespace ucorf;
@@ -33,6 +41,27 @@ retry:
             cout << "rpc call success, response=" << rsp << endl;
         }
 
+        std::vector<User> users = stub.CallMethod<std::vector<User>>("users", ec, 3);
+        if (ec) {
+            cout << "rpc call error: " << ec.message() << endl;
+        } else {
+            for (auto & user : users)
+                cout << "user: " << user.name << ", " << user.age << ", " << user.city << endl;
+        }
+
+        // 批量调用, 一次往返
+        Hprose_Batch batch;
+        batch.Add("add", 2);
+        batch.Add("users", 2);
+        ec = stub.CallBatch(batch);
+        if (ec) {
+            cout << "batch call error: " << ec.message() << endl;
+        } else {
+            int sum = batch.Result<int>(0, ec);
+            std::vector<User> batch_users = batch.Result<std::vector<User>>(1, ec);
+            cout << "batch call success, add=" << sum << ", users=" << batch_users.size() << endl;
+        }
+
         co_sleep(1000);
         goto retry;
     };
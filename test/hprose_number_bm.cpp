@@ -0,0 +1,132 @@
+#include <ucorf/hprose/hprose_protocol.h>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+using namespace ucorf::hprose;
+
+// hprose数字编解码的微基准: 对比原来的std::to_string/atoll/atof实现与Buffer的实现,
+// 并校验double编码后可以精确还原.
+static int count = 1000000;
+
+// 原来的实现: to_string编码, 读出临时字符串后atoll/atof解码
+static void LegacyWrite(std::string & s, long long i)
+{
+    s += TagLong;
+    s += std::to_string(i);
+    s += TagSemicolon;
+}
+
+static void LegacyWrite(std::string & s, double f)
+{
+    s += TagDouble;
+    s += std::to_string(f);
+    s += TagSemicolon;
+}
+
+template <typename T>
+static bool LegacyRead(std::string const& s, size_t & pos, T & v)
+{
+    ++pos;  // tag
+    size_t end = s.find(TagSemicolon, pos);
+    if (end == std::string::npos) return false;
+    std::string num = s.substr(pos, end - pos);
+    pos = end + 1;
+    if (std::is_integral<T>::value)
+        v = (T)atoll(num.c_str());
+    else
+        v = (T)atof(num.c_str());
+    return true;
+}
+
+template <typename F>
+static long long TimeUs(F const& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+static void Report(const char* name, long long legacy_us, long long new_us)
+{
+    std::printf("%-20s legacy: %6lldus  buffer: %6lldus  speedup: %.2fx\n",
+            name, legacy_us, new_us, (double)legacy_us / (new_us + 1));
+}
+
+template <typename T>
+static void Bench(const char* name, std::vector<T> const& values)
+{
+    // 预先分配好内存, 只比较编码本身
+    std::string legacy;
+    Buffer buf;
+    legacy.reserve(values.size() * 32);
+    buf.s_.reserve(values.size() * 32);
+    long long legacy_enc = TimeUs([&]{
+            for (auto v : values)
+                LegacyWrite(legacy, v);
+            });
+    long long new_enc = TimeUs([&]{
+            for (auto v : values)
+                buf.Write(v);
+            });
+
+    std::string name_enc = std::string(name) + " encode";
+    Report(name_enc.c_str(), legacy_enc, new_enc);
+
+    size_t pos = 0;
+    T sum = 0;
+    long long legacy_dec = TimeUs([&]{
+            T v;
+            while (pos < legacy.size() && LegacyRead(legacy, pos, v))
+                sum += v;
+            });
+
+    std::string const& s = buf.str();
+    Buffer reader(s.data(), s.size());
+    size_t errors = 0;
+    long long new_dec = TimeUs([&]{
+            for (auto expect : values) {
+                T v;
+                if (!reader.Read(v) || memcmp(&v, &expect, sizeof(T)) != 0)
+                    ++errors;
+            }
+            });
+
+    std::string name_dec = std::string(name) + " decode";
+    Report(name_dec.c_str(), legacy_dec, new_dec);
+    std::printf("%-20s bytes legacy: %zu  buffer: %zu  round-trip errors: %zu  (%g)\n",
+            name, legacy.size(), s.size(), errors, (double)sum);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+        printf("Usage: hprose_number_bm.t [Count]\n");
+        return 0;
+    }
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+
+    std::mt19937_64 rng(20161019);
+    std::vector<long long> integers, small_integers;
+    std::vector<double> prices, doubles;
+    integers.reserve(count);
+    small_integers.reserve(count);
+    prices.reserve(count);
+    doubles.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        integers.push_back((long long)rng() >> (rng() % 63));
+        small_integers.push_back((long long)(rng() % 100000));
+        prices.push_back((double)(rng() % 10000000) / 100);
+        doubles.push_back(std::uniform_real_distribution<double>(-1e6, 1e6)(rng));
+    }
+
+    Bench("integer", integers);
+    Bench("small integer", small_integers);
+    Bench("price", prices);
+    Bench("double", doubles);
+    return 0;
+}
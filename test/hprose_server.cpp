@@ -12,6 +12,32 @@ int add(int v)
     return v + v;
 }
 
+// 自定义结构体, 按hprose的class/object格式传输
+struct User
+{
+    std::string name;
+    int age;
+    std::string city;
+};
+ucorf_hprose_class(User, name, age, city)
+
+std::vector<User> users(int count)
+{
+    std::vector<User> result;
+    for (int i = 0; i < count; ++i)
+        result.push_back(User{"user" + std::to_string(i), 20 + i, "Beijing"});
+    return result;
+}
+
+// 成员函数需要绑定对象注册
+struct Counter
+{
+    int value = 0;
+
+    int incr(int step) { return value += step; }
+    int get() const { return value; }
+};
+
 int main(int argc, char **argv)
 {
     using namespace ucorf;
@@ -22,7 +48,12 @@ int main(int argc, char **argv)
         url = argv[1];
 
     Hprose_Service *hp_srv = new Hprose_Service;
-    hp_srv->RegisterFunction("add", boost::function<int(int)>(&add));
+    hp_srv->RegisterFunction("add", &add);
+    hp_srv->RegisterFunction("users", boost::function<std::vector<User>(int)>(&users));
+    hp_srv->RegisterFunction("hello", [](std::string const& name) { return "hello " + name; });
+    static Counter counter;
+    hp_srv->RegisterFunction("incr", &counter, &Counter::incr);
+    hp_srv->RegisterFunction("get", &counter, &Counter::get);
     boost::shared_ptr<IService> srv(hp_srv);
     Server server;
     server.SetHeaderFactory(&Hprose_Head::Factory);
@@ -0,0 +1,99 @@
+#include <ucorf/server.h>
+#include <ucorf/client.h>
+#include "echo.rpc.h"
+#include <iostream>
+#include <cstdio>
+#include <boost/smart_ptr/make_shared.hpp>
+using std::cout;
+using std::endl;
+using namespace Echo;
+
+// 在同一进程内通过inproc://启动server和client,
+// 对比走序列化的进程内连接与直接调用(Option::inproc_direct_call)的QPS和平均延迟.
+static int concurrecy = 64;
+static int count_per_co = 10000;
+
+struct MyEcho : public ::Echo::UcorfEchoService
+{
+    virtual bool Echo(EchoRequest & request, EchoResponse & response)
+    {
+        response.set_code(request.code());
+        return true;
+    }
+};
+
+static void Bench(const char* name, UcorfEchoServiceStub & stub)
+{
+    std::atomic<int> done{0};
+    std::atomic<size_t> errors{0};
+    co_chan<bool> finish(1);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < concurrecy; ++i)
+        go [&]{
+            EchoRequest request;
+            request.set_code(1);
+            EchoResponse response;
+            for (int j = 0; j < count_per_co; ++j) {
+                boost_ec ec = stub.Echo(request, &response);
+                if (ec || response.code() != 1)
+                    ++errors;
+            }
+
+            if (++done == concurrecy)
+                finish << true;
+        };
+
+    bool ok;
+    finish >> ok;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    size_t calls = (size_t)concurrecy * count_per_co;
+    std::printf("%-12s calls: %zu  errors: %zu  time: %lldms  qps: %lld  average: %.2fus\n",
+            name, calls, (size_t)errors, (long long)us / 1000,
+            (long long)(calls * 1000000 / (us + 1)), (double)us * concurrecy / calls);
+}
+
+int main(int argc, char **argv)
+{
+    using namespace ucorf;
+
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+        printf("Usage: inproc_bm.t [Coroutines] [CallsPerCoroutine]\n");
+        return 0;
+    }
+
+    if (argc > 1) concurrecy = atoi(argv[1]);
+    if (argc > 2) count_per_co = atoi(argv[2]);
+
+    const char* url = "inproc://echo";
+
+    Server server;
+    server.RegisterService(boost::shared_ptr<IService>(new MyEcho));
+    boost_ec ec = server.Listen(url);
+    if (ec) {
+        cout << "listen error: " << ec.message() << endl;
+        return 1;
+    }
+
+    auto serialize_opt = boost::make_shared<Option>();
+    serialize_opt->enable_stats = false;
+    Client serialize_client;
+    serialize_client.SetOption(serialize_opt).SetUrl(url);
+    UcorfEchoServiceStub serialize_stub(&serialize_client);
+
+    auto direct_opt = boost::make_shared<Option>();
+    direct_opt->enable_stats = false;
+    direct_opt->inproc_direct_call = true;
+    Client direct_client;
+    direct_client.SetOption(direct_opt).SetUrl(url);
+    UcorfEchoServiceStub direct_stub(&direct_client);
+
+    go [&]{
+        Bench("serialize", serialize_stub);
+        Bench("direct", direct_stub);
+        exit(0);
+    };
+
+    co_sched.RunLoop();
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <ucorf/client.h>
+#include <ucorf/introspect_service.h>
+#include <iostream>
+using std::cout;
+using std::endl;
+
+// 每秒查询一次server的服务列表和运行状态
+int main(int argc, char **argv)
+{
+    using namespace ucorf;
+
+    const char* url = "tcp://127.0.0.1:48080";
+    if (argc > 1)
+        url = argv[1];
+
+    Client client;
+    client.SetUrl(url);
+
+    go [&]{
+        StringMessage request, response;
+        boost_ec ec = client.Call(IntrospectService::service_name(), "ListServices", &request, &response);
+        if (ec)
+            cout << "ListServices error: " << ec.message() << endl;
+        else
+            cout << response.str() << endl;
+
+        for (;;) {
+            ec = client.Call(IntrospectService::service_name(), "Status", &request, &response);
+            if (ec)
+                cout << "Status error: " << ec.message() << endl;
+            else
+                cout << response.str() << endl;
+            co_sleep(1000);
+        }
+    };
+
+    co_sched.RunLoop();
+    return 0;
+}
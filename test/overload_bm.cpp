@@ -0,0 +1,148 @@
+#include <ucorf/server.h>
+#include <ucorf/client.h>
+#include <ucorf/net_transport.h>
+#include "echo.rpc.h"
+#include <iostream>
+#include <cstdio>
+#include <boost/smart_ptr/make_shared.hpp>
+#include <boost/thread.hpp>
+using std::cout;
+using std::endl;
+using namespace Echo;
+
+// 在同一进程内启动server和client, 用远超server处理能力的并发压测,
+// 对比开启/关闭CoDel过载保护时的成功QPS、拒绝数、超时数和延迟.
+static int concurrecy = 2000;
+static int handler_ms = 10;
+static int worker_c = 100;
+static int target_ms = 5;
+static std::atomic<size_t> g_count{0};
+static std::atomic<size_t> g_overload{0};
+static std::atomic<size_t> g_timeout{0};
+static std::atomic<size_t> g_error{0};
+static std::atomic<size_t> g_all_time{0};
+static std::atomic<int> g_max_time{0};
+
+struct SlowEcho : public ::Echo::UcorfEchoService
+{
+    virtual bool Echo(EchoRequest & request, EchoResponse & response)
+    {
+        co_sleep(handler_ms);
+        response.set_code(request.code());
+        return true;
+    }
+};
+
+void show_status()
+{
+    static int c = 0;
+    if (c++ % 10 == 0) {
+        std::printf("------- Co: %d  Handler: %dms  Workers: %d  Capacity: %d qps  CoDel target: %dms -------\n",
+                concurrecy, handler_ms, worker_c, worker_c * 1000 / handler_ms, target_ms);
+        std::printf("|   QPS   | overload | timeout |  error  | average D | max D \n");
+    }
+
+    static size_t last_count = 0, last_overload = 0, last_timeout = 0, last_error = 0;
+    size_t count = g_count, overload = g_overload, timeout = g_timeout, error = g_error;
+    int qps = (int)(count - last_count);
+    std::printf("|%7d  | %7d  | %6d  |%7d  | %5d     |%5d\n",
+            qps, (int)(overload - last_overload), (int)(timeout - last_timeout),
+            (int)(error - last_error), (int)(g_all_time / (qps + 1)), (int)g_max_time);
+    last_count = count;
+    last_overload = overload;
+    last_timeout = timeout;
+    last_error = error;
+    g_all_time = 0;
+    g_max_time = 0;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace ucorf;
+
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+        printf("Usage: overload_bm.t [Coroutines] [HandlerMs] [Workers] [TargetMs(0 means disable CoDel)] [ThreadCount]\n");
+        return 0;
+    }
+
+    if (argc > 1) concurrecy = atoi(argv[1]);
+    if (argc > 2) handler_ms = atoi(argv[2]);
+    if (argc > 3) worker_c = atoi(argv[3]);
+    if (argc > 4) target_ms = atoi(argv[4]);
+    int thread_c = 4;
+    if (argc > 5) thread_c = atoi(argv[5]);
+
+    std::string url = "tcp://127.0.0.1:48081";
+
+    ::network::OptionsUser tp_opt;
+    tp_opt.max_pack_size_ = 40960;
+
+    auto srv_opt = boost::make_shared<Option>();
+    srv_opt->transport_opt = tp_opt;
+    srv_opt->dispatch_mode = eDispatchMode::coroutine;
+    srv_opt->max_dispatch_coroutines = worker_c;
+    srv_opt->overload_target_ms = target_ms;
+
+    Server server;
+    server.SetOption(srv_opt).RegisterService(boost::shared_ptr<IService>(new SlowEcho));
+    boost_ec ec = server.Listen(url);
+    if (ec) {
+        cout << "listen error: " << ec.message() << endl;
+        return 1;
+    }
+
+    auto cli_opt = boost::make_shared<Option>();
+    cli_opt->transport_opt = tp_opt;
+    cli_opt->rcv_timeout_ms = 1000;
+
+    Client client;
+    client.SetOption(cli_opt).SetUrl(url);
+    UcorfEchoServiceStub stub(&client);
+
+    for (int i = 0; i < concurrecy; ++i)
+        go [&]{
+            EchoRequest request;
+            request.set_code(1);
+            EchoResponse response;
+
+            for (;;) {
+                auto now = std::chrono::system_clock::now();
+                boost_ec ec = stub.Echo(request, &response);
+                if (!ec) {
+                    ++g_count;
+                    int delay = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now() - now).count();
+                    g_all_time += delay;
+                    if (g_max_time < delay)
+                        g_max_time = delay;
+                    continue;
+                }
+
+                if (ec == MakeUcorfErrorCode(eUcorfErrorCode::ec_overload))
+                    ++g_overload;
+                else if (ec == MakeUcorfErrorCode(eUcorfErrorCode::ec_rcv_timeout))
+                    ++g_timeout;
+                else
+                    ++g_error;
+                co_sleep(1);
+            }
+        };
+
+    go []{
+        for (;;) {
+            co_sleep(1000);
+            show_status();
+        }
+    };
+
+    go []{
+        co_sleep(20000);
+        exit(0);
+    };
+
+    boost::thread_group tg;
+    for (int i = 0; i < thread_c; ++i)
+        tg.create_thread([]{ co_sched.RunLoop(); });
+    tg.join_all();
+    return 0;
+}
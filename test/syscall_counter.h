@@ -0,0 +1,80 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// 统计本进程的系统调用次数, 用于对比不同transport(epoll/io_uring)每个请求的系统调用开销.
+// 优先使用perf的raw_syscalls:sys_enter跟踪点, 统计所有系统调用, 包括之后创建的线程;
+// 需要tracefs可读且perf_event_paranoid允许, 所以要在创建其他线程之前构造.
+// 不可用时退回/proc/self/io中的syscr+syscw, 只包含读写类的系统调用(不含epoll_wait, io_uring_enter等).
+class SyscallCounter
+{
+public:
+    SyscallCounter() : fd_(Open()) {}
+
+    ~SyscallCounter()
+    {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    bool IsPrecise() const { return fd_ >= 0; }
+
+    const char* Name() const { return IsPrecise() ? "syscalls" : "rw syscalls"; }
+
+    // 累计次数
+    uint64_t Get() const
+    {
+        if (fd_ >= 0) {
+            uint64_t count = 0;
+            if (::read(fd_, &count, sizeof(count)) == sizeof(count))
+                return count;
+            return 0;
+        }
+
+        unsigned long long r = 0, w = 0;
+        FILE* fp = fopen("/proc/self/io", "r");
+        if (!fp) return 0;
+        char line[128];
+        while (fgets(line, sizeof(line), fp)) {
+            sscanf(line, "syscr: %llu", &r);
+            sscanf(line, "syscw: %llu", &w);
+        }
+        fclose(fp);
+        return r + w;
+    }
+
+private:
+    static int Open()
+    {
+        const char* paths[] = {
+            "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+        };
+        unsigned long long id = 0;
+        for (const char* path : paths) {
+            FILE* fp = fopen(path, "r");
+            if (!fp) continue;
+            if (fscanf(fp, "%llu", &id) != 1) id = 0;
+            fclose(fp);
+            if (id) break;
+        }
+        if (!id) return -1;
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.inherit = 1;
+        attr.exclude_kernel = 0;
+        return (int)::syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+
+private:
+    int fd_;
+};
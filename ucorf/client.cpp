@@ -25,6 +25,26 @@ namespace ucorf
         return impl_->Call(service_name, method_name, request, response);
     }
 
+    boost_ec Client::Call(std::string const& service_name,
+            std::string const& method_name,
+            IMessage *request, IMessage *response,
+            ePriority priority)
+    {
+        return impl_->Call(service_name, method_name, request, response, priority);
+    }
+
+    Client& Client::EnableCoalescing(std::string const& service_name,
+            std::string const& method_name, bool enable)
+    {
+        impl_->EnableCoalescing(service_name, method_name, enable);
+        return *this;
+    }
+
+    std::vector<MethodStats::Snapshot> Client::GetStats()
+    {
+        return impl_->GetStats();
+    }
+
     /// ------------------------ extend method --------------------------
     Client& Client::SetDispatcher(std::unique_ptr<IDispatcher> && dispatcher)
     {
@@ -19,6 +19,16 @@ namespace ucorf
                 std::string const& method_name,
                 IMessage *request, IMessage *response);
 
+        boost_ec Call(std::string const& service_name,
+                std::string const& method_name,
+                IMessage *request, IMessage *response,
+                ePriority priority);
+
+        Client& EnableCoalescing(std::string const& service_name,
+                std::string const& method_name, bool enable);
+
+        std::vector<MethodStats::Snapshot> GetStats();
+
         /// ------------------------ extend method --------------------------
     public:
         Client& SetDispatcher(std::unique_ptr<IDispatcher> && dispatcher);
@@ -3,14 +3,14 @@
 #include "dispatcher.h"
 #include "logger.h"
 #include "message.h"
-#include "net_transport.h"
+#include "inproc_transport.h"
 
 namespace ucorf
 {
     ClientImpl::ClientImpl()
         : opt_(new Option), dispatcher_(new RobinDispatcher),
         head_factory_(&UcorfHead::Factory), default_srv_finder_(new ServerFinder),
-        tp_factory_([]{ return static_cast<ITransportClient*>(new NetTransportClient); })
+        coalesce_methods_(new MethodSet)
     {
         default_srv_finder_->SetConnectedCb(boost::bind(&ClientImpl::OnConnected, this, _1, _2));
         default_srv_finder_->SetReceiveCb(boost::bind(&ClientImpl::OnReceiveData, this, _1, _2, _3, _4));
@@ -77,9 +77,70 @@ namespace ucorf
         return *this;
     }
 
+    ClientImpl& ClientImpl::EnableCoalescing(std::string const& service_name,
+            std::string const& method_name, bool enable)
+    {
+        std::unique_lock<co_mutex> lock(coalesce_mtx_);
+        boost::shared_ptr<MethodSet> methods(new MethodSet(*coalesce_methods_));
+        if (enable)
+            methods->insert(MethodSet::value_type(service_name, method_name));
+        else
+            methods->erase(MethodSet::value_type(service_name, method_name));
+
+        boost::shared_ptr<const MethodSet> const_methods(methods);
+        boost::atomic_store(&coalesce_methods_, const_methods);
+        return *this;
+    }
+
     boost_ec ClientImpl::Call(std::string const& service_name,
             std::string const& method_name,
             IMessage *request, IMessage *response)
+    {
+        return Call(service_name, method_name, request, response, opt_->priority);
+    }
+
+    std::vector<MethodStats::Snapshot> ClientImpl::GetStats()
+    {
+        return stats_.GetSnapshot();
+    }
+
+    boost_ec ClientImpl::Call(std::string const& service_name,
+            std::string const& method_name,
+            IMessage *request, IMessage *response,
+            ePriority priority)
+    {
+        Span span;
+        Tracer & tracer = Tracer::getInstance();
+        if (tracer.IsEnabled()) {
+            TraceContext parent = tracer.Current();
+            if (parent || Tracer::Sample(opt_->trace_sample_rate))
+                tracer.BeginSpan(span, eSpanKind::client, parent, service_name, method_name);
+        }
+
+        MethodStats* stats = nullptr;
+        MethodStats::clock_t::time_point start;
+        if (opt_->enable_stats) {
+            stats = stats_.Lookup(service_name, method_name);
+            start = MethodStats::clock_t::now();
+            stats->Enter();
+        }
+
+        MethodStats::Traffic traffic;
+        boost_ec ec = DoCall(service_name, method_name, request, response, priority,
+                span.Context(), traffic);
+
+        if (stats)
+            stats->Leave(MethodStats::clock_t::now() - start, ec, traffic);
+        if (span)
+            tracer.EndSpan(span, ec.value());
+        return ec;
+    }
+
+    boost_ec ClientImpl::DoCall(std::string const& service_name,
+            std::string const& method_name,
+            IMessage *request, IMessage *response,
+            ePriority priority, TraceContext const& trace,
+            MethodStats::Traffic & traffic)
     {
         if (wnd_size_ > opt_->request_wnd_size)
             return MakeUcorfErrorCode(eUcorfErrorCode::ec_req_wnd_full);
@@ -115,72 +176,114 @@ namespace ucorf
             return MakeUcorfErrorCode(eUcorfErrorCode::ec_no_estab);
         }
 
+        if (opt_->inproc_direct_call && response) {
+            if (InprocTransportClient *inproc = dynamic_cast<InprocTransportClient*>(tp.get())) {
+                boost::optional<boost_ec> ec = inproc->DirectCall(service_name, method_name,
+                        request, response, trace);
+                if (ec) return *ec;
+            }
+        }
+
         IHeaderPtr header = head_factory_();
         std::size_t msg_id = ++msg_id_;
         header->SetId(msg_id);
         header->SetType(response ? eHeaderType::request : eHeaderType::oneway_request);
-        header->SetFollowBytes(request->ByteSize());
         header->SetService(service_name);
         header->SetMethod(method_name);
+        if (opt_->header_extensions) {
+            header->SetPriority(priority);
+            if (trace)
+                header->SetTraceContext(trace);
+        }
         std::vector<char> buf;
-        buf.resize(header->ByteSize() + request->ByteSize());
-        header->Serialize(&buf[0], header->ByteSize());
-        request->Serialize(&buf[header->ByteSize()], request->ByteSize());
+        if (!SerializeFrame(*header, *request, buf))
+            return MakeUcorfErrorCode(eUcorfErrorCode::ec_parse_error);
+        traffic.out = header->GetFollowBytes();
         if (!response) {
             co_chan<boost_ec> cc(1);
             tp->Send(std::move(buf), [=](boost_ec const& ec) { cc << ec; });
             boost_ec ec;
             cc >> ec;
             return ec;
-        } else {
-            std::unique_lock<co_mutex> channel_lock(channel_mtx_);
-            auto it_1 = channels_.find(tp.get());
-            if (channels_.end() == it_1)
-                return MakeUcorfErrorCode(eUcorfErrorCode::ec_no_estab);
-            auto chan_grp = it_1->second;
-            channel_lock.unlock();
+        }
+
+        boost::shared_ptr<const MethodSet> coalesce_methods = boost::atomic_load(&coalesce_methods_);
+        if (!coalesce_methods->empty() &&
+                coalesce_methods->count(MethodSet::value_type(service_name, method_name))) {
+            // 以服务名+方法名+请求包体作为key, 与服务端的请求合并一致.
+            std::size_t body_len = header->GetFollowBytes();
+            std::string key;
+            key.reserve(service_name.size() + method_name.size() + 2 + body_len);
+            key.append(service_name).append(1, '\0').append(method_name).append(1, '\0');
+            key.append(&buf[buf.size() - body_len], body_len);
+            boost::shared_ptr<ResponseData> rsp = flight_.Do(key, [&]{
+                        return boost::make_shared<ResponseData>(
+                            this->Request(tp, msg_id, std::move(buf)));
+                    });
+            if (!rsp) return MakeUcorfErrorCode(eUcorfErrorCode::ec_call_error);
+            return ParseResponse(*rsp, response, traffic);
+        }
 
-            auto chan = RspChan(1);
-            int map_idx = msg_id & (e_chan_group_count - 1);
+        return ParseResponse(Request(tp, msg_id, std::move(buf)), response, traffic);
+    }
 
-            RspChanMap &chan_map = chan_grp->maps[map_idx];
-            co_mutex &mtx = chan_grp->mtxs[map_idx];
+    boost_ec ClientImpl::ParseResponse(ResponseData const& rsp, IMessage *response,
+            MethodStats::Traffic & traffic)
+    {
+        if (rsp.ec)
+            return rsp.ec;
 
-            std::unique_lock<co_mutex> map_lock(mtx);
-            if (chan_grp->closed[map_idx])
-                return MakeUcorfErrorCode(eUcorfErrorCode::ec_no_estab);
-            chan_map[msg_id] = chan;
-            map_lock.unlock();
-
-            tp->Send(&buf[0], buf.size(), [=](boost_ec const& ec){
-                        if (ec) {
-                            chan.TryPush(ec);
-                        }
-                    });
-            ++wnd_size_;
+        traffic.in = rsp.data.size();
+        if (rsp.data.empty() || !response->Parse(&rsp.data[0], rsp.data.size()))
+            return MakeUcorfErrorCode(eUcorfErrorCode::ec_parse_error);
 
-            ResponseData rsp;
-            if (opt_->rcv_timeout_ms) {
-                if (!chan.TimedPop(rsp, std::chrono::milliseconds(opt_->rcv_timeout_ms)))
-                    return MakeUcorfErrorCode(eUcorfErrorCode::ec_rcv_timeout);
-            } else
-                chan >> rsp;
+        return boost_ec();
+    }
 
-            --wnd_size_;
+    ClientImpl::ResponseData ClientImpl::Request(boost::shared_ptr<ITransportClient> tp,
+            std::size_t msg_id, std::vector<char> && buf)
+    {
+        std::unique_lock<co_mutex> channel_lock(channel_mtx_);
+        auto it_1 = channels_.find(tp.get());
+        if (channels_.end() == it_1)
+            return ResponseData(MakeUcorfErrorCode(eUcorfErrorCode::ec_no_estab));
+        auto chan_grp = it_1->second;
+        channel_lock.unlock();
 
-            {
-                std::unique_lock<co_mutex> map_lock(mtx);
-                chan_map.erase(msg_id);
-            }
+        auto chan = RspChan(1);
+        int map_idx = msg_id & (e_chan_group_count - 1);
+
+        RspChanMap &chan_map = chan_grp->maps[map_idx];
+        co_mutex &mtx = chan_grp->mtxs[map_idx];
+
+        std::unique_lock<co_mutex> map_lock(mtx);
+        if (chan_grp->closed[map_idx])
+            return ResponseData(MakeUcorfErrorCode(eUcorfErrorCode::ec_no_estab));
+        chan_map[msg_id] = chan;
+        map_lock.unlock();
 
-            if (rsp.ec)
-                return rsp.ec;
+        tp->Send(std::move(buf), [=](boost_ec const& ec){
+                    if (ec) {
+                        chan.TryPush(ec);
+                    }
+                });
+        ++wnd_size_;
 
-            if (rsp.data.empty() || !response->Parse(&rsp.data[0], rsp.data.size()))
-                return MakeUcorfErrorCode(eUcorfErrorCode::ec_parse_error);
+        ResponseData rsp;
+        if (opt_->rcv_timeout_ms) {
+            if (!chan.TimedPop(rsp, std::chrono::milliseconds(opt_->rcv_timeout_ms)))
+                rsp.ec = MakeUcorfErrorCode(eUcorfErrorCode::ec_rcv_timeout);
+        } else
+            chan >> rsp;
+
+        --wnd_size_;
+
+        {
+            std::unique_lock<co_mutex> map_lock(mtx);
+            chan_map.erase(msg_id);
         }
 
-        return boost_ec();
+        return rsp;
     }
 
     void ClientImpl::OnConnected(boost::shared_ptr<ITransportClient> tp, SessId sess_id)
@@ -268,6 +371,13 @@ namespace ucorf
 //        ucorf_log_debug("receive response. srv=%s, method=%s, msgid=%llu",
 //                header->GetService().c_str(), header->GetMethod().c_str(), (unsigned long long)header->GetId());
 
+        if (header->GetType() == eHeaderType::goaway) {
+            // 不再分配新请求到该连接, 已发出的请求继续等待响应, 连接由server关闭.
+            ucorf_log_info("server %s is going away", tp->RemoteUrl().c_str());
+            dispatcher_->Del(tp);
+            return ;
+        }
+
         std::size_t msg_id = header->GetId();
 
         std::unique_lock<co_mutex> channel_lock(channel_mtx_);
@@ -297,8 +407,15 @@ namespace ucorf
 
         ResponseData rsp;
         rsp.header = header;
-        rsp.data.resize(bytes);
-        memcpy(&rsp.data[0], data, bytes);
+        if (header->GetType() == eHeaderType::error_response) {
+            uint32_t code = (uint32_t)eUcorfErrorCode::ec_call_error;
+            if (bytes >= sizeof(code))
+                code = ntohl(*(uint32_t*)data);
+            rsp.ec = MakeUcorfErrorCode((eUcorfErrorCode)code);
+        } else {
+            rsp.data.resize(bytes);
+            memcpy(&rsp.data[0], data, bytes);
+        }
         chan.TryPush(rsp);
     }
 
@@ -5,6 +5,10 @@
 #include "transport.h"
 #include "option.h"
 #include "server_finder.h"
+#include "single_flight.h"
+#include "stats.h"
+#include "tracer.h"
+#include <set>
 
 namespace ucorf
 {
@@ -27,6 +31,19 @@ namespace ucorf
                 std::string const& method_name,
                 IMessage *request, IMessage *response);
 
+        boost_ec Call(std::string const& service_name,
+                std::string const& method_name,
+                IMessage *request, IMessage *response,
+                ePriority priority);
+
+        // 合并并发的相同调用(服务名, 方法名, 请求包体都相同),
+        // 只发送一次请求, 所有调用共享同一个响应.
+        ClientImpl& EnableCoalescing(std::string const& service_name,
+                std::string const& method_name, bool enable);
+
+        // 各方法的调用统计, Option::enable_stats开启时记录.
+        std::vector<MethodStats::Snapshot> GetStats();
+
         /// ------------------------ extend method --------------------------
     public:
         ClientImpl& SetDispatcher(std::unique_ptr<IDispatcher> && dispatcher);
@@ -41,6 +58,18 @@ namespace ucorf
         size_t OnReceiveData(boost::shared_ptr<ITransportClient> tp, SessId sess_id, const char* data, size_t bytes);
         void OnResponse(boost::shared_ptr<ITransportClient> tp, IHeaderPtr header, const char* data, size_t bytes);
 
+        boost_ec DoCall(std::string const& service_name,
+                std::string const& method_name,
+                IMessage *request, IMessage *response,
+                ePriority priority, TraceContext const& trace,
+                MethodStats::Traffic & traffic);
+
+        struct ResponseData;
+        ResponseData Request(boost::shared_ptr<ITransportClient> tp,
+                std::size_t msg_id, std::vector<char> && buf);
+        static boost_ec ParseResponse(ResponseData const& rsp, IMessage *response,
+                MethodStats::Traffic & traffic);
+
     private:
         struct ResponseData
         {
@@ -66,6 +95,7 @@ namespace ucorf
         };
         typedef std::unordered_map<ITransportClient*,
                     boost::shared_ptr<RspChanGroup>> ChannelMap;
+        typedef std::set<std::pair<std::string, std::string>> MethodSet;
         StubMap stubs_;
         std::string url_;
         co_mutex channel_mtx_;
@@ -79,6 +109,11 @@ namespace ucorf
         std::unique_ptr<ServerFinder> default_srv_finder_;
         std::list<std::unique_ptr<ServerFinder>> srv_finders_;
         TransportFactory tp_factory_;
+
+        co_mutex coalesce_mtx_;
+        boost::shared_ptr<const MethodSet> coalesce_methods_;
+        SingleFlight<boost::shared_ptr<ResponseData>> flight_;
+        StatsRegistry stats_;
     };
 
 } //namespace ucorf
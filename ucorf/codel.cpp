@@ -0,0 +1,65 @@
+#include "codel.h"
+#include <limits>
+
+namespace ucorf
+{
+    static const int64_t no_delay = std::numeric_limits<int64_t>::max();
+
+    static inline int64_t NowNs()
+    {
+        return std::chrono::duration_cast<Codel::duration_t>(
+                Codel::clock_t::now().time_since_epoch()).count();
+    }
+
+    Codel::Codel(int target_ms, int interval_ms)
+        : target_ns_((int64_t)target_ms * 1000000),
+        interval_ns_((int64_t)interval_ms * 1000000),
+        min_delay_ns_(no_delay),
+        interval_end_ns_(NowNs() + interval_ns_)
+    {
+    }
+
+    void Codel::SetTarget(int target_ms)
+    {
+        target_ns_ = (int64_t)target_ms * 1000000;
+    }
+
+    void Codel::SetInterval(int interval_ms)
+    {
+        interval_ns_ = (int64_t)interval_ms * 1000000;
+    }
+
+    bool Codel::Overloaded(duration_t delay)
+    {
+        const auto relaxed = std::memory_order_relaxed;
+        int64_t now = NowNs();
+        int64_t value = delay.count();
+
+        int64_t min_delay = min_delay_ns_.load(relaxed);
+        while (value < min_delay && !min_delay_ns_.compare_exchange_weak(min_delay, value, relaxed))
+            ;
+
+        // interval结束, 只有抢到更新interval_end_ns_的线程根据本interval的最小排队时长更新过载状态,
+        // 并以当前请求的排队时长开始新的interval.
+        int64_t interval_end = interval_end_ns_.load(relaxed);
+        if (now > interval_end &&
+                interval_end_ns_.compare_exchange_strong(interval_end, now + interval_ns_, relaxed)) {
+            min_delay = min_delay_ns_.exchange(value, relaxed);
+            overloaded_ = min_delay > target_ns_;
+        }
+
+        return overloaded_ && value > target_ns_ * 2;
+    }
+
+    bool Codel::IsOverloaded() const
+    {
+        return overloaded_;
+    }
+
+    Codel::duration_t Codel::MinDelay() const
+    {
+        int64_t min_delay = min_delay_ns_.load();
+        return duration_t(min_delay == no_delay ? 0 : min_delay);
+    }
+
+} //namespace ucorf
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "preheader.h"
+
+namespace ucorf
+{
+    // CoDel(Controlled Delay)过载检测.
+    // 每个interval结束时, 如果该interval内请求排队时长的最小值仍高于target,
+    // 认为进入过载状态. 过载状态下排队时长超过2倍target的请求应被直接拒绝.
+    class Codel
+    {
+    public:
+        typedef std::chrono::steady_clock clock_t;
+        typedef std::chrono::nanoseconds duration_t;
+
+        Codel(int target_ms = 5, int interval_ms = 100);
+
+        void SetTarget(int target_ms);
+        void SetInterval(int interval_ms);
+
+        // 记录一个请求的排队时长.
+        // @returns: 该请求是否应该被拒绝.
+        bool Overloaded(duration_t delay);
+
+        bool IsOverloaded() const;
+
+        // 当前interval内的最小排队时长, 还没有请求时为0.
+        duration_t MinDelay() const;
+
+    private:
+        std::atomic<int64_t> target_ns_;
+        std::atomic<int64_t> interval_ns_;
+        std::atomic<int64_t> min_delay_ns_;     // 当前interval内的最小排队时长, 没有请求时为INT64_MAX
+        std::atomic<int64_t> interval_end_ns_;
+        std::atomic<bool> overloaded_{false};
+    };
+
+} //namespace ucorf
@@ -0,0 +1,496 @@
+#include "datagram_transport.h"
+#include "stream_transport.h"
+#include "logger.h"
+#include <boost/algorithm/string.hpp>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ucorf
+{
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    static bool ParseDatagramAddress(std::string const& url, sockaddr_storage & addr, socklen_t & addr_len)
+    {
+        static const std::string udp_prefix = "udp://";
+        if (!boost::istarts_with(url, udp_prefix)) return false;
+        return ParseInetAddress(url.substr(udp_prefix.size()), addr, addr_len);
+    }
+
+    static int CreateDatagramSocket(int family, DatagramTransportOption const& opt)
+    {
+        int fd = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+
+        if (opt.rcvbuf_bytes > 0)
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt.rcvbuf_bytes, sizeof(opt.rcvbuf_bytes));
+        if (opt.sndbuf_bytes > 0)
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt.sndbuf_bytes, sizeof(opt.sndbuf_bytes));
+
+        // 接收时附带内核因缓冲区满丢弃的数据包累计数
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+        return fd;
+    }
+
+    DatagramStats& DatagramStats::operator+=(DatagramStats const& other)
+    {
+        rx_packets += other.rx_packets;
+        rx_bytes += other.rx_bytes;
+        rx_dropped += other.rx_dropped;
+        rx_overflow += other.rx_overflow;
+        tx_packets += other.tx_packets;
+        tx_bytes += other.tx_bytes;
+        tx_dropped += other.tx_dropped;
+        return *this;
+    }
+
+    // socket
+    DatagramSocket::DatagramSocket(int fd, DatagramTransportOption const& opt)
+        : fd_(fd), opt_(opt)
+    {
+    }
+
+    DatagramSocket::~DatagramSocket()
+    {
+        ::close(fd_);
+    }
+
+    void DatagramSocket::Start(OnPacketF const& on_packet, OnCloseF const& on_close)
+    {
+        DatagramSocketPtr self = shared_from_this();
+        go [=]{ self->RecvLoop(on_packet, on_close); };
+    }
+
+    void DatagramSocket::RecvLoop(OnPacketF on_packet, OnCloseF on_close)
+    {
+        // 每次recvmmsg最多收取的数据包数
+        const int batch = 16;
+        const std::size_t buf_size = 64 * 1024;
+        const std::size_t ctrl_size = CMSG_SPACE(sizeof(uint32_t));
+        std::vector<char> bufs(batch * buf_size);
+        std::vector<char> ctrls(batch * ctrl_size);
+        std::vector<sockaddr_storage> addrs(batch);
+        std::vector<iovec> iovs(batch);
+        std::vector<mmsghdr> msgs(batch);
+        uint32_t last_overflow = 0;
+
+        boost_ec ec;
+        while (!closed_)
+        {
+            // 在协程中poll会被hook, 等待期间切换到其他协程. Close()中的shutdown会唤醒poll.
+            pollfd pfd;
+            pfd.fd = fd_;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int r = ::poll(&pfd, 1, -1);
+            if (r < 0 && errno != EINTR) {
+                ec = MakeSysErrorCode(errno);
+                break;
+            }
+            if (r <= 0) continue;
+
+            while (!closed_)
+            {
+                for (int i = 0; i < batch; ++i) {
+                    iovs[i].iov_base = &bufs[i * buf_size];
+                    iovs[i].iov_len = buf_size;
+                    memset(&msgs[i], 0, sizeof(mmsghdr));
+                    msghdr & hdr = msgs[i].msg_hdr;
+                    hdr.msg_name = &addrs[i];
+                    hdr.msg_namelen = sizeof(sockaddr_storage);
+                    hdr.msg_iov = &iovs[i];
+                    hdr.msg_iovlen = 1;
+                    hdr.msg_control = &ctrls[i * ctrl_size];
+                    hdr.msg_controllen = ctrl_size;
+                }
+
+                int n = ::recvmmsg(fd_, &msgs[0], batch, MSG_DONTWAIT, nullptr);
+                if (n < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+                    // 已connect的socket收到对端端口不可达的ICMP, 忽略
+                    if (errno == ECONNREFUSED) continue;
+                    ec = MakeSysErrorCode(errno);
+                    closed_ = true;
+                    break;
+                }
+                if (n == 0) break;
+
+                for (int i = 0; i < n; ++i) {
+                    msghdr & hdr = msgs[i].msg_hdr;
+                    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL) continue;
+                        uint32_t overflow = 0;
+                        memcpy(&overflow, CMSG_DATA(cmsg), sizeof(overflow));
+                        rx_overflow_ += (uint32_t)(overflow - last_overflow);
+                        last_overflow = overflow;
+                    }
+
+                    ++rx_packets_;
+                    rx_bytes_ += msgs[i].msg_len;
+                    if (hdr.msg_flags & MSG_TRUNC) {
+                        ++rx_dropped_;
+                        continue;
+                    }
+
+                    on_packet(addrs[i], hdr.msg_namelen, &bufs[i * buf_size], msgs[i].msg_len);
+                }
+
+                if (n < batch) break;
+            }
+        }
+
+        closed_ = true;
+        if (on_close)
+            on_close(ec ? ec : MakeSysErrorCode(ECONNABORTED));
+    }
+
+    void DatagramSocket::Send(sockaddr_storage const* to, socklen_t to_len,
+            std::vector<char> && buf, OnSndF const& cb)
+    {
+        if (closed_) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        std::unique_lock<co_mutex> lock(mtx_);
+        if (send_queue_.size() >= opt_.max_send_queue) {
+            lock.unlock();
+            ++tx_dropped_;
+            if (cb) cb(MakeSysErrorCode(ENOBUFS));
+            return ;
+        }
+
+        send_queue_.push_back(Packet());
+        Packet & pkt = send_queue_.back();
+        pkt.to_len = to ? to_len : 0;
+        if (to)
+            memcpy(&pkt.to, to, to_len);
+        pkt.buf.swap(buf);
+        pkt.cb = cb;
+        if (writing_) return ;
+
+        writing_ = true;
+        lock.unlock();
+
+        DatagramSocketPtr self = shared_from_this();
+        go [=]{ self->WriteLoop(); };
+    }
+
+    void DatagramSocket::WriteLoop()
+    {
+        // 每次sendmmsg最多发送的数据包数
+        const std::size_t max_batch = 64;
+        std::vector<Packet> batch;
+        std::vector<iovec> iovs;
+        std::vector<mmsghdr> msgs;
+        for (;;)
+        {
+            batch.clear();
+            {
+                std::unique_lock<co_mutex> lock(mtx_);
+                if (send_queue_.empty()) {
+                    writing_ = false;
+                    return ;
+                }
+
+                while (!send_queue_.empty() && batch.size() < max_batch) {
+                    batch.push_back(std::move(send_queue_.front()));
+                    send_queue_.pop_front();
+                }
+            }
+
+            iovs.resize(batch.size());
+            msgs.resize(batch.size());
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                Packet & pkt = batch[i];
+                iovs[i].iov_base = pkt.buf.empty() ? nullptr : &pkt.buf[0];
+                iovs[i].iov_len = pkt.buf.size();
+                memset(&msgs[i], 0, sizeof(mmsghdr));
+                msghdr & hdr = msgs[i].msg_hdr;
+                hdr.msg_name = pkt.to_len ? &pkt.to : nullptr;
+                hdr.msg_namelen = pkt.to_len;
+                hdr.msg_iov = &iovs[i];
+                hdr.msg_iovlen = 1;
+            }
+
+            std::size_t idx = 0;
+            while (idx < batch.size())
+            {
+                if (closed_) {
+                    for (; idx < batch.size(); ++idx) {
+                        ++tx_dropped_;
+                        if (batch[idx].cb) batch[idx].cb(MakeSysErrorCode(ENOTCONN));
+                    }
+                    break;
+                }
+
+                int n = ::sendmmsg(fd_, &msgs[idx], batch.size() - idx, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (n > 0) {
+                    for (std::size_t end = idx + n; idx < end; ++idx) {
+                        ++tx_packets_;
+                        tx_bytes_ += batch[idx].buf.size();
+                        if (batch[idx].cb) batch[idx].cb(boost_ec());
+                    }
+                    continue;
+                }
+
+                int err = n < 0 ? errno : EAGAIN;
+                if (err == EINTR) continue;
+                if (err == EAGAIN || err == EWOULDBLOCK) {
+                    pollfd pfd;
+                    pfd.fd = fd_;
+                    pfd.events = POLLOUT;
+                    pfd.revents = 0;
+                    ::poll(&pfd, 1, 100);
+                    continue;
+                }
+
+                // 第一个数据包发送失败(如超过最大长度, 对端不可达), 丢弃后继续发送后面的
+                ++tx_dropped_;
+                if (batch[idx].cb) batch[idx].cb(MakeSysErrorCode(err));
+                ++idx;
+            }
+        }
+    }
+
+    void DatagramSocket::Close()
+    {
+        if (closed_.exchange(true)) return ;
+        // 唤醒阻塞在poll上的接收协程
+        ::shutdown(fd_, SHUT_RDWR);
+    }
+
+    DatagramStats DatagramSocket::GetStats() const
+    {
+        DatagramStats stats;
+        stats.rx_packets = rx_packets_;
+        stats.rx_bytes = rx_bytes_;
+        stats.rx_dropped = rx_dropped_;
+        stats.rx_overflow = rx_overflow_;
+        stats.tx_packets = tx_packets_;
+        stats.tx_bytes = tx_bytes_;
+        stats.tx_dropped = tx_dropped_;
+        return stats;
+    }
+
+    // server
+    DatagramTransportServer::DatagramTransportServer()
+        : on_receive_(boost::make_shared<OnReceiveF>())
+    {
+        ucorf_log_debug("DatagramTransportServer construct.");
+    }
+    DatagramTransportServer::~DatagramTransportServer()
+    {
+        ucorf_log_debug("DatagramTransportServer destruct.");
+        Shutdown();
+    }
+
+    void DatagramTransportServer::Shutdown()
+    {
+        if (sock_)
+            sock_->Close();
+    }
+    void DatagramTransportServer::SetReceiveCb(OnReceiveF const& cb)
+    {
+        *on_receive_ = cb;
+    }
+    void DatagramTransportServer::SetConnectedCb(OnConnectedF const&)
+    {
+    }
+    void DatagramTransportServer::SetDisconnectedCb(OnDisconnectedF const&)
+    {
+    }
+    void DatagramTransportServer::SetOption(boost::any const& opt)
+    {
+        if (const DatagramTransportOption* dgram_opt = boost::any_cast<DatagramTransportOption>(&opt))
+            opt_ = *dgram_opt;
+        else if (!opt.empty())
+            WarnUnknownOption("DatagramTransportServer", opt);
+    }
+
+    boost_ec DatagramTransportServer::Listen(std::string const& url)
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseDatagramAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = CreateDatagramSocket(addr.ss_family, opt_);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (::bind(fd, (sockaddr*)&addr, addr_len) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        url_ = BoundInetUrl(url, fd);
+        sock_.reset(new DatagramSocket(fd, opt_));
+        // 回调在接收协程中执行, 协程持有socket, 可以直接用裸指针
+        sock_->Start(boost::bind(&DatagramTransportServer::OnPacket, on_receive_, sock_.get(),
+                    _1, _2, _3, _4), DatagramSocket::OnCloseF());
+        return boost_ec();
+    }
+
+    void DatagramTransportServer::OnPacket(OnReceivePtr on_receive, DatagramSocket *sock,
+            sockaddr_storage const& from, socklen_t from_len, const char* data, size_t bytes)
+    {
+        PeerPtr peer(new Peer);
+        memcpy(&peer->addr, &from, from_len);
+        peer->addr_len = from_len;
+
+        // 一个数据包必须恰好是完整的帧, 否则整包丢弃
+        size_t consume = (*on_receive)(SessId(peer), data, bytes);
+        if (consume != bytes)
+            sock->Drop();
+    }
+
+    void DatagramTransportServer::Send(SessId id, const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(id, std::move(buf), cb);
+    }
+    void DatagramTransportServer::Send(SessId id, std::vector<char> && buf, OnSndF const& cb)
+    {
+        PeerPtr &peer = ::boost::any_cast<PeerPtr&>(id);
+        sock_->Send(&peer->addr, peer->addr_len, std::move(buf), cb);
+    }
+    std::string DatagramTransportServer::LocalUrl() const
+    {
+        return url_;
+    }
+    void DatagramTransportServer::ForEachSession(boost::function<void(SessId)> const&)
+    {
+        // 无连接
+    }
+    void DatagramTransportServer::Close(SessId)
+    {
+    }
+    DatagramStats DatagramTransportServer::GetStats() const
+    {
+        return sock_ ? sock_->GetStats() : DatagramStats();
+    }
+
+    // client
+    DatagramTransportClient::DatagramTransportClient()
+    {
+        ucorf_log_debug("DatagramTransportClient construct.");
+    }
+    DatagramTransportClient::~DatagramTransportClient()
+    {
+        ucorf_log_debug("DatagramTransportClient destruct.");
+        Shutdown();
+    }
+
+    void DatagramTransportClient::Shutdown()
+    {
+        DatagramSocketPtr sock = GetSocket();
+        if (sock)
+            sock->Close();
+    }
+    void DatagramTransportClient::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void DatagramTransportClient::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void DatagramTransportClient::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+    void DatagramTransportClient::SetOption(boost::any const& opt)
+    {
+        if (const DatagramTransportOption* dgram_opt = boost::any_cast<DatagramTransportOption>(&opt))
+            opt_ = *dgram_opt;
+        else if (!opt.empty())
+            WarnUnknownOption("DatagramTransportClient", opt);
+    }
+
+    boost_ec DatagramTransportClient::Connect(std::string const& url)
+    {
+        url_ = url;
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseDatagramAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = CreateDatagramSocket(addr.ss_family, opt_);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        // udp的connect只是绑定默认的目的地址, 不会等待对端
+        if (::connect(fd, (sockaddr*)&addr, addr_len) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        DatagramSocketPtr sock(new DatagramSocket(fd, opt_));
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            sock_ = sock;
+        }
+
+        if (on_connect_)
+            on_connect_(SessId(sock));
+
+        // socket可能比client活得更久, 回调按值持有
+        DatagramSocket *raw = sock.get();
+        OnReceiveF on_receive = on_receive_;
+        OnDisconnectedF on_disconnect = on_disconnect_;
+        sock->Start([=](sockaddr_storage const&, socklen_t, const char* data, size_t bytes) {
+                    if (on_receive(SessId(sock), data, bytes) != bytes)
+                        raw->Drop();
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("datagram socket closed: %s", ec.message().c_str());
+                    if (on_disconnect)
+                        on_disconnect(SessId(sock), ec);
+                });
+        return boost_ec();
+    }
+    void DatagramTransportClient::Send(const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(std::move(buf), cb);
+    }
+    void DatagramTransportClient::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        DatagramSocketPtr sock = GetSocket();
+        if (!sock) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        sock->Send(nullptr, 0, std::move(buf), cb);
+    }
+    bool DatagramTransportClient::IsEstab()
+    {
+        DatagramSocketPtr sock = GetSocket();
+        return sock && sock->IsOpen();
+    }
+    std::string DatagramTransportClient::RemoteUrl() const
+    {
+        return url_;
+    }
+    DatagramStats DatagramTransportClient::GetStats() const
+    {
+        DatagramSocketPtr sock = GetSocket();
+        return sock ? sock->GetStats() : DatagramStats();
+    }
+
+    DatagramSocketPtr DatagramTransportClient::GetSocket() const
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return sock_;
+    }
+
+} //namespace ucorf
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "preheader.h"
+#include "transport.h"
+#include <deque>
+#include <boost/enable_shared_from_this.hpp>
+#include <sys/socket.h>
+
+namespace ucorf
+{
+    // 通过Option::transport_opt设置
+    struct DatagramTransportOption
+    {
+        // socket的收发缓冲区大小, 0表示使用系统默认值.
+        // 接收缓冲区太小时突发流量会被内核丢弃(计入DatagramStats::rx_overflow).
+        int rcvbuf_bytes = 4 * 1024 * 1024;
+        int sndbuf_bytes = 0;
+
+        // 发送队列最多排队的数据包数, 超过后新的数据包直接丢弃.
+        std::size_t max_send_queue = 4096;
+    };
+
+    struct DatagramStats
+    {
+        uint64_t rx_packets = 0;    // 收到的数据包
+        uint64_t rx_bytes = 0;
+        uint64_t rx_dropped = 0;    // 不完整(截断, 包头错误)或无法分发而丢弃的数据包
+        uint64_t rx_overflow = 0;   // 接收缓冲区满被内核丢弃的数据包(SO_RXQ_OVFL)
+        uint64_t tx_packets = 0;    // 发出的数据包
+        uint64_t tx_bytes = 0;
+        uint64_t tx_dropped = 0;    // 发送队列满或发送失败而丢弃的数据包
+
+        DatagramStats& operator+=(DatagramStats const& other);
+    };
+
+    // udp socket, 每个数据包是一个完整的帧(包头+包体), 不拆包也不合并.
+    // 接收协程等待可读后用recvmmsg批量收取; 发送时排队, 由发送协程用sendmmsg批量发出.
+    class DatagramSocket : public boost::enable_shared_from_this<DatagramSocket>
+    {
+    public:
+        typedef ITransport::OnSndF OnSndF;
+        typedef boost::function<void(sockaddr_storage const& from, socklen_t from_len,
+                const char* data, size_t bytes)> OnPacketF;
+        typedef boost::function<void(boost_ec const&)> OnCloseF;
+
+        DatagramSocket(int fd, DatagramTransportOption const& opt);
+        ~DatagramSocket();
+
+        // 启动接收协程. @on_close: 关闭或出错时调用一次.
+        void Start(OnPacketF const& on_packet, OnCloseF const& on_close);
+
+        // @to: 目的地址, 已connect的socket传nullptr
+        void Send(sockaddr_storage const* to, socklen_t to_len, std::vector<char> && buf, OnSndF const& cb);
+
+        void Close();
+
+        bool IsOpen() const { return !closed_; }
+
+        int fd() const { return fd_; }
+
+        // 处理方丢弃一个已收到的数据包
+        void Drop() { ++rx_dropped_; }
+
+        DatagramStats GetStats() const;
+
+    private:
+        struct Packet
+        {
+            sockaddr_storage to;
+            socklen_t to_len;
+            std::vector<char> buf;
+            OnSndF cb;
+        };
+
+        void RecvLoop(OnPacketF on_packet, OnCloseF on_close);
+        void WriteLoop();
+
+    private:
+        int fd_;
+        DatagramTransportOption opt_;
+        std::atomic<bool> closed_{false};
+        co_mutex mtx_;
+        std::deque<Packet> send_queue_;
+        bool writing_ = false;
+
+        std::atomic<uint64_t> rx_packets_{0};
+        std::atomic<uint64_t> rx_bytes_{0};
+        std::atomic<uint64_t> rx_dropped_{0};
+        std::atomic<uint64_t> rx_overflow_{0};
+        std::atomic<uint64_t> tx_packets_{0};
+        std::atomic<uint64_t> tx_bytes_{0};
+        std::atomic<uint64_t> tx_dropped_{0};
+    };
+    typedef boost::shared_ptr<DatagramSocket> DatagramSocketPtr;
+
+    // udp://ip:port, 主要用于可以容忍丢包的大量oneway请求(如上报).
+    // 没有连接的概念, 不会触发Connected/Disconnected回调, SessId表示对端地址,
+    // 回复普通请求的响应时按数据包发回对端, 不保证送达.
+    // 单个帧不能超过一个udp数据包的大小(约64KB).
+    class DatagramTransportServer : public ITransportServer
+    {
+    public:
+        DatagramTransportServer();
+        ~DatagramTransportServer();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Listen(std::string const& url);
+        virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
+
+        DatagramStats GetStats() const;
+
+    private:
+        // 对端地址
+        struct Peer
+        {
+            sockaddr_storage addr;
+            socklen_t addr_len;
+        };
+        typedef boost::shared_ptr<Peer> PeerPtr;
+
+        // 接收协程持有回调而不是server, socket可以比server活得更久.
+        typedef boost::shared_ptr<OnReceiveF> OnReceivePtr;
+
+        static void OnPacket(OnReceivePtr on_receive, DatagramSocket *sock,
+                sockaddr_storage const& from, socklen_t from_len, const char* data, size_t bytes);
+
+    private:
+        std::string url_;
+        DatagramTransportOption opt_;
+        DatagramSocketPtr sock_;
+        OnReceivePtr on_receive_;
+    };
+
+    class DatagramTransportClient : public ITransportClient
+    {
+    public:
+        DatagramTransportClient();
+        ~DatagramTransportClient();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Connect(std::string const& url);
+        virtual void Send(const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual bool IsEstab();
+        virtual std::string RemoteUrl() const;
+
+        DatagramStats GetStats() const;
+
+    private:
+        DatagramSocketPtr GetSocket() const;
+
+    private:
+        std::string url_;
+        DatagramTransportOption opt_;
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        mutable co_mutex mtx_;
+        DatagramSocketPtr sock_;
+    };
+
+} //namespace ucorf
@@ -37,6 +37,9 @@ std::string ucorf_error_category::message(int v) const
 
         case (int)eUcorfErrorCode::ec_logic_error:
             return "logic error";
+
+        case (int)eUcorfErrorCode::ec_overload:
+            return "server overload";
     }
 
     return "";
@@ -19,6 +19,7 @@ namespace ucorf
         ec_unsupport_protocol   = 6,
         ec_req_wnd_full = 7,
         ec_logic_error  = 8,
+        ec_overload     = 9,
     };
 
     class ucorf_error_category
@@ -19,6 +19,8 @@ namespace ucorf
         virtual std::size_t GetFollowBytes();
         virtual std::string GetService();
         virtual std::string GetMethod() { return ""; }
+        virtual boost::string_ref ServiceRef(std::string &) { return "hprose"; }
+        virtual boost::string_ref MethodRef(std::string &) { return boost::string_ref(); }
 
         virtual bool Serialize(void* buf, std::size_t len);
         virtual std::size_t ByteSize();
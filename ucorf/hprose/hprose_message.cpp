@@ -6,10 +6,14 @@ Hprose_Message::Hprose_Message(std::string const& body)
     : body_(body)
 {
 }
+Hprose_Message::Hprose_Message(std::string && body)
+    : body_(std::move(body))
+{
+}
 bool Hprose_Message::Serialize(void * buf, std::size_t len)
 {
     if (len < ByteSize()) return false;
-    memcpy(buf, body_.data(), len);
+    memcpy(buf, body_.data(), body_.size());
     return true;
 }
 std::size_t Hprose_Message::ByteSize()
@@ -22,4 +26,46 @@ std::size_t Hprose_Message::Parse(const void * buf, std::size_t len)
     return len;
 }
 
+bool Hprose_Message::SerializeAppend(std::vector<char> & buf)
+{
+    buf.insert(buf.end(), body_.begin(), body_.end());
+    return true;
+}
+
+void Hprose_Reply::Add(std::unique_ptr<IMessage> && part)
+{
+    parts_.push_back(std::move(part));
+}
+bool Hprose_Reply::SerializeAppend(std::vector<char> & buf)
+{
+    if (encoded_) {
+        buf.insert(buf.end(), body_.begin(), body_.end());
+        return true;
+    }
+
+    for (auto & part : parts_)
+        if (!part->SerializeAppend(buf))
+            return false;
+    buf.push_back(hprose::TagEnd);
+    return true;
+}
+bool Hprose_Reply::Serialize(void * buf, std::size_t len)
+{
+    Encode();
+    if (len < body_.size()) return false;
+    memcpy(buf, body_.data(), body_.size());
+    return true;
+}
+std::size_t Hprose_Reply::ByteSize()
+{
+    Encode();
+    return body_.size();
+}
+void Hprose_Reply::Encode()
+{
+    if (encoded_) return ;
+    SerializeAppend(body_);
+    encoded_ = true;
+}
+
 } //namespace ucorf
@@ -2,6 +2,7 @@
 
 #include "preheader.h"
 #include "message.h"
+#include "hprose_protocol.h"
 #include <memory>
 
 namespace ucorf
@@ -11,11 +12,107 @@ namespace ucorf
     public:
         Hprose_Message() = default;
         explicit Hprose_Message(std::string const& body);
+        explicit Hprose_Message(std::string && body);
 
         virtual bool Serialize(void* buf, std::size_t len);
         virtual std::size_t ByteSize();
         virtual std::size_t Parse(const void* buf, std::size_t len);
+        virtual bool SerializeAppend(std::vector<char> & buf);
 
         std::string body_;
     };
+
+    // 批量调用的响应: 每个调用的结果(R<value>或E<error>)按顺序拼接, 最后是z.
+    class Hprose_Reply : public IMessage
+    {
+    public:
+        // @part: 一个调用的结果, 不带结尾的z
+        void Add(std::unique_ptr<IMessage> && part);
+
+        virtual bool SerializeAppend(std::vector<char> & buf);
+        virtual bool Serialize(void* buf, std::size_t len);
+        virtual std::size_t ByteSize();
+
+        // 只用于发送
+        virtual std::size_t Parse(const void*, std::size_t)
+        {
+            return 0;
+        }
+
+    private:
+        void Encode();
+
+    private:
+        std::vector<std::unique_ptr<IMessage>> parts_;
+        bool encoded_ = false;
+        std::vector<char> body_;
+    };
+
+    // 发送时才编码的hprose消息, 由encoder直接写入发送缓冲区, 不经过中间的字符串.
+    // @Encoder: void(hprose::Buffer & writer), 可能被调用多次(如重试), 每次结果应一致.
+    // @size_hint: 编码后长度的估计值, 用于预先分配发送缓冲区.
+    template <typename Encoder>
+    class Hprose_LazyMessage : public IMessage
+    {
+    public:
+        Hprose_LazyMessage(Encoder && encoder, std::size_t size_hint)
+            : encoder_(std::move(encoder)), size_hint_(size_hint) {}
+
+        virtual bool SerializeAppend(std::vector<char> & buf)
+        {
+            if (encoded_) {
+                buf.insert(buf.end(), body_.begin(), body_.end());
+                return true;
+            }
+
+            buf.reserve(buf.size() + size_hint_);
+            hprose::Buffer writer(buf);
+            encoder_(writer);
+            return true;
+        }
+
+        // 需要完整包体的场景(如响应缓存)编码到body_中, 之后复用.
+        virtual bool Serialize(void* buf, std::size_t len)
+        {
+            Encode();
+            if (len < body_.size()) return false;
+            memcpy(buf, body_.data(), body_.size());
+            return true;
+        }
+        virtual std::size_t ByteSize()
+        {
+            Encode();
+            return body_.size();
+        }
+
+        // 只用于发送
+        virtual std::size_t Parse(const void*, std::size_t)
+        {
+            return 0;
+        }
+
+    private:
+        void Encode()
+        {
+            if (encoded_) return ;
+            hprose::Buffer writer;
+            writer.s_.reserve(size_hint_);
+            encoder_(writer);
+            body_.swap(writer.s_);
+            encoded_ = true;
+        }
+
+    private:
+        Encoder encoder_;
+        std::size_t size_hint_;
+        bool encoded_ = false;
+        std::string body_;
+    };
+
+    template <typename Encoder>
+    std::unique_ptr<IMessage> MakeHproseMessage(Encoder && encoder, std::size_t size_hint)
+    {
+        typedef typename std::decay<Encoder>::type E;
+        return std::unique_ptr<IMessage>(new Hprose_LazyMessage<E>(E(std::forward<Encoder>(encoder)), size_hint));
+    }
 } //namespace ucorf
@@ -0,0 +1,469 @@
+#include "hprose_number.h"
+#include <stdlib.h>
+#include <limits>
+#include <cmath>
+
+namespace ucorf {
+namespace hprose {
+
+// 10^0 ~ 10^22, 都可以用double精确表示
+static const double kExactPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// 2^53, 更大的整数不能用double精确表示
+static const uint64_t kMaxExactInteger = 1ull << 53;
+
+static bool parse_double_slow(boost::string_ref s, double & f)
+{
+    // strtod需要'\0'结尾, 在栈上拷贝一份
+    char buf[64];
+    if (s.size() >= sizeof(buf)) return false;
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+
+    char *end = nullptr;
+    f = strtod(buf, &end);
+    return end == buf + s.size();
+}
+
+// 有效数字不超过2^53且10的指数不超过22时, 一次乘除法即可得到正确舍入的结果(Clinger),
+// 其他情况交给strtod.
+bool parse_double(boost::string_ref s, double & f)
+{
+    size_t pos = 0, size = s.size();
+    bool negative = false;
+    if (pos < size && (s[pos] == '-' || s[pos] == '+'))
+        negative = (s[pos++] == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0;         // 有效数字位数, 不含前导0
+    int exp10 = 0;
+    bool any_digit = false;
+    bool truncated = false;
+
+    for (; pos < size; ++pos) {
+        unsigned d = (unsigned char)s[pos] - '0';
+        if (d > 9) break;
+        any_digit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + d;
+            if (mantissa) ++digits;
+        } else {
+            ++exp10;
+            truncated |= (d != 0);
+        }
+    }
+
+    if (pos < size && s[pos] == '.') {
+        for (++pos; pos < size; ++pos) {
+            unsigned d = (unsigned char)s[pos] - '0';
+            if (d > 9) break;
+            any_digit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + d;
+                if (mantissa) ++digits;
+                --exp10;
+            } else {
+                truncated |= (d != 0);
+            }
+        }
+    }
+
+    if (!any_digit) return false;
+
+    if (pos < size && (s[pos] == 'e' || s[pos] == 'E')) {
+        ++pos;
+        bool exp_negative = false;
+        if (pos < size && (s[pos] == '-' || s[pos] == '+'))
+            exp_negative = (s[pos++] == '-');
+        if (pos == size) return false;
+
+        int e = 0;
+        for (; pos < size; ++pos) {
+            unsigned d = (unsigned char)s[pos] - '0';
+            if (d > 9) return false;
+            if (e < 100000) e = e * 10 + d;
+        }
+        exp10 += exp_negative ? -e : e;
+    }
+
+    if (pos != size) return false;
+
+    if (!truncated && mantissa <= kMaxExactInteger && exp10 >= -22 && exp10 <= 22) {
+        double v = (double)mantissa;
+        v = exp10 < 0 ? v / kExactPow10[-exp10] : v * kExactPow10[exp10];
+        f = negative ? -v : v;
+        return true;
+    }
+
+    return parse_double_slow(s, f);
+}
+
+// 两位数字的查找表, 每次除以100输出两位
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int CountDigits(uint64_t v)
+{
+    int n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+// 从p往前写两位数字
+static inline char* WritePair(char* p, uint32_t v)
+{
+    *--p = kDigitPairs[v * 2 + 1];
+    *--p = kDigitPairs[v * 2];
+    return p;
+}
+
+size_t format_unsigned(char* buf, uint64_t v)
+{
+    // 先算出位数, 从后往前直接写入buf
+    int len = CountDigits(v);
+    char* p = buf + len;
+
+    // 每次取8位, 之后都用32位运算
+    while (v >= 100000000) {
+        uint32_t lo = (uint32_t)(v % 100000000);
+        v /= 100000000;
+        p = WritePair(p, lo % 100);
+        p = WritePair(p, lo / 100 % 100);
+        p = WritePair(p, lo / 10000 % 100);
+        p = WritePair(p, lo / 1000000);
+    }
+
+    uint32_t u = (uint32_t)v;
+    while (u >= 100) {
+        p = WritePair(p, u % 100);
+        u /= 100;
+    }
+    if (u >= 10)
+        WritePair(p, u);
+    else
+        *--p = (char)('0' + u);
+    return len;
+}
+
+///////////////////////////////////////////////////////////////
+// Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers")
+// 用64位整数近似计算出在f的舍入区间内、位数尽量少的十进制数.
+namespace {
+
+// f * 2^e
+struct DiyFp
+{
+    uint64_t f;
+    int e;
+
+    DiyFp() : f(0), e(0) {}
+    DiyFp(uint64_t fp, int exp) : f(fp), e(exp) {}
+
+    DiyFp operator-(DiyFp const& rhs) const
+    {
+        return DiyFp(f - rhs.f, e);
+    }
+
+    // 取128位乘积的高64位, 四舍五入
+    DiyFp operator*(DiyFp const& rhs) const
+    {
+        unsigned __int128 p = (unsigned __int128)f * rhs.f;
+        uint64_t h = (uint64_t)(p >> 64);
+        uint64_t l = (uint64_t)p;
+        if (l & (1ull << 63))
+            ++h;
+        return DiyFp(h, e + rhs.e + 64);
+    }
+
+    DiyFp Normalize() const
+    {
+        int s = __builtin_clzll(f);
+        return DiyFp(f << s, e - s);
+    }
+};
+
+// IEEE754浮点数的布局
+template <typename Double>
+struct FloatTraits;
+
+template <>
+struct FloatTraits<double>
+{
+    typedef uint64_t Bits;
+    static const int kSignificandSize = 52;
+    static const int kExponentBias = 0x3FF + kSignificandSize;
+};
+
+template <>
+struct FloatTraits<float>
+{
+    typedef uint32_t Bits;
+    static const int kSignificandSize = 23;
+    static const int kExponentBias = 0x7F + kSignificandSize;
+};
+
+// 正的有限值分解为DiyFp, 以及舍入区间的上下边界m-, m+(已规格化, 指数相同)
+template <typename Double>
+static DiyFp Decompose(Double value, DiyFp & minus, DiyFp & plus)
+{
+    typedef FloatTraits<Double> T;
+    typename T::Bits bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint64_t hidden_bit = 1ull << T::kSignificandSize;
+    uint64_t significand = bits & (hidden_bit - 1);
+    int biased_e = (int)(bits >> T::kSignificandSize);
+
+    DiyFp v;
+    if (biased_e) {
+        v = DiyFp(significand + hidden_bit, biased_e - T::kExponentBias);
+    } else {
+        // 非规格化数
+        v = DiyFp(significand, 1 - T::kExponentBias);
+    }
+
+    plus = DiyFp((v.f << 1) + 1, v.e - 1).Normalize();
+    if (v.f == hidden_bit && biased_e > 1) {
+        // 2的整数次幂, 下方的间隔是上方的一半
+        minus = DiyFp((v.f << 2) - 1, v.e - 2);
+    } else {
+        minus = DiyFp((v.f << 1) - 1, v.e - 1);
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    return v;
+}
+
+// 10^k的64位近似值, k = -348, -340, ..., 340
+static const struct { uint64_t f; int e; } kCachedPowers[] = {
+        { 0xfa8fd5a0081c0288ull, -1220 }, { 0xbaaee17fa23ebf76ull, -1193 }, { 0x8b16fb203055ac76ull, -1166 },
+        { 0xcf42894a5dce35eaull, -1140 }, { 0x9a6bb0aa55653b2dull, -1113 }, { 0xe61acf033d1a45dfull, -1087 },
+        { 0xab70fe17c79ac6caull, -1060 }, { 0xff77b1fcbebcdc4full, -1034 }, { 0xbe5691ef416bd60cull, -1007 },
+        { 0x8dd01fad907ffc3cull, -980 }, { 0xd3515c2831559a83ull, -954 }, { 0x9d71ac8fada6c9b5ull, -927 },
+        { 0xea9c227723ee8bcbull, -901 }, { 0xaecc49914078536dull, -874 }, { 0x823c12795db6ce57ull, -847 },
+        { 0xc21094364dfb5637ull, -821 }, { 0x9096ea6f3848984full, -794 }, { 0xd77485cb25823ac7ull, -768 },
+        { 0xa086cfcd97bf97f4ull, -741 }, { 0xef340a98172aace5ull, -715 }, { 0xb23867fb2a35b28eull, -688 },
+        { 0x84c8d4dfd2c63f3bull, -661 }, { 0xc5dd44271ad3cdbaull, -635 }, { 0x936b9fcebb25c996ull, -608 },
+        { 0xdbac6c247d62a584ull, -582 }, { 0xa3ab66580d5fdaf6ull, -555 }, { 0xf3e2f893dec3f126ull, -529 },
+        { 0xb5b5ada8aaff80b8ull, -502 }, { 0x87625f056c7c4a8bull, -475 }, { 0xc9bcff6034c13053ull, -449 },
+        { 0x964e858c91ba2655ull, -422 }, { 0xdff9772470297ebdull, -396 }, { 0xa6dfbd9fb8e5b88full, -369 },
+        { 0xf8a95fcf88747d94ull, -343 }, { 0xb94470938fa89bcfull, -316 }, { 0x8a08f0f8bf0f156bull, -289 },
+        { 0xcdb02555653131b6ull, -263 }, { 0x993fe2c6d07b7facull, -236 }, { 0xe45c10c42a2b3b06ull, -210 },
+        { 0xaa242499697392d3ull, -183 }, { 0xfd87b5f28300ca0eull, -157 }, { 0xbce5086492111aebull, -130 },
+        { 0x8cbccc096f5088ccull, -103 }, { 0xd1b71758e219652cull, -77 }, { 0x9c40000000000000ull, -50 },
+        { 0xe8d4a51000000000ull, -24 }, { 0xad78ebc5ac620000ull, 3 }, { 0x813f3978f8940984ull, 30 },
+        { 0xc097ce7bc90715b3ull, 56 }, { 0x8f7e32ce7bea5c70ull, 83 }, { 0xd5d238a4abe98068ull, 109 },
+        { 0x9f4f2726179a2245ull, 136 }, { 0xed63a231d4c4fb27ull, 162 }, { 0xb0de65388cc8ada8ull, 189 },
+        { 0x83c7088e1aab65dbull, 216 }, { 0xc45d1df942711d9aull, 242 }, { 0x924d692ca61be758ull, 269 },
+        { 0xda01ee641a708deaull, 295 }, { 0xa26da3999aef774aull, 322 }, { 0xf209787bb47d6b85ull, 348 },
+        { 0xb454e4a179dd1877ull, 375 }, { 0x865b86925b9bc5c2ull, 402 }, { 0xc83553c5c8965d3dull, 428 },
+        { 0x952ab45cfa97a0b3ull, 455 }, { 0xde469fbd99a05fe3ull, 481 }, { 0xa59bc234db398c25ull, 508 },
+        { 0xf6c69a72a3989f5cull, 534 }, { 0xb7dcbf5354e9beceull, 561 }, { 0x88fcf317f22241e2ull, 588 },
+        { 0xcc20ce9bd35c78a5ull, 614 }, { 0x98165af37b2153dfull, 641 }, { 0xe2a0b5dc971f303aull, 667 },
+        { 0xa8d9d1535ce3b396ull, 694 }, { 0xfb9b7cd9a4a7443cull, 720 }, { 0xbb764c4ca7a44410ull, 747 },
+        { 0x8bab8eefb6409c1aull, 774 }, { 0xd01fef10a657842cull, 800 }, { 0x9b10a4e5e9913129ull, 827 },
+        { 0xe7109bfba19c0c9dull, 853 }, { 0xac2820d9623bf429ull, 880 }, { 0x80444b5e7aa7cf85ull, 907 },
+        { 0xbf21e44003acdd2dull, 933 }, { 0x8e679c2f5e44ff8full, 960 }, { 0xd433179d9c8cb841ull, 986 },
+        { 0x9e19db92b4e31ba9ull, 1013 }, { 0xeb96bf6ebadf77d9ull, 1039 }, { 0xaf87023b9bf0ee6bull, 1066 },
+};
+
+// 选一个10^K, 使 c * 2^e 的指数落在[-60, -32]区间
+static DiyFp GetCachedPower(int e, int & K)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;   // log10(2)
+    int k = (int)dk;
+    if (dk - k > 0.0)
+        ++k;
+
+    unsigned index = (unsigned)((k >> 3) + 1);
+    K = -(-348 + (int)index * 8);
+    return DiyFp(kCachedPowers[index].f, kCachedPowers[index].e);
+}
+
+static const uint32_t kPow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static int CountDecimalDigit32(uint32_t n)
+{
+    int digits = 1;
+    while (digits < 10 && n >= kPow10[digits])
+        ++digits;
+    return digits;
+}
+
+// 在区间内向w靠近, 调整最后一位数字
+static void GrisuRound(char* buffer, int len, uint64_t delta, uint64_t rest,
+        uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+            (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+// 生成Mp的数字, 区间宽度delta内的数字都可以舍去. 结果为 buffer * 10^K
+static void DigitGen(DiyFp const& W, DiyFp const& Mp, uint64_t delta,
+        char* buffer, int & len, int & K)
+{
+    const DiyFp one(1ull << -Mp.e, Mp.e);
+    const DiyFp wp_w = Mp - W;
+    uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = CountDecimalDigit32(p1);
+    len = 0;
+
+    // 整数部分
+    while (kappa > 0) {
+        uint32_t d = p1 / kPow10[kappa - 1];
+        p1 %= kPow10[kappa - 1];
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        --kappa;
+
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            K += kappa;
+            GrisuRound(buffer, len, delta, rest, (uint64_t)kPow10[kappa] << -one.e, wp_w.f);
+            return ;
+        }
+    }
+
+    // 小数部分
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        --kappa;
+
+        if (p2 < delta) {
+            K += kappa;
+            int index = -kappa;
+            GrisuRound(buffer, len, delta, p2, one.f, wp_w.f * (index < 10 ? kPow10[index] : 0));
+            return ;
+        }
+    }
+}
+
+template <typename Double>
+static void Grisu2(Double value, char* buffer, int & len, int & K)
+{
+    DiyFp w_m, w_p;
+    const DiyFp v = Decompose(value, w_m, w_p);
+    const DiyFp c_mk = GetCachedPower(w_p.e, K);
+    const DiyFp W = v.Normalize() * c_mk;
+    DiyFp Wp = w_p * c_mk;
+    DiyFp Wm = w_m * c_mk;
+    // 近似计算有1个单位的误差, 收窄区间保证结果可以还原
+    ++Wm.f;
+    --Wp.f;
+    DigitGen(W, Wp, Wp.f - Wm.f, buffer, len, K);
+}
+
+// 数字为 digits * 10^K, 按数量级选择定点或指数形式
+static size_t Prettify(char* buf, const char* digits, int len, int K)
+{
+    const int kk = len + K;   // 小数点的位置
+    size_t n = 0;
+
+    if (K >= 0 && kk <= 21) {
+        // 1234e7 -> 12340000000
+        memcpy(buf, digits, len);
+        n = len;
+        for (int i = 0; i < K; ++i)
+            buf[n++] = '0';
+        return n;
+    }
+
+    if (kk > 0 && kk <= 21) {
+        // 1234e-2 -> 12.34
+        memcpy(buf, digits, kk);
+        n = kk;
+        buf[n++] = '.';
+        memcpy(buf + n, digits + kk, len - kk);
+        return n + len - kk;
+    }
+
+    if (kk > -6 && kk <= 0) {
+        // 1234e-6 -> 0.001234
+        buf[n++] = '0';
+        buf[n++] = '.';
+        for (int i = kk; i < 0; ++i)
+            buf[n++] = '0';
+        memcpy(buf + n, digits, len);
+        return n + len;
+    }
+
+    // 1234e30 -> 1.234e33
+    buf[n++] = digits[0];
+    if (len > 1) {
+        buf[n++] = '.';
+        memcpy(buf + n, digits + 1, len - 1);
+        n += len - 1;
+    }
+    buf[n++] = 'e';
+    int exp = kk - 1;
+    if (exp < 0) {
+        buf[n++] = '-';
+        exp = -exp;
+    }
+    return n + format_unsigned(buf + n, (uint64_t)exp);
+}
+
+template <typename Double>
+static size_t FormatDouble(char* buf, Double f)
+{
+    size_t n = 0;
+    if (std::signbit(f)) {
+        buf[n++] = '-';
+        f = -f;
+    }
+
+    if (f == 0) {
+        buf[n++] = '0';
+        return n;
+    }
+
+    char digits[20];
+    int len = 0, K = 0;
+    Grisu2(f, digits, len, K);
+    return n + Prettify(buf + n, digits, len, K);
+}
+
+} //namespace
+
+size_t format_double(char* buf, double f)
+{
+    return FormatDouble(buf, f);
+}
+
+size_t format_double(char* buf, float f)
+{
+    return FormatDouble(buf, f);
+}
+
+} //namespace hprose
+} //namespace ucorf
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include <type_traits>
+#include <boost/utility/string_ref.hpp>
+
+// hprose数字的十进制编解码, 直接读写调用方的缓冲区, 不产生临时字符串.
+namespace ucorf {
+namespace hprose {
+
+// 十进制整数, 可带正负号, 不允许其他字符.
+// 无符号类型不接受负号, 超出Integer范围时返回false.
+template <typename Integer>
+inline bool parse_integer(boost::string_ref s, Integer & i)
+{
+    if (s.empty()) return false;
+
+    size_t pos = 0;
+    bool negative = false;
+    if (s[0] == '-' || s[0] == '+') {
+        negative = (s[0] == '-');
+        if (negative && !std::is_signed<Integer>::value) return false;
+        if (++pos == s.size()) return false;
+    }
+
+    // 绝对值的上限, 负数比正数多1
+    const unsigned long long limit = (unsigned long long)std::numeric_limits<Integer>::max()
+        + (negative ? 1 : 0);
+    unsigned long long v = 0;
+    for (; pos < s.size(); ++pos) {
+        unsigned d = (unsigned char)s[pos] - '0';
+        if (d > 9) return false;
+        if (v > (limit - d) / 10) return false;
+        v = v * 10 + d;
+    }
+
+    i = negative ? (Integer)(0 - v) : (Integer)v;
+    return true;
+}
+
+// [+-]digits[.digits][(e|E)[+-]digits], 结果正确舍入.
+bool parse_double(boost::string_ref s, double & f);
+
+// 无符号整数转十进制, @buf: 至少20字节. @returns: 写入的字节数.
+size_t format_unsigned(char* buf, uint64_t v);
+
+// @buf: 至少20字节. @returns: 写入的字节数.
+template <typename Integer>
+inline size_t format_integer(char* buf, Integer i)
+{
+    if (i < 0) {
+        *buf = '-';
+        // 先转成无符号再取反, 避免最小值溢出
+        return 1 + format_unsigned(buf + 1, 0 - (uint64_t)(int64_t)i);
+    }
+    return format_unsigned(buf, (uint64_t)i);
+}
+
+// 可以精确还原为f的最短十进制表示(Grisu2), 绝大多数情况下是最短的.
+// f不能是NaN或无穷大. @buf: 至少32字节. @returns: 写入的字节数.
+size_t format_double(char* buf, double f);
+size_t format_double(char* buf, float f);
+
+} //namespace hprose
+} //namespace ucorf
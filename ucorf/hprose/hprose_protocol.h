@@ -2,12 +2,25 @@
 
 #include <type_traits>
 #include <string>
+#include <vector>
 #include <stdlib.h>
 #include <limits>
 #include <time.h>
 #include <chrono>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/string_generator.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <string.h>
+#include <cmath>
+#include <unordered_map>
+#include <boost/preprocessor/variadic/size.hpp>
+#include <boost/preprocessor/variadic/to_seq.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/preprocessor/seq/for_each_i.hpp>
+#include <boost/preprocessor/punctuation/comma_if.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include "hprose_number.h"
 
 namespace ucorf {
 namespace hprose {
@@ -62,41 +75,223 @@ struct has_mapped_type
     static const bool value = noexcept(test<Container>((Container*)nullptr));
 };
 
+// 用户结构体的反射信息, 由ucorf_hprose_class宏生成特化.
+// 按hprose的class/object格式编解码, 字段按名字对应, 对端多出的字段被跳过.
+template <typename T>
+struct HproseClass
+{
+    static const bool value = false;
+};
+
+// 在全局命名空间中为结构体声明要序列化的字段, 例如:
+//   struct Person { std::string name; int age; };
+//   ucorf_hprose_class(Person, name, age)
+// hprose中的类名即为Type的写法.
+#define ucorf_hprose_class(Type, ...) \
+    namespace ucorf { namespace hprose { \
+    template <> \
+    struct HproseClass<Type> \
+    { \
+        static const bool value = true; \
+        static const char* name() { return #Type; } \
+        static size_t field_count() { return BOOST_PP_VARIADIC_SIZE(__VA_ARGS__); } \
+        static const char* const* field_names() { \
+            static const char* const names[] = { \
+                BOOST_PP_SEQ_FOR_EACH_I(_ucorf_hprose_field_name, _, BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__)) \
+            }; \
+            return names; \
+        } \
+        template <typename F> \
+        static void for_each(Type const& obj, F & f) { \
+            BOOST_PP_SEQ_FOR_EACH(_ucorf_hprose_field_visit, _, BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__)) \
+        } \
+        template <typename F> \
+        static bool visit(Type & obj, size_t idx, F & f) { \
+            switch (idx) { \
+                BOOST_PP_SEQ_FOR_EACH_I(_ucorf_hprose_field_case, _, BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__)) \
+            } \
+            return false; \
+        } \
+    }; \
+    } }
+
+#define _ucorf_hprose_field_name(r, data, i, field) BOOST_PP_COMMA_IF(i) BOOST_PP_STRINGIZE(field)
+#define _ucorf_hprose_field_visit(r, data, field) f(obj.field);
+#define _ucorf_hprose_field_case(r, data, i, field) case i: return f(obj.field);
+
+// 按list编解码的容器(vector, list, set等)
+template <typename Container>
+struct is_hprose_list
+{
+    static const bool value = !has_mapped_type<Container>::value
+        && !std::is_arithmetic<Container>::value && !HproseClass<Container>::value;
+};
+
+// utf-8字符的字节数, @leader: 首字节. 非法的首字节返回0.
+inline size_t utf8_seq_len(unsigned char leader)
+{
+    if (leader < 0x80) return 1;
+    if ((leader >> 5) == 0x6) return 2;
+    if ((leader >> 4) == 0xe) return 3;
+    if ((leader >> 3) == 0x1e) return 4;
+    return 0;
+}
+
+// 编码后长度的估计值, 用于预先分配发送缓冲区, 不要求精确.
+template <typename Number>
+inline typename std::enable_if<std::is_arithmetic<Number>::value, size_t>::type
+estimate_size(Number)
+{
+    return std::is_integral<Number>::value ? 12 : 24;
+}
+inline size_t estimate_size(nullptr_t) { return 1; }
+inline size_t estimate_size(boost::string_ref s) { return s.size() + 16; }
+inline size_t estimate_size(std::string const& s) { return s.size() + 16; }
+inline size_t estimate_size(const char* s) { return strlen(s) + 16; }
+inline size_t estimate_size(boost::uuids::uuid const&) { return 40; }
+
+template <typename Container>
+typename std::enable_if<has_mapped_type<Container>::value, size_t>::type
+estimate_size(Container const& container);
+
+template <typename T>
+typename std::enable_if<HproseClass<T>::value, size_t>::type
+estimate_size(T const& obj);
+
+template <typename Container>
+typename std::enable_if<is_hprose_list<Container>::value, size_t>::type
+estimate_size(Container const& container)
+{
+    size_t n = 16;
+    for (auto & elem : container)
+        n += estimate_size(elem);
+    return n;
+}
+
+template <typename Container>
+typename std::enable_if<has_mapped_type<Container>::value, size_t>::type
+estimate_size(Container const& container)
+{
+    size_t n = 16;
+    for (auto & kv : container)
+        n += estimate_size(kv.first) + estimate_size(kv.second);
+    return n;
+}
+
+struct estimate_field
+{
+    size_t n = 0;
+    template <typename T>
+    void operator()(T const& v) { n += estimate_size(v); }
+};
+
+template <typename T>
+typename std::enable_if<HproseClass<T>::value, size_t>::type
+estimate_size(T const& obj)
+{
+    estimate_field f;
+    HproseClass<T>::for_each(obj, f);
+    return f.n + 8;
+}
+
 struct Buffer
 {
     std::string s_;
     size_t read_pos_ = 0;
 
+    // 借用的只读数据, 非空时从这里读取, 否则读取s_.
+    const char* view_ = nullptr;
+    size_t view_len_ = 0;
+
+    // 读取时的引用表(按出现顺序记录可被引用的值的起始位置)和类定义表
+    struct ClassDef
+    {
+        boost::string_ref name;
+        std::vector<boost::string_ref> fields;
+    };
+    std::vector<size_t> refs_;
+    std::vector<ClassDef> classes_;
+    int replaying_ = 0;         // 正在重新读取被引用的值, 不再记录引用和类定义
+
+    // 嵌套的层数(列表, 对象, 引用), 超过max_depth_时读取失败,
+    // 避免对端构造很深的嵌套使递归读取栈溢出(协程栈一般只有1MB).
+    int depth_ = 0;
+    int max_depth_ = 64;
+
+    struct depth_sentry
+    {
+        Buffer *buf_;
+        explicit depth_sentry(Buffer * b) : buf_(b) { ++buf_->depth_; }
+        ~depth_sentry() { --buf_->depth_; }
+        bool ok() const { return buf_->depth_ <= buf_->max_depth_; }
+    };
+
     struct rb_sentry
     {
         Buffer *buf_ = nullptr;
         size_t pos_ = 0;
+        size_t refs_ = 0;
+        size_t classes_ = 0;
         bool commit_ = false;
 
         explicit rb_sentry(Buffer * b) : buf_(b) {
             pos_ = buf_->read_pos_;
+            refs_ = buf_->refs_.size();
+            classes_ = buf_->classes_.size();
         }
         size_t begin() { return pos_; }
         void commit() { commit_ = true; }
         ~rb_sentry() {
-            if (!commit_)
+            if (!commit_) {
                 buf_->read_pos_ = pos_;
+                buf_->refs_.resize(refs_);
+                buf_->classes_.resize(classes_);
+            }
         }
     };
 
+    // 写入时的引用表, 只有字符串按值去重, 其他可被引用的值只计数.
+    // 每个Buffer对应一条消息, 引用和类定义不跨消息.
+    // @simple_: 不写引用(类定义仍然只写一次). 旧版本的ucorf不能解析引用(r<n>;),
+    //           所以默认不写, 确认对端支持后再关闭. 读取时总是支持引用.
+    bool simple_ = true;
+    size_t ref_count_ = 0;
+    std::unordered_map<std::string, size_t> str_refs_;
+    std::string ref_key_;
+    std::vector<const char*> class_refs_;
+
+    // 写入的目标, 非空时追加到out_的末尾(如发送缓冲区), 否则写入s_.
+    std::vector<char>* out_ = nullptr;
+
     Buffer() {}
     explicit Buffer(std::string const& s) : s_(s) {}
-    Buffer(const void* b, size_t len) : s_((const char*)b, len) {}
+
+    // 编码的结果直接追加到out的末尾, 不经过s_.
+    explicit Buffer(std::vector<char> & out) : out_(&out) {}
+
+    // 不拷贝数据, 调用方需保证读取期间数据有效.
+    // 读出的boost::string_ref指向这块内存.
+    Buffer(const void* b, size_t len) : view_((const char*)b), view_len_(len) {}
 
     std::string const& str()
     {
         return s_;
     }
 
+    const char* rdata() const
+    {
+        return view_ ? view_ : s_.data();
+    }
+
+    size_t rsize() const
+    {
+        return view_ ? view_len_ : s_.size();
+    }
+
     int get()
     {
-        if (read_pos_ >= s_.size()) return -1;
-        return (int)(unsigned char)s_[read_pos_++];
+        if (read_pos_ >= rsize()) return -1;
+        return (int)(unsigned char)rdata()[read_pos_++];
     }
 
     void rollback(size_t n = 1)
@@ -105,32 +300,182 @@ struct Buffer
     }
 
     // 结果不包含字符c
-    std::string ReadUntil(char c)
+    boost::string_ref ReadUntil(char c)
     {
-        rb_sentry rb(this);
-        for (;;) {
-            int v = get();
-            if (v == -1)
-                return "";
-
-            if (v == c) {
-                rb.commit();
-                return s_.substr(rb.begin(), read_pos_ - rb.begin());
-            }
+        const char* data = rdata();
+        size_t size = rsize();
+        if (read_pos_ >= size) return boost::string_ref();
 
-            ++v;
-        }
+        const char* found = (const char*)memchr(data + read_pos_, c, size - read_pos_);
+        if (!found) return boost::string_ref();
+
+        boost::string_ref r(data + read_pos_, found - data - read_pos_);
+        read_pos_ = found - data + 1;
+        return r;
     }
 
     // 取N个bytes
-    std::string ReadN(size_t n)
+    boost::string_ref ReadN(size_t n)
     {
-        if (read_pos_ + n < s_.size()) {
+        if (n <= rsize() - read_pos_) {
             read_pos_ += n;
-            return s_.substr(read_pos_ - n, n);
+            return boost::string_ref(rdata() + read_pos_ - n, n);
+        }
+
+        return boost::string_ref();
+    }
+
+    // 清空读写的引用表和类定义, 批量调用中每个调用的引用单独计数.
+    void ResetRefs()
+    {
+        refs_.clear();
+        classes_.clear();
+        ref_count_ = 0;
+        str_refs_.clear();
+        class_refs_.clear();
+    }
+
+    int peek() const
+    {
+        if (read_pos_ >= rsize()) return -1;
+        return (int)(unsigned char)rdata()[read_pos_];
+    }
+
+    // 记录一个可被引用的值, @pos: 值的起始位置(tag)
+    void AddRef(size_t pos)
+    {
+        if (!replaying_)
+            refs_.push_back(pos);
+    }
+
+    // r<index>; 回到被引用的值的位置重新读取
+    template <typename T>
+    bool __ReadRef(T & value)
+    {
+        depth_sentry depth(this);
+        if (!depth.ok()) return false;
+        if (get() != TagRef) return false;
+        size_t idx = 0;
+        if (!parse_integer(ReadUntil(TagSemicolon), idx) || idx >= refs_.size())
+            return false;
+
+        size_t pos = read_pos_;
+        read_pos_ = refs_[idx];
+        ++replaying_;
+        bool r = __Read(value);
+        --replaying_;
+        read_pos_ = pos;
+        return r;
+    }
+
+    // c<len>"<name>"<count>{<field names>}
+    bool __ReadClass()
+    {
+        if (get() != TagClass) return false;
+        boost::string_ref len_s = ReadUntil(TagQuote);
+        size_t len = 0;
+        if (!parse_integer(len_s, len)) return false;
+        ClassDef def;
+        def.name = ReadN(len);
+        if (def.name.size() != len || get() != TagQuote) return false;
+
+        boost::string_ref count_s = ReadUntil(TagOpenbrace);
+        size_t count = 0;
+        if (!count_s.empty() && !parse_integer(count_s, count)) return false;
+        // 每个字段名至少占1个字节, 避免按对端给出的个数分配过大的内存
+        if (count > rsize() - read_pos_) return false;
+        def.fields.resize(count);
+        for (auto & field : def.fields)
+            if (!__Read(field))
+                return false;
+        if (get() != TagClosebrace) return false;
+
+        if (!replaying_)
+            classes_.push_back(std::move(def));
+        return true;
+    }
+
+    // 跳过一个任意类型的值, 其中可被引用的值照常记录.
+    bool Skip()
+    {
+        rb_sentry rb(this);
+        bool r = __Skip();
+        if (r) rb.commit();
+        return r;
+    }
+    bool __Skip()
+    {
+        depth_sentry depth(this);
+        if (!depth.ok()) return false;
+        size_t pos = read_pos_;
+        int v = get();
+        if (v == -1) return false;
+        if (v >= '0' && v <= '9') return true;
+
+        switch (v) {
+            case TagNull: case TagEmpty: case TagTrue: case TagFalse: case TagNaN:
+                return true;
+
+            case TagInfinity:
+                return get() != -1;
+
+            case TagInteger: case TagLong: case TagDouble: case TagRef:
+                return !ReadUntil(TagSemicolon).empty();
+
+            case TagUTF8Char: {
+                rollback();
+                boost::string_ref c;
+                return __ReadUTF8(c);
+            }
+
+            case TagString: case TagBytes: {
+                rollback();
+                boost::string_ref str;
+                return __Read(str);
+            }
+
+            case TagDate: case TagTime: {
+                rollback();
+                time_t t;
+                long long nano;
+                return __Read(t, nano);
+            }
+
+            case TagGuid: {
+                rollback();
+                boost::uuids::uuid uuid;
+                return __Read(uuid);
+            }
+
+            case TagList: case TagMap: {
+                AddRef(pos);
+                boost::string_ref count_s = ReadUntil(TagOpenbrace);
+                size_t count = 0;
+                if (!count_s.empty() && !parse_integer(count_s, count)) return false;
+                if (v == TagMap) count *= 2;
+                for (size_t i = 0; i < count; ++i)
+                    if (!__Skip())
+                        return false;
+                return get() == TagClosebrace;
+            }
+
+            case TagClass:
+                rollback();
+                return __ReadClass() && __Skip();
+
+            case TagObject: {
+                AddRef(pos);
+                size_t idx = 0;
+                if (!parse_integer(ReadUntil(TagOpenbrace), idx) || idx >= classes_.size())
+                    return false;
+                for (size_t i = 0; i < classes_[idx].fields.size(); ++i)
+                    if (!__Skip())
+                        return false;
+                return get() == TagClosebrace;
+            }
         }
 
-        return "";
+        return false;
     }
 
     // integer and long
@@ -155,22 +500,12 @@ struct Buffer
 
         if (v >= '0' && v <= '9') {
             // 个位数
-            i = (int)(v - '0');
+            i = (Integer)(v - '0');
             return true;
         }
 
-        if (v == TagInteger) {
-            // Integer
-            std::string const& s = ReadUntil(TagSemicolon);
-            i = (int)atoi(s.c_str());
-            return true;
-        }
-
-        if (v == TagLong) {
-            // Integer
-            std::string const& s = ReadUntil(TagSemicolon);
-            i = (long long)atoll(s.c_str());
-            return true;
+        if (v == TagInteger || v == TagLong) {
+            return parse_integer(ReadUntil(TagSemicolon), i);
         }
 
         return false;
@@ -212,8 +547,9 @@ struct Buffer
             return false;
         }
         if (v != TagDouble) return false;
-        std::string const& s = ReadUntil(TagSemicolon);
-        f = (double)atof(s.c_str());
+        double d = 0;
+        if (!parse_double(ReadUntil(TagSemicolon), d)) return false;
+        f = (Double)d;
         return true;
     }
 
@@ -241,33 +577,33 @@ struct Buffer
 
     // utf-8 char
     bool ReadUTF8(std::string & c)
+    {
+        boost::string_ref r;
+        if (!ReadUTF8(r)) return false;
+        c.assign(r.data(), r.size());
+        return true;
+    }
+    bool ReadUTF8(boost::string_ref & c)
     {
         rb_sentry rb(this);
-        bool r = __Read(c);
+        bool r = __ReadUTF8(c);
         if (r) rb.commit();
         return r;
     }
-    bool __ReadUTF8(std::string & c)
+    bool __ReadUTF8(boost::string_ref & c)
     {
         int v = get();
         if (v != TagUTF8Char) return false;
         int leader = get();
         if (leader == -1) return false;
 
-        int follow_bytes = 0;
-        for (; follow_bytes <= 6; ++follow_bytes)
-            if ((leader & (1 << (7 - follow_bytes))) == 0)
-                break;
-
-        std::string r;
-        r += leader;
-        if (follow_bytes) {
-            std::string s = ReadN(follow_bytes);
-            if (s.empty()) return false;
-            r += s;
-            r.swap(c);
-            return true;
-        }
+        size_t bytes = utf8_seq_len((unsigned char)leader);
+        if (!bytes) return false;
+
+        rollback();
+        boost::string_ref r = ReadN(bytes);
+        if (r.empty()) return false;
+        c = r;
         return true;
     }
 
@@ -295,71 +631,119 @@ struct Buffer
     }
     bool __Read(time_t &t, long long &nano)
     {
+        if (peek() == TagRef) {
+            get();
+            size_t idx = 0;
+            if (!parse_integer(ReadUntil(TagSemicolon), idx) || idx >= refs_.size())
+                return false;
+            size_t pos = read_pos_;
+            read_pos_ = refs_[idx];
+            ++replaying_;
+            bool r = __Read(t, nano);
+            --replaying_;
+            read_pos_ = pos;
+            return r;
+        }
+
+        AddRef(read_pos_);
         int v = get();
         if (v == -1) return false;
         if (v != TagDate && v != TagTime) return false;
 
         tm r;
         memset(&r, 0, sizeof(tm));
+        r.tm_isdst = -1;
 
+        // 以';'(本地时间)或'Z'(UTC)结尾, 取先出现的一个
         bool is_utc = false;
-        std::string s = ReadUntil(TagSemicolon);
-        if (s.empty()) {
-            is_utc = true;
-            s = ReadUntil(TagUTC);
-        }
-        if (s.empty()) return false;
+        const char* data = rdata() + read_pos_;
+        size_t size = rsize() - read_pos_;
+        size_t end = 0;
+        while (end < size && data[end] != TagSemicolon && data[end] != TagUTC)
+            ++end;
+        if (end == 0 || end == size) return false;
+        is_utc = (data[end] == TagUTC);
+        boost::string_ref s = ReadN(end);
+        get();
+
+        auto field = [&](size_t pos, size_t n, int & out) {
+            return pos + n <= s.size() && parse_integer(s.substr(pos, n), out);
+        };
 
         if (v == TagDate) {
-            // Date
-            if (s.size() < 8) return false;
-            r.tm_year = atoi(s.substr(0, 4).c_str()) - 1900;
-            r.tm_mon = atoi(s.substr(4, 2).c_str());
-            r.tm_mday = atoi(s.substr(6, 2).c_str());
-            s = s.substr(9);
+            // Date: YYYYMMDD, 后面可能跟T和时间
+            int year, mon, mday;
+            if (!field(0, 4, year) || !field(4, 2, mon) || !field(6, 2, mday)) return false;
+            r.tm_year = year - 1900;
+            r.tm_mon = mon - 1;
+            r.tm_mday = mday;
+            if (s.size() > 8) {
+                if (s[8] != TagTime) return false;
+                s = s.substr(9);
+            } else {
+                s = boost::string_ref();
+            }
         } else {
             r.tm_year = 70;
             r.tm_mon = 0;
             r.tm_mday = 1;
         }
 
-        if (s.size() >= 6) {
-            // Time
-            r.tm_hour = atoi(s.substr(0, 2).c_str());
-            r.tm_min = atoi(s.substr(2, 4).c_str());
-            r.tm_sec = atoi(s.substr(4, 6).c_str());
-
-            if (is_utc) {
-                // convert to local time.
-                time_t t = timegm(&r);
-                localtime_r(&t, &r);
-            }
-            t = mktime(&r);
+        nano = 0;
+        if (!s.empty()) {
+            // Time: hhmmss[.fraction]
+            if (!field(0, 2, r.tm_hour) || !field(2, 2, r.tm_min) || !field(4, 2, r.tm_sec))
+                return false;
 
             if (s.size() > 6) {
                 if (s[6] != TagPoint) return false;
-                std::string nanos = s.substr(7);
-                if (nanos.size() > 9) return false;
-                nanos.resize(9, '0');
-                nano = atol(nanos.c_str());
-            } else {
-                nano = 0;
+                boost::string_ref frac = s.substr(7);
+                if (frac.empty() || frac.size() > 9) return false;
+                if (!parse_integer(frac, nano)) return false;
+                for (size_t i = frac.size(); i < 9; ++i)
+                    nano *= 10;
             }
         }
 
+        if (is_utc) {
+            t = timegm(&r);
+        } else {
+            t = mktime(&r);
+        }
         return true;
     }
 
     // Bytes & String
+    // @utf8: 兼容旧接口, 按数据中的标记(s/b)区分字符串和二进制.
     bool Read(std::string & str, bool utf8 = false)
+    {
+        boost::string_ref r;
+        if (!Read(r)) return false;
+        str.assign(r.data(), r.size());
+        return true;
+    }
+    bool __Read(std::string & str)
+    {
+        boost::string_ref r;
+        if (!__Read(r)) return false;
+        str.assign(r.data(), r.size());
+        return true;
+    }
+
+    // 不拷贝, 结果指向读取的数据.
+    bool Read(boost::string_ref & str)
     {
         rb_sentry rb(this);
         bool r = __Read(str);
         if (r) rb.commit();
         return r;
     }
-    bool __Read(std::string & str, bool utf8 = false)
+    bool __Read(boost::string_ref & str)
     {
+        if (peek() == TagRef)
+            return __ReadRef(str);
+
+        size_t pos = read_pos_;
         int v = get();
         if (v == TagEmpty) {
             // empty string
@@ -368,8 +752,9 @@ struct Buffer
         }
 
         if (v != TagString && v != TagBytes) return false;
+        AddRef(pos);
 
-        std::string len_s = ReadUntil(TagQuote);
+        boost::string_ref len_s = ReadUntil(TagQuote);
         if (len_s.empty()) {
             if (get() == TagQuote) {
                 // empty string
@@ -380,26 +765,30 @@ struct Buffer
             return false;
         }
 
-        std::string result;
-        int len = atoi(len_s.c_str());
-        if (len <= 0) return false;
-        if (utf8) {
-            for (int i = 0; i < len; ++i)
-            {
-                std::string utf8_char;
-                if (!ReadUTF8(utf8_char))
-                    return false;
-
-                result += utf8_char;
+        size_t len = 0;
+        if (!parse_integer(len_s, len) || !len) return false;
+
+        // 字符串的长度是utf-16编码单元数, 4字节的utf-8字符占2个单元
+        size_t bytes = len;
+        if (v == TagString) {
+            const char* data = rdata();
+            size_t size = rsize();
+            size_t pos = read_pos_;
+            for (size_t units = 0; units < len; ) {
+                if (pos >= size) return false;
+                size_t n = utf8_seq_len((unsigned char)data[pos]);
+                if (!n) return false;
+                pos += n;
+                units += (n == 4) ? 2 : 1;
             }
-        } else {
-            std::string bin = ReadN(len);
-            if (bin.length() != (size_t)len) return false;
-            result.swap(bin);
+            bytes = pos - read_pos_;
         }
 
+        boost::string_ref result = ReadN(bytes);
+        if (result.size() != bytes) return false;
+
         if (get() == TagQuote) {
-            str.swap(result);
+            str = result;
             return true;
         }
 
@@ -415,13 +804,17 @@ struct Buffer
     }
     bool __Read(boost::uuids::uuid & uuid)
     {
+        if (peek() == TagRef)
+            return __ReadRef(uuid);
+
+        AddRef(read_pos_);
         if (get() != TagGuid) return false;
         if (get() != TagOpenbrace) return false;
-        std::string uuid_s = ReadUntil(TagClosebrace);
+        boost::string_ref uuid_s = ReadUntil(TagClosebrace);
         if (uuid_s.empty()) return false;
         try {
             boost::uuids::uuid n_uuid;
-            n_uuid = boost::uuids::string_generator()(uuid_s);
+            n_uuid = boost::uuids::string_generator()(uuid_s.begin(), uuid_s.end());
             n_uuid.swap(uuid);
             return true;
         } catch (std::exception &e) {
@@ -451,8 +844,7 @@ struct Buffer
     // std::vector & std::list & std::array & std::deque & std::set
     // @remarks: use container by iterator.
     template <typename Container>
-    typename std::enable_if<!has_mapped_type<Container>::value && !std::is_integral<Container>::value,
-             bool>::type
+    typename std::enable_if<is_hprose_list<Container>::value, bool>::type
     Read(Container & container)
     {
         rb_sentry rb(this);
@@ -462,12 +854,17 @@ struct Buffer
     }
 
     template <typename Container>
-    typename std::enable_if<!has_mapped_type<Container>::value && !std::is_integral<Container>::value,
-             bool>::type
+    typename std::enable_if<is_hprose_list<Container>::value, bool>::type
     __Read(Container & container)
     {
+        if (peek() == TagRef)
+            return __ReadRef(container);
+
+        depth_sentry depth(this);
+        if (!depth.ok()) return false;
+        AddRef(read_pos_);
         if (get() != TagList) return false;
-        std::string len_s = ReadUntil(TagOpenbrace);
+        boost::string_ref len_s = ReadUntil(TagOpenbrace);
         if (len_s.empty()) {
             if (get() == TagClosebrace) {
                 container.clear();
@@ -477,7 +874,10 @@ struct Buffer
             return false;
         }
 
-        int len = atoi(len_s.c_str());
+        size_t len = 0;
+        if (!parse_integer(len_s, len)) return false;
+        // 每个元素至少占1个字节, 避免按对端给出的长度分配过大的内存
+        if (len > rsize() - read_pos_) return false;
         Container c;
         c.resize(len);
         for (auto & elem : c)
@@ -492,23 +892,112 @@ struct Buffer
         return false;
     }
 
+    // user struct, 见ucorf_hprose_class
+    template <typename T>
+    typename std::enable_if<HproseClass<T>::value, bool>::type
+    Read(T & obj)
+    {
+        rb_sentry rb(this);
+        bool r = __Read(obj);
+        if (r) rb.commit();
+        return r;
+    }
+
+    struct read_field
+    {
+        Buffer *buf;
+        template <typename T>
+        bool operator()(T & v) { return buf->Read(v); }
+    };
+
+    // [c...]o<class index>{<field values>}
+    template <typename T>
+    typename std::enable_if<HproseClass<T>::value, bool>::type
+    __Read(T & obj)
+    {
+        typedef HproseClass<T> C;
+        int v = peek();
+        if (v == TagRef)
+            return __ReadRef(obj);
+
+        depth_sentry depth(this);
+        if (!depth.ok()) return false;
+        if (v == TagClass && !__ReadClass())
+            return false;
+
+        AddRef(read_pos_);
+        if (get() != TagObject) return false;
+        size_t idx = 0;
+        if (!parse_integer(ReadUntil(TagOpenbrace), idx) || idx >= classes_.size())
+            return false;
+
+        const char* const* names = C::field_names();
+        const size_t count = C::field_count();
+        read_field reader{this};
+        size_t fields = classes_[idx].fields.size();
+        for (size_t i = 0; i < fields; ++i) {
+            // 字段顺序一般与本地一致, 先按位置比较
+            boost::string_ref name = classes_[idx].fields[i];
+            size_t j = (i < count && name == names[i]) ? i : count;
+            for (size_t k = 0; j == count && k < count; ++k)
+                if (name == names[k])
+                    j = k;
+
+            if (j == count) {
+                if (!__Skip()) return false;
+            } else if (!C::visit(obj, j, reader)) {
+                return false;
+            }
+        }
+
+        return get() == TagClosebrace;
+    }
+
     ///////////////////////////////////////////////////////////////
-    // integer and long
-    void __Write(std::string const& s)
+    void Append(const char* p, size_t n)
+    {
+        if (out_)
+            out_->insert(out_->end(), p, p + n);
+        else
+            s_.append(p, n);
+    }
+
+    void Append(char c)
     {
-        s_ += s;
+        if (out_)
+            out_->push_back(c);
+        else
+            s_ += c;
+    }
+
+    void __Write(boost::string_ref s)
+    {
+        Append(s.data(), s.size());
     }
 
     void __Write(char c)
     {
-        s_ += c;
+        Append(c);
     }
 
     void Write(char c)
     {
-        s_ += c;
+        Append(c);
     }
 
+    // tag + 十进制长度 + 结束符, 如 s5" 或 a3{
+    void WriteLength(char tag, size_t len, char end)
+    {
+        char buf[24];
+        size_t n = 0;
+        buf[n++] = tag;
+        n += format_unsigned(buf + n, len);
+        buf[n++] = end;
+        Append(buf, n);
+    }
+
+    // integer and long
+
     template <typename Integer>
     typename std::enable_if<std::is_integral<Integer>::value && !std::is_same<Integer, bool>::value>::type
     Write(Integer i)
@@ -518,9 +1007,12 @@ struct Buffer
             return ;
         }
 
-        __Write(sizeof(Integer) <= 4 ? TagInteger : TagLong);
-        __Write(std::to_string(i));
-        __Write(TagSemicolon);
+        char buf[24];
+        size_t n = 0;
+        buf[n++] = sizeof(Integer) <= 4 ? TagInteger : TagLong;
+        n += format_integer(buf + n, i);
+        buf[n++] = TagSemicolon;
+        Append(buf, n);
     }
 
     // double (float)
@@ -528,30 +1020,23 @@ struct Buffer
     typename std::enable_if<std::is_floating_point<Double>::value>::type
     Write(Double f)
     {
-        typedef typename std::conditional<sizeof(Double) == 4, int32_t, int64_t>::type CInteger;
-        static const Double nan = std::numeric_limits<Double>::signaling_NaN();
-        if (*(CInteger*)&f == *(CInteger*)&nan) {
+        if (std::isnan(f)) {
             __Write(TagNaN);
             return ;
         }
 
-        static const Double inf = std::numeric_limits<Double>::infinity();
-        if (*(CInteger*)&f == *(CInteger*)&inf) {
+        if (std::isinf(f)) {
             __Write(TagInfinity);
-            __Write(TagPos);
+            __Write(f > 0 ? TagPos : TagNeg);
             return ;
         }
 
-        static const Double negative_inf = std::numeric_limits<Double>::infinity();
-        if (*(CInteger*)&f == *(CInteger*)&negative_inf) {
-            __Write(TagInfinity);
-            __Write(TagNeg);
-            return ;
-        }
-
-        __Write(TagDouble);
-        __Write(std::to_string(f));
-        __Write(TagSemicolon);
+        char buf[40];
+        size_t n = 0;
+        buf[n++] = TagDouble;
+        n += format_double(buf + n, f);
+        buf[n++] = TagSemicolon;
+        Append(buf, n);
     }
 
     // bool
@@ -581,41 +1066,104 @@ struct Buffer
     }
 
     // Bytes & String
-    int utf8_char_count(std::string const& str)
+    // utf-16编码单元数, 与读取时一致
+    static size_t utf8_char_count(boost::string_ref str)
     {
-        int chars = 0;
-        for (size_t i = 0; i < str.length(); ++i, ++chars)
+        size_t chars = 0;
+        for (size_t i = 0; i < str.size(); )
         {
-            char leader = str[i];
-            int follow_bytes = 0;
-            for (; follow_bytes <= 6; ++follow_bytes)
-                if ((leader & (1 << (7 - follow_bytes))) == 0)
-                    break;
-            i += follow_bytes;
+            size_t n = utf8_seq_len((unsigned char)str[i]);
+            if (!n) n = 1;
+            i += n;
+            chars += (n == 4) ? 2 : 1;
         }
         return chars;
     }
-    void Write(std::string const& str, bool utf8 = false)
+    void Write(boost::string_ref str, bool utf8 = false)
     {
         if (str.empty()) {
             __Write(TagEmpty);
             return ;
         }
 
-        __Write(utf8 ? TagString : TagBytes);
-        int len = utf8 ? utf8_char_count(str) : str.length();
-        __Write(std::to_string(len));
-        __Write(TagQuote);
+        char tag = utf8 ? TagString : TagBytes;
+        if (!simple_ && str.size() <= 64) {
+            // 重复的字符串写成引用, 长字符串很少重复, 不值得拷贝到表中
+            ref_key_.assign(1, tag);
+            ref_key_.append(str.data(), str.size());
+            auto it = str_refs_.find(ref_key_);
+            if (it != str_refs_.end()) {
+                WriteLength(TagRef, it->second, TagSemicolon);
+                return ;
+            }
+            str_refs_.emplace(ref_key_, ref_count_);
+        }
+
+        ++ref_count_;
+        WriteLength(tag, utf8 ? utf8_char_count(str) : str.size(), TagQuote);
         __Write(str);
         __Write(TagQuote);
     }
+    void Write(std::string const& str, bool utf8 = false)
+    {
+        Write(boost::string_ref(str), utf8);
+    }
     void Write(const char* sstr, bool utf8 = false)
     {
-        Write(std::string(sstr), utf8);
+        Write(boost::string_ref(sstr), utf8);
     }
 
     void Write(boost::uuids::uuid const& uuid)
     {
+        ++ref_count_;
+        __Write(TagGuid);
+        __Write(TagOpenbrace);
+        __Write(boost::uuids::to_string(uuid));
+        __Write(TagClosebrace);
+    }
+
+    // user struct, 见ucorf_hprose_class
+    // 每种类型的类定义在第一个对象之前写一次
+    struct write_field
+    {
+        Buffer *buf;
+        template <typename T>
+        void operator()(T const& v) { buf->Write(v); }
+    };
+
+    template <typename T>
+    typename std::enable_if<HproseClass<T>::value>::type
+    Write(T const& obj)
+    {
+        typedef HproseClass<T> C;
+        const char* name = C::name();
+        size_t idx = 0;
+        while (idx < class_refs_.size() && class_refs_[idx] != name)
+            ++idx;
+
+        if (idx == class_refs_.size()) {
+            class_refs_.push_back(name);
+            size_t name_len = strlen(name);
+            WriteLength(TagClass, name_len, TagQuote);
+            Append(name, name_len);
+            __Write(TagQuote);
+            size_t count = C::field_count();
+            if (count) {
+                char buf[24];
+                Append(buf, format_unsigned(buf, count));
+            }
+            __Write(TagOpenbrace);
+            const char* const* names = C::field_names();
+            for (size_t i = 0; i < count; ++i)
+                Write(boost::string_ref(names[i]), true);
+            __Write(TagClosebrace);
+        }
+
+        ++ref_count_;
+        WriteLength(TagObject, idx, TagOpenbrace);
+        write_field writer{this};
+        C::for_each(obj, writer);
+        __Write(TagClosebrace);
     }
 
     // std::map & std::unordered_map
@@ -630,18 +1178,18 @@ struct Buffer
     // std::vector & std::list & std::array & std::deque & std::set
     // @remarks: use container by iterator.
     template <typename Container>
-    typename std::enable_if<!has_mapped_type<Container>::value && !std::is_integral<Container>::value>::type
+    typename std::enable_if<is_hprose_list<Container>::value>::type
     Write(Container const& container)
     {
-        __Write(TagList);
+        ++ref_count_;
         if (container.size() == 0) {
+            __Write(TagList);
             __Write(TagOpenbrace);
             __Write(TagClosebrace);
             return ;
         }
 
-        __Write(std::to_string(container.size()));
-        __Write(TagOpenbrace);
+        WriteLength(TagList, container.size(), TagOpenbrace);
         for (auto &elem : container)
             Write(elem);
         __Write(TagClosebrace);
@@ -16,23 +16,38 @@ std::unique_ptr<IMessage> Hprose_Service::CallMethod(std::string const&,
     }
 
     if (flag == hprose::TagCall) {
-        std::string method;
-        if (!reader.Read(method, true))
-            return std::unique_ptr<IMessage>(new Hprose_Message("Es10\"Error Args\"z"));
-        return std::unique_ptr<IMessage>(new Hprose_Message(Call(method, reader)));
+        // 一个请求中可以有多个调用: C<name><args>C<name><args>...z
+        // 结果按顺序拼接, 每个调用的引用单独计数.
+        // 先找出所有调用, 超过上限时一个也不执行.
+        std::vector<CallRange> calls;
+        std::unique_ptr<Hprose_Reply> reply(new Hprose_Reply);
+        if (!SplitCalls(reader, calls)) {
+            reply->Add(TooManyCalls());
+            return std::unique_ptr<IMessage>(reply.release());
+        }
+
+        if (parallel_batch_ && calls.size() > 1)
+            return CallBatchParallel(request_data, calls);
+
+        for (auto & call : calls) {
+            Buffer sub(request_data + call.begin, call.end - call.begin);
+            reply->Add(CallOne(sub));
+        }
+        return std::unique_ptr<IMessage>(reply.release());
     }
 
     Buffer writer;
     writer.Write(hprose::TagError);
     writer.Write("No support protocol tag.");
     writer.Write(hprose::TagEnd);
-    return std::unique_ptr<IMessage>(new Hprose_Message(writer.str()));
+    return std::unique_ptr<IMessage>(new Hprose_Message(std::move(writer.s_)));
 }
 
 std::string Hprose_Service::GetFunctionList()
 {
     Buffer writer;
     writer.Write(hprose::TagFunctions);
+    std::unique_lock<co_mutex> lock(func_mutex_);
     std::vector<std::string> funcs;
     funcs.reserve(functions_.size());
     for (auto &kv : functions_)
@@ -42,30 +57,132 @@ std::string Hprose_Service::GetFunctionList()
     return writer.str();
 }
 
-std::string Hprose_Service::Call(std::string const& method, Buffer & reader)
+std::unique_ptr<IMessage> Hprose_Service::CallOne(Buffer & reader)
+{
+    reader.ResetRefs();
+    boost::string_ref method;
+    std::unique_ptr<IMessage> result;
+    if (reader.Read(method))
+        result = Call(method, reader);
+    else
+        result.reset(new Hprose_Message("Es10\"Error Args\""));
+
+    // 跳过没有读完的参数(嵌套深度受Buffer::max_depth_限制), 格式错误时不再处理后面的调用
+    for (int c = reader.peek(); c != -1 && c != hprose::TagCall && c != hprose::TagEnd; c = reader.peek()) {
+        if (!reader.Skip()) {
+            reader.read_pos_ = reader.rsize();
+            break;
+        }
+    }
+
+    return result;
+}
+
+bool Hprose_Service::SplitCalls(Buffer & reader, std::vector<CallRange> & calls)
+{
+    do {
+        if (calls.size() >= max_batch_calls_)
+            return false;
+
+        reader.ResetRefs();
+        size_t begin = reader.read_pos_;
+        for (int c = reader.peek(); c != -1 && c != hprose::TagCall && c != hprose::TagEnd; c = reader.peek()) {
+            if (!reader.Skip()) {
+                reader.read_pos_ = reader.rsize();
+                break;
+            }
+        }
+        calls.push_back(CallRange{begin, reader.read_pos_});
+    } while (reader.get() == hprose::TagCall);
+    return true;
+}
+
+std::unique_ptr<IMessage> Hprose_Service::CallBatchParallel(const char *request_data,
+        std::vector<CallRange> const& calls)
+{
+    // 各用一个reader在协程中执行, 其余的调用交给有界的协程池, 第一个在当前协程中执行
+    std::vector<std::unique_ptr<IMessage>> results(calls.size());
+    co_chan<bool> done(calls.size());
+    for (size_t i = 1; i < calls.size(); ++i)
+        batch_pool_.Post("", [&, i]{
+            Buffer sub(request_data + calls[i].begin, calls[i].end - calls[i].begin);
+            results[i] = CallOne(sub);
+            done << true;
+        });
+
+    Buffer first(request_data + calls[0].begin, calls[0].end - calls[0].begin);
+    results[0] = CallOne(first);
+    for (size_t i = 1; i < calls.size(); ++i) {
+        bool ok;
+        done >> ok;
+    }
+
+    std::unique_ptr<Hprose_Reply> reply(new Hprose_Reply);
+    for (auto & result : results)
+        reply->Add(std::move(result));
+    return std::unique_ptr<IMessage>(reply.release());
+}
+
+std::unique_ptr<IMessage> Hprose_Service::TooManyCalls()
 {
-    boost::shared_ptr<CalleeBase> sptr;
+    Buffer writer;
+    writer.Write(hprose::TagError);
+    writer.Write("Too Many Calls");
+    return std::unique_ptr<IMessage>(new Hprose_Message(std::move(writer.s_)));
+}
 
-    {
-        std::unique_lock<co_mutex> lock(func_mutex_);
-        auto it = functions_.find(method);
-        if (functions_.end() == it)
-            it = functions_.find("*");
+void Hprose_Service::SetWriteRefs(bool on)
+{
+    std::unique_lock<co_mutex> lock(func_mutex_);
+    write_refs_ = on;
+    for (auto &kv : functions_)
+        kv.second->write_refs = on;
+}
 
-        if (functions_.end() != it)
-            sptr = it->second;
+const Hprose_Service::FunctionTable* Hprose_Service::GetTable()
+{
+    if (dirty_.load(std::memory_order_acquire))
+        Publish();
+    return table_.load(std::memory_order_acquire);
+}
+
+void Hprose_Service::Publish()
+{
+    std::unique_lock<co_mutex> lock(func_mutex_);
+    if (!dirty_) return ;
+
+    std::unique_ptr<FunctionTable> table(new FunctionTable);
+    table->functions.reserve(functions_.size());
+    for (auto &kv : functions_) {
+        if (kv.first == "*")
+            table->wildcard = kv.second.get();
+        else
+            table->functions.emplace(boost::string_ref(kv.first), kv.second.get());
+    }
+
+    table_.store(table.get(), std::memory_order_release);
+    tables_.push_back(std::move(table));
+    dirty_ = false;
+}
+
+std::unique_ptr<IMessage> Hprose_Service::Call(boost::string_ref method, Buffer & reader)
+{
+    CalleeBase* callee = nullptr;
+    const FunctionTable* table = GetTable();
+    if (table) {
+        auto it = table->functions.find(method);
+        callee = (table->functions.end() != it) ? it->second : table->wildcard;
     }
 
-    if (!sptr) {
+    if (!callee) {
         // no callee, returns error.
         Buffer writer;
         writer.Write(hprose::TagError);
-        writer.Write(std::string("No Callee ") + method);
-        writer.Write(hprose::TagEnd);
-        return writer.str();
+        writer.Write("No Callee " + method.to_string());
+        return std::unique_ptr<IMessage>(new Hprose_Message(std::move(writer.s_)));
     }
 
-    return sptr->Call(reader);
+    return callee->Call(reader);
 }
 
 } //namespace hprose
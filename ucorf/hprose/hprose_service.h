@@ -7,145 +7,370 @@
 #include "error.h"
 #include "logger.h"
 #include "hprose_protocol.h"
+#include "request_scheduler.h"
+#include <boost/functional/hash.hpp>
+#include <tuple>
 
 namespace ucorf {
 namespace hprose {
 
     struct CalleeBase
     {
+        // 返回值中重复的字符串写成引用, 见Hprose_Service::SetWriteRefs
+        std::atomic<bool> write_refs{false};
+
         virtual ~CalleeBase() {}
-        virtual std::string Call(Buffer & reader) = 0;
+        virtual std::unique_ptr<IMessage> Call(Buffer & reader) = 0;
 
-        std::string R2Hprose(void)
+        // 返回一个调用的结果(R<value>), 不带结尾的z, 由Hprose_Reply拼接.
+        std::unique_ptr<IMessage> R2Hprose(void)
         {
-            Buffer buf;
-            buf.Write(hprose::TagResult);
-            buf.Write(hprose::TagEmpty);
-            buf.Write(hprose::TagEnd);
-            return buf.str();
+            return std::unique_ptr<IMessage>(new Hprose_Message(std::string{
+                        hprose::TagResult, hprose::TagEmpty}));
         }
 
+        // 返回值在发送时才编码, 直接写入发送缓冲区
         template <typename R>
-        std::string R2Hprose(R const& r)
+        std::unique_ptr<IMessage> R2Hprose(R && r)
         {
-            Buffer buf;
-            buf.Write(hprose::TagResult);
-            buf.Write(r);
-            buf.Write(hprose::TagEnd);
-            return buf.str();
+            typedef typename std::decay<R>::type result_t;
+            struct Encoder
+            {
+                result_t r;
+                bool refs;
+                void operator()(Buffer & writer)
+                {
+                    writer.simple_ = !refs;
+                    writer.Write(hprose::TagResult);
+                    writer.Write(r);
+                }
+            };
+            std::size_t size_hint = estimate_size(r) + 2;
+            return MakeHproseMessage(Encoder{std::forward<R>(r), write_refs.load(std::memory_order_relaxed)},
+                    size_hint);
         }
 
-        std::string error_arguments()
+        std::unique_ptr<IMessage> error_arguments()
         {
-            return "Es10\"Error Args\"z";
+            return std::unique_ptr<IMessage>(new Hprose_Message("Es10\"Error Args\""));
         }
     };
 
-    template <typename F>
-    struct Callee;
+    // C++11没有std::index_sequence
+    template <std::size_t ... I>
+    struct index_sequence {};
 
-    template <typename R>
-    struct Callee<R()> : public CalleeBase
+    template <std::size_t N, std::size_t ... I>
+    struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {};
+
+    template <std::size_t ... I>
+    struct make_index_sequence<0, I...>
     {
-        typedef boost::function<R()> func_t;
-        explicit Callee(func_t const& fn) : fn_(fn) {}
+        typedef index_sequence<I...> type;
+    };
 
-        virtual std::string Call(Buffer & reader) override
-        {
-            R result = fn_();
-            return R2Hprose(result);
-        }
+    // 可调用对象的签名: 函数指针, 或operator()唯一的仿函数(lambda, boost::function).
+    // 成员函数指针的特化用于取仿函数operator()的签名, 成员函数本身需要绑定对象后才能调用,
+    // 见RegisterFunction(method, obj, &C::fn).
+    template <typename F>
+    struct function_traits : function_traits<decltype(&F::operator())> {};
 
-        func_t fn_;
+    template <typename R, typename ... Args>
+    struct function_traits<R(Args...)>
+    {
+        typedef R result_type;
+        typedef std::tuple<typename std::decay<Args>::type...> args_type;
+        static const std::size_t arity = sizeof...(Args);
     };
 
-    template <typename R, typename Arg>
-    struct Callee<R(Arg)> : public CalleeBase
+    template <typename R, typename ... Args>
+    struct function_traits<R(*)(Args...)> : function_traits<R(Args...)> {};
+
+    template <typename C, typename R, typename ... Args>
+    struct function_traits<R(C::*)(Args...)> : function_traits<R(Args...)> {};
+
+    template <typename C, typename R, typename ... Args>
+    struct function_traits<R(C::*)(Args...) const> : function_traits<R(Args...)> {};
+
+    // 绑定了对象的成员函数
+    template <typename C, typename MF, typename R, typename ... Args>
+    struct bound_member
     {
-        typedef boost::function<R(Arg)> func_t;
-        explicit Callee(func_t const& fn) : fn_(fn) {}
+        C* obj;
+        MF fn;
 
-        virtual std::string Call(Buffer & reader) override
+        R operator()(Args... args) const
         {
-            Arg arg;
-            if (reader.Read(arg)) {
-                R result = fn_(arg);
-                return R2Hprose(result);
-            }
-
-            return error_arguments();
+            return (obj->*fn)(std::forward<Args>(args)...);
         }
-
-        func_t fn_;
     };
 
-    template <typename R, typename Arg1, typename Arg2>
-    struct Callee<R(Arg1, Arg2)> : public CalleeBase
+    // 注册时绑定F的确切类型, 调用时只有Call这一次虚调用:
+    // 参数直接解码到栈上的tuple中, 返回值在发送时编码.
+    template <typename F>
+    struct Callee : public CalleeBase
     {
-        typedef boost::function<R(Arg1, Arg2)> func_t;
-        explicit Callee(func_t const& fn) : fn_(fn) {}
+        typedef function_traits<F> traits;
+        typedef typename traits::result_type result_t;
+        typedef typename traits::args_type args_t;
 
-        virtual std::string Call(Buffer & reader) override
-        {
-            Arg1 arg1;
-            Arg2 arg2;
-            if (reader.Read(arg1) && reader.Read(arg2)) {
-                R result = fn_(arg1, arg2);
-                return R2Hprose(result);
-            }
+        static_assert(!std::is_member_function_pointer<F>::value,
+                "use RegisterFunction(method, obj, &C::fn) for member functions");
 
-            return error_arguments();
-        }
+        explicit Callee(F const& fn) : fn_(fn) {}
 
-        func_t fn_;
-    };
+        virtual std::unique_ptr<IMessage> Call(Buffer & reader) override
+        {
+            args_t args;
+            return Invoke(reader, args, typename make_index_sequence<traits::arity>::type(),
+                    std::is_void<result_t>());
+        }
 
-    template <typename R, typename Arg1, typename Arg2, typename Arg3>
-    struct Callee<R(Arg1, Arg2, Arg3)> : public CalleeBase
-    {
-        typedef boost::function<R(Arg1, Arg2, Arg3)> func_t;
-        explicit Callee(func_t const& fn) : fn_(fn) {}
+    private:
+        template <std::size_t ... I>
+        static bool ReadArgs(Buffer & reader, args_t & args, index_sequence<I...>)
+        {
+            // 整个参数列表只需要一次回滚
+            Buffer::rb_sentry rb(&reader);
+            bool ok = true;
+            int expand[] = {0, (ok = ok && reader.__Read(std::get<I>(args)), 0)...};
+            (void)expand;
+            if (ok) rb.commit();
+            return ok;
+        }
 
-        virtual std::string Call(Buffer & reader) override
+        template <std::size_t ... I>
+        std::unique_ptr<IMessage> Invoke(Buffer & reader, args_t & args, index_sequence<I...> seq,
+                std::false_type)
         {
-            Arg1 arg1;
-            Arg2 arg2;
-            Arg3 arg3;
-            if (reader.Read(arg1) && reader.Read(arg2) && reader.Read(arg3)) {
-                R result = fn_(arg1, arg2, arg3);
-                return R2Hprose(result);
-            }
+            if (!ReadArgs(reader, args, seq))
+                return error_arguments();
+            return R2Hprose(fn_(std::get<I>(args)...));
+        }
 
-            return error_arguments();
+        template <std::size_t ... I>
+        std::unique_ptr<IMessage> Invoke(Buffer & reader, args_t & args, index_sequence<I...> seq,
+                std::true_type)
+        {
+            if (!ReadArgs(reader, args, seq))
+                return error_arguments();
+            fn_(std::get<I>(args)...);
+            return R2Hprose();
         }
 
-        func_t fn_;
+        F fn_;
     };
 
+    // 注册表在注册时修改, 请求处理时读取的是它发布出来的不可变副本(FunctionTable):
+    // 查找不加锁也不分配内存, 注册后的第一次查找重新发布一次.
+    // 旧的副本可能还有请求在读, 保留到服务析构时释放, 所以运行中频繁注册会占用额外内存.
     class Hprose_Service : public IService
     {
     public:
         std::string name() override { return "hprose"; }
 
-        template <typename R, typename ... Args>
-        bool RegisterFunction(std::string const& method, boost::function<R(Args)...> const& fn)
+        // @method: "*"表示没有对应方法时的默认处理函数.
+        // @fn: 函数指针, lambda, boost::function等, operator()不能有重载.
+        //      直接传函数指针或lambda时省去boost::function的间接调用.
+        template <typename F>
+        bool RegisterFunction(std::string const& method, F fn)
         {
             std::unique_lock<co_mutex> lock(func_mutex_);
-            return functions_.insert(std::make_pair(method,
-                        boost::static_pointer_cast<CalleeBase>(boost::make_shared<Callee<R(Args)...>>(fn))
-                        )).second;
+            boost::shared_ptr<CalleeBase> callee = boost::make_shared<Callee<F>>(fn);
+            callee->write_refs = write_refs_;
+            bool ok = functions_.insert(std::make_pair(method, callee)).second;
+            if (ok)
+                dirty_ = true;
+            return ok;
         }
 
+        // 注册成员函数, 调用时作用于@obj. @obj需要在服务的整个生命周期内有效.
+        template <typename C, typename R, typename ... Args>
+        bool RegisterFunction(std::string const& method, C* obj, R (C::*fn)(Args...))
+        {
+            typedef R (C::*MF)(Args...);
+            return RegisterFunction(method, bound_member<C, MF, R, Args...>{obj, fn});
+        }
+
+        template <typename C, typename R, typename ... Args>
+        bool RegisterFunction(std::string const& method, C const* obj, R (C::*fn)(Args...) const)
+        {
+            typedef R (C::*MF)(Args...) const;
+            return RegisterFunction(method, bound_member<C const, MF, R, Args...>{obj, fn});
+        }
+
+        // 一个请求中有多个调用(C...C...z)时, 是否在各自的协程中并行执行. 默认按顺序执行.
+        // @max_workers: 并行执行的协程池大小, 所有请求共用, 超出的调用排队.
+        void SetParallelBatch(bool parallel, std::size_t max_workers = 64)
+        {
+            parallel_batch_ = parallel;
+            batch_pool_.SetMaxWorkers(max_workers);
+        }
+
+        // 一个请求中最多的调用数, 超过时整个请求的调用都不执行, 返回一个错误.
+        void SetMaxBatchCalls(std::size_t max_calls) { max_batch_calls_ = max_calls; }
+
+        // 返回值中重复的字符串写成引用(r<n>;), 可以减小响应. 旧版本的ucorf客户端不能解析引用,
+        // 所以默认关闭, 确认所有客户端都已升级后再开启.
+        void SetWriteRefs(bool on);
+
         std::unique_ptr<IMessage> CallMethod(std::string const&,
                 const char *request_data, size_t request_bytes) override;
 
     private:
+        struct StringRefHash
+        {
+            std::size_t operator()(boost::string_ref s) const
+            {
+                return boost::hash_range(s.begin(), s.end());
+            }
+        };
+
+        // key指向functions_中的方法名, functions_只增不删, 所以一直有效.
+        struct FunctionTable
+        {
+            std::unordered_map<boost::string_ref, CalleeBase*, StringRefHash> functions;
+            CalleeBase* wildcard = nullptr;     // "*"
+        };
+
         std::string GetFunctionList();
 
-        std::string Call(std::string const& method, Buffer & reader);
+        std::unique_ptr<IMessage> Call(boost::string_ref method, Buffer & reader);
+
+        // 读方法名并调用, reader停在下一个调用或结尾处
+        std::unique_ptr<IMessage> CallOne(Buffer & reader);
+
+        // 一个调用在请求中的范围, 从方法名开始
+        struct CallRange
+        {
+            size_t begin;
+            size_t end;
+        };
+
+        // 找出请求中每个调用的范围, 调用数超过max_batch_calls_时返回false.
+        bool SplitCalls(Buffer & reader, std::vector<CallRange> & calls);
+
+        std::unique_ptr<IMessage> CallBatchParallel(const char *request_data,
+                std::vector<CallRange> const& calls);
+
+        std::unique_ptr<IMessage> TooManyCalls();
+
+        const FunctionTable* GetTable();
+
+        void Publish();
 
         co_mutex func_mutex_;
         std::map<std::string, boost::shared_ptr<CalleeBase>> functions_;
+        std::atomic<bool> dirty_{false};
+        std::atomic<const FunctionTable*> table_{nullptr};
+        std::vector<std::unique_ptr<FunctionTable>> tables_;  // 发布过的所有副本
+        bool parallel_batch_ = false;
+        bool write_refs_ = false;
+        std::size_t max_batch_calls_ = 128;
+        RequestScheduler batch_pool_{64};
+    };
+
+    // 批量调用: 多个调用编码在一个请求中, 一次往返返回所有结果.
+    //   Hprose_Batch batch;
+    //   batch.Add("add", 1);
+    //   batch.Add("users", 3);
+    //   boost_ec ec = stub.CallBatch(batch);
+    //   int sum = batch.Result<int>(0, ec);
+    class Hprose_Batch
+    {
+    public:
+        // 参数中重复的字符串写成引用, 见Hprose_ServiceStub::SetWriteRefs. 需在Add前设置.
+        void SetWriteRefs(bool on) { write_refs_ = on; }
+
+        // @returns: 调用的序号, 用于取结果
+        template <typename ... Args>
+        std::size_t Add(std::string const& method, Args && ... args)
+        {
+            // 每个调用用新的writer, 引用单独计数
+            Buffer writer(request_);
+            writer.simple_ = !write_refs_;
+            writer.Write(hprose::TagCall);
+            writer.Write(method, true);
+            int expand[] = {0, (writer.Write(args), 0)...};
+            (void)expand;
+            return count_++;
+        }
+
+        std::size_t size() const { return count_; }
+
+        // 第idx个调用的返回值, 服务端返回错误时ec为ec_logic_error.
+        template <typename R>
+        R Result(std::size_t idx, boost_ec & ec)
+        {
+            if (idx >= results_.size()) {
+                ec = MakeUcorfErrorCode(eUcorfErrorCode::ec_call_error);
+                return R();
+            }
+
+            Slot const& slot = results_[idx];
+            Buffer reader(response_.body_.data() + slot.begin, slot.end - slot.begin);
+            if (slot.error) {
+                std::string err;
+                if (!reader.Read(err))
+                    err = "Parse Response Error";
+                ucorf_log_error("returns error:%s", err.c_str());
+                ec = MakeUcorfErrorCode(eUcorfErrorCode::ec_logic_error);
+                return R();
+            }
+
+            R r;
+            if (!reader.Read(r)) {
+                ec = MakeUcorfErrorCode(eUcorfErrorCode::ec_parse_error);
+                return R();
+            }
+            ec = boost_ec();
+            return r;
+        }
+
+        void Clear()
+        {
+            request_.clear();
+            count_ = 0;
+            response_.body_.clear();
+            results_.clear();
+        }
+
+    private:
+        friend class Hprose_ServiceStub;
+
+        // 按顺序记下每个结果的位置
+        bool ParseResponse()
+        {
+            results_.clear();
+            Buffer reader(response_.body_.data(), response_.body_.size());
+            for (;;) {
+                int flag = reader.get();
+                if (flag == hprose::TagEnd) break;
+                if (flag != hprose::TagResult && flag != hprose::TagError) return false;
+
+                reader.ResetRefs();
+                Slot slot;
+                slot.begin = reader.read_pos_;
+                if (!reader.Skip()) return false;
+                slot.end = reader.read_pos_;
+                slot.error = (flag == hprose::TagError);
+                results_.push_back(slot);
+            }
+            return results_.size() == count_;
+        }
+
+        struct Slot
+        {
+            std::size_t begin;
+            std::size_t end;
+            bool error;
+        };
+
+        std::vector<char> request_;     // 已编码的调用, 不含结尾的z
+        std::size_t count_ = 0;
+        bool write_refs_ = false;
+        Hprose_Message response_;
+        std::vector<Slot> results_;
     };
 
     class Hprose_ServiceStub : public IServiceStub
@@ -155,21 +380,33 @@ namespace hprose {
 
         std::string name() override { return "hprose"; }
 
+        // 参数中重复的字符串(包括与方法名相同的参数)写成引用(r<n>;), 可以减小请求.
+        // 旧版本的ucorf服务端不能解析引用, 所以默认关闭, 确认服务端都已升级后再开启.
+        void SetWriteRefs(bool on) { write_refs_ = on; }
+
         template <typename R, typename ... Args>
         R CallMethod(std::string const& method, boost_ec & ec, Args && ... args)
         {
-            Buffer buf;
-            buf.Write(hprose::TagCall);
-            buf.Write(method, true);
-            RecursiveWrite(buf, std::forward<Args>(args)...);
-            buf.Write(hprose::TagEnd);
-
-            Hprose_Message request(buf.str());
+            // 发送时直接编码到发送缓冲区
+            std::size_t size_hint = estimate_size(method) + 2;
+            int expand[] = {0, (size_hint += estimate_size(args), 0)...};
+            (void)expand;
+            auto encoder = [&](Buffer & buf) {
+                buf.simple_ = !write_refs_;
+                buf.Write(hprose::TagCall);
+                buf.Write(method, true);
+                RecursiveWrite(buf, args...);
+                buf.Write(hprose::TagEnd);
+            };
+            Hprose_LazyMessage<decltype(encoder)> request(std::move(encoder), size_hint);
             Hprose_Message response;
-            ec = c_->Call("", "", &request, &response);
+            if (priority_)
+                ec = c_->Call("", "", &request, &response, *priority_);
+            else
+                ec = c_->Call("", "", &request, &response);
             if (ec) return R();
 
-            Buffer reader(response.body_);
+            Buffer reader(response.body_.data(), response.body_.size());
             char flag = reader.get();
             if (flag == hprose::TagResult) {
                 R r;
@@ -192,6 +429,28 @@ namespace hprose {
             return R();
         }
 
+        // 发送batch中的所有调用, 之后用Hprose_Batch::Result取各个调用的结果.
+        boost_ec CallBatch(Hprose_Batch & batch)
+        {
+            if (!batch.size()) return boost_ec();
+
+            auto encoder = [&](Buffer & buf) {
+                buf.Append(batch.request_.data(), batch.request_.size());
+                buf.Write(hprose::TagEnd);
+            };
+            Hprose_LazyMessage<decltype(encoder)> request(std::move(encoder), batch.request_.size() + 1);
+            boost_ec ec = priority_
+                ? c_->Call("", "", &request, &batch.response_, *priority_)
+                : c_->Call("", "", &request, &batch.response_);
+            if (ec) return ec;
+
+            if (!batch.ParseResponse()) {
+                ucorf_log_error("batch response parse error");
+                return MakeUcorfErrorCode(eUcorfErrorCode::ec_call_error);
+            }
+            return boost_ec();
+        }
+
         template <typename R, typename ... Args>
         R CallMethodNE(std::string const& method, Args && ... args)
         {
@@ -199,6 +458,10 @@ namespace hprose {
             return CallMethod(method, ec, std::forward<Args>(args)...);
         }
 
+        void RecursiveWrite(Buffer & buf)
+        {
+        }
+
         template <typename A, typename ... Args>
         void RecursiveWrite(Buffer & buf, A && a)
         {
@@ -211,6 +474,9 @@ namespace hprose {
             buf.Write(std::forward<A>(a));
             RecursiveWrite(buf, std::forward<Args>(args)...);
         }
+
+    private:
+        bool write_refs_ = false;
     };
 
 } //namespace hprose
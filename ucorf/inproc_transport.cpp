@@ -0,0 +1,389 @@
+#include "inproc_transport.h"
+#include "logger.h"
+#include <boost/algorithm/string.hpp>
+#include <errno.h>
+
+namespace ucorf
+{
+    static const std::string inproc_prefix = "inproc://";
+
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    // 进程内按名字登记的server
+    class InprocRegistry
+    {
+    public:
+        static InprocRegistry& getInstance()
+        {
+            static InprocRegistry obj;
+            return obj;
+        }
+
+        typedef InprocTransportServer::CorePtr CorePtr;
+
+        bool Bind(std::string const& name, CorePtr const& server)
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            return servers_.insert(ServerMap::value_type(name, server)).second;
+        }
+
+        void Unbind(std::string const& name, CorePtr const& server)
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            auto it = servers_.find(name);
+            if (servers_.end() != it && it->second == server)
+                servers_.erase(it);
+        }
+
+        // 只在锁内查找, Accept(会调用连接回调)在锁外执行.
+        boost_ec Connect(std::string const& name, InprocSessionPtr & sess,
+                boost::shared_ptr<InprocEndpoint> & endpoint)
+        {
+            CorePtr server;
+            {
+                std::unique_lock<co_mutex> lock(mtx_);
+                auto it = servers_.find(name);
+                if (servers_.end() == it)
+                    return MakeSysErrorCode(ECONNREFUSED);
+                server = it->second;
+            }
+
+            sess = InprocTransportServer::Accept(server);
+            if (!sess)
+                return MakeSysErrorCode(ECONNREFUSED);
+            endpoint = server->endpoint;
+            return boost_ec();
+        }
+
+    private:
+        typedef std::map<std::string, CorePtr> ServerMap;
+        co_mutex mtx_;
+        ServerMap servers_;
+    };
+
+    // session
+    void InprocSession::Pair(InprocSessionPtr & a, InprocSessionPtr & b)
+    {
+        a.reset(new InprocSession);
+        b.reset(new InprocSession);
+        a->peer_ = b;
+        b->peer_ = a;
+    }
+
+    void InprocSession::Start(OnReceiveF const& on_receive, OnCloseF const& on_close)
+    {
+        InprocSessionPtr self = shared_from_this();
+        go [=]{ self->ReadLoop(on_receive, on_close); };
+    }
+
+    boost_ec InprocSession::Send(std::vector<char> && buf)
+    {
+        InprocSessionPtr peer = peer_.lock();
+        if (closed_ || !peer || peer->closed_)
+            return MakeSysErrorCode(ENOTCONN);
+
+        peer->Push(std::move(buf));
+        return boost_ec();
+    }
+
+    void InprocSession::Push(std::vector<char> && buf)
+    {
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            queue_.push_back(std::move(buf));
+        }
+        signal_.TryPush(true);
+    }
+
+    void InprocSession::Close()
+    {
+        Shutdown();
+        InprocSessionPtr peer = peer_.lock();
+        if (peer)
+            peer->Shutdown();
+    }
+
+    void InprocSession::Shutdown()
+    {
+        closed_ = true;
+        signal_.TryPush(true);
+    }
+
+    void InprocSession::ReadLoop(OnReceiveF on_receive, OnCloseF on_close)
+    {
+        std::vector<char> pending;
+        std::size_t offset = 0;     // pending中已处理的字节数
+        std::deque<std::vector<char>> bufs;
+        boost_ec ec = MakeSysErrorCode(ECONNRESET);
+        for (;;)
+        {
+            bool signal = false;
+            signal_ >> signal;
+
+            {
+                std::unique_lock<co_mutex> lock(mtx_);
+                bufs.swap(queue_);
+            }
+
+            for (auto &buf : bufs) {
+                if (offset == pending.size()) {
+                    pending.swap(buf);
+                    offset = 0;
+                } else {
+                    // 只有不完整的包才挪到开头, 与新数据拼接
+                    if (offset) {
+                        pending.erase(pending.begin(), pending.begin() + offset);
+                        offset = 0;
+                    }
+                    pending.insert(pending.end(), buf.begin(), buf.end());
+                }
+                if (pending.empty()) continue;
+
+                std::size_t consume = on_receive(&pending[offset], pending.size() - offset);
+                if (consume == (std::size_t)-1) {
+                    ec = MakeSysErrorCode(EBADMSG);
+                    Close();
+                    break;
+                }
+                offset += consume;
+            }
+            bufs.clear();
+
+            if (closed_) break;
+        }
+
+        on_close(ec);
+    }
+
+    // server
+    InprocTransportServer::InprocTransportServer()
+        : core_(boost::make_shared<Core>())
+    {
+        core_->endpoint.reset(new InprocEndpoint);
+        ucorf_log_debug("InprocTransportServer construct.");
+    }
+    InprocTransportServer::~InprocTransportServer()
+    {
+        ucorf_log_debug("InprocTransportServer destruct.");
+        Shutdown();
+    }
+
+    void InprocTransportServer::Shutdown()
+    {
+        if (!name_.empty()) {
+            InprocRegistry::getInstance().Unbind(name_, core_);
+            name_.clear();
+        }
+        core_->endpoint->closed = true;
+
+        std::set<InprocSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            core_->closed = true;
+            sessions = core_->sessions;
+        }
+        for (auto &sess : sessions)
+            sess->Close();
+    }
+    void InprocTransportServer::SetReceiveCb(OnReceiveF const& cb)
+    {
+        core_->on_receive = cb;
+    }
+    void InprocTransportServer::SetConnectedCb(OnConnectedF const& cb)
+    {
+        core_->on_connect = cb;
+    }
+    void InprocTransportServer::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        core_->on_disconnect = cb;
+    }
+    void InprocTransportServer::SetDirectCall(DirectCallF const& fn)
+    {
+        core_->endpoint->direct_call = fn;
+    }
+
+    boost_ec InprocTransportServer::Listen(std::string const& url)
+    {
+        if (!boost::istarts_with(url, inproc_prefix) || url.size() == inproc_prefix.size())
+            return MakeSysErrorCode(EINVAL);
+
+        std::string name = url.substr(inproc_prefix.size());
+        if (!InprocRegistry::getInstance().Bind(name, core_))
+            return MakeSysErrorCode(EADDRINUSE);
+
+        url_ = url;
+        name_ = name;
+        return boost_ec();
+    }
+
+    InprocSessionPtr InprocTransportServer::Accept(CorePtr core)
+    {
+        InprocSessionPtr sess, peer;
+        InprocSession::Pair(sess, peer);
+        {
+            std::unique_lock<co_mutex> lock(core->sessions_mtx);
+            if (core->closed)
+                return InprocSessionPtr();
+            core->sessions.insert(sess);
+        }
+
+        ucorf_log_debug("new inproc connection");
+        if (core->on_connect)
+            core->on_connect(SessId(sess));
+
+        sess->Start([=](const char* data, size_t bytes) {
+                    return core->on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("inproc connection disconnect: %s", ec.message().c_str());
+                    {
+                        std::unique_lock<co_mutex> lock(core->sessions_mtx);
+                        core->sessions.erase(sess);
+                    }
+                    if (core->on_disconnect)
+                        core->on_disconnect(SessId(sess), ec);
+                });
+        return peer;
+    }
+
+    void InprocTransportServer::Send(SessId id, const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(id, std::move(buf), cb);
+    }
+    void InprocTransportServer::Send(SessId id, std::vector<char> && buf, OnSndF const& cb)
+    {
+        InprocSessionPtr &sess = ::boost::any_cast<InprocSessionPtr&>(id);
+        boost_ec ec = sess->Send(std::move(buf));
+        if (cb) cb(ec);
+    }
+    std::string InprocTransportServer::LocalUrl() const
+    {
+        return url_;
+    }
+    void InprocTransportServer::ForEachSession(boost::function<void(SessId)> const& fn)
+    {
+        std::set<InprocSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            sessions = core_->sessions;
+        }
+
+        for (auto &sess : sessions)
+            fn(SessId(sess));
+    }
+    void InprocTransportServer::Close(SessId id)
+    {
+        InprocSessionPtr &sess = ::boost::any_cast<InprocSessionPtr&>(id);
+        sess->Close();
+    }
+
+    // client
+    InprocTransportClient::InprocTransportClient()
+    {
+        ucorf_log_debug("InprocTransportClient construct.");
+    }
+    InprocTransportClient::~InprocTransportClient()
+    {
+        ucorf_log_debug("InprocTransportClient destruct.");
+        Shutdown();
+    }
+
+    void InprocTransportClient::Shutdown()
+    {
+        InprocSessionPtr sess = GetSession();
+        if (sess)
+            sess->Close();
+    }
+    void InprocTransportClient::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void InprocTransportClient::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void InprocTransportClient::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+
+    boost_ec InprocTransportClient::Connect(std::string const& url)
+    {
+        url_ = url;
+        if (!boost::istarts_with(url, inproc_prefix))
+            return MakeSysErrorCode(EINVAL);
+
+        InprocSessionPtr sess;
+        boost::shared_ptr<InprocEndpoint> endpoint;
+        boost_ec ec = InprocRegistry::getInstance().Connect(
+                url.substr(inproc_prefix.size()), sess, endpoint);
+        if (ec) return ec;
+
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            sess_ = sess;
+            endpoint_ = endpoint;
+        }
+
+        ucorf_log_debug("inproc connect sucess");
+        if (on_connect_)
+            on_connect_(SessId(sess));
+
+        // 连接可能比client活得更久, 回调按值持有
+        OnReceiveF on_receive = on_receive_;
+        OnDisconnectedF on_disconnect = on_disconnect_;
+        sess->Start([=](const char* data, size_t bytes) {
+                    return on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("inproc disconnect because: %s", ec.message().c_str());
+                    if (on_disconnect)
+                        on_disconnect(SessId(sess), ec);
+                });
+        return boost_ec();
+    }
+    void InprocTransportClient::Send(const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(std::move(buf), cb);
+    }
+    void InprocTransportClient::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        InprocSessionPtr sess = GetSession();
+        boost_ec ec = sess ? sess->Send(std::move(buf)) : MakeSysErrorCode(ENOTCONN);
+        if (cb) cb(ec);
+    }
+    bool InprocTransportClient::IsEstab()
+    {
+        InprocSessionPtr sess = GetSession();
+        return sess && sess->IsEstab();
+    }
+    std::string InprocTransportClient::RemoteUrl() const
+    {
+        return url_;
+    }
+
+    boost::optional<boost_ec> InprocTransportClient::DirectCall(std::string const& service,
+            std::string const& method, IMessage *request, IMessage *response,
+            TraceContext const& trace)
+    {
+        boost::shared_ptr<InprocEndpoint> endpoint;
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            endpoint = endpoint_;
+        }
+
+        if (!endpoint || endpoint->closed || !endpoint->direct_call)
+            return boost::none;
+        return endpoint->direct_call(service, method, request, response, trace);
+    }
+
+    InprocSessionPtr InprocTransportClient::GetSession()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return sess_;
+    }
+
+} //namespace ucorf
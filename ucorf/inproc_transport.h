@@ -0,0 +1,142 @@
+#pragma once
+
+#include "preheader.h"
+#include "transport.h"
+#include "message.h"
+#include <deque>
+#include <set>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/optional.hpp>
+
+namespace ucorf
+{
+    // 同进程内直接调用服务, 由ServerImpl提供.
+    // 返回空表示不能直接调用(如消息类型与服务不一致), 调用方应走序列化的正常流程.
+    typedef boost::function<boost::optional<boost_ec>(std::string const& service,
+            std::string const& method, IMessage *request, IMessage *response,
+            TraceContext const& trace)> DirectCallF;
+
+    // 同进程内的连接, 一对session互为对端, 发送的数据包直接放入对端的接收队列.
+    class InprocSession : public boost::enable_shared_from_this<InprocSession>
+    {
+    public:
+        typedef boost::function<size_t(const char*, size_t)> OnReceiveF;
+        typedef boost::function<void(boost_ec const&)> OnCloseF;
+
+        typedef boost::shared_ptr<InprocSession> InprocSessionPtr;
+        static void Pair(InprocSessionPtr & a, InprocSessionPtr & b);
+
+        void Start(OnReceiveF const& on_receive, OnCloseF const& on_close);
+
+        boost_ec Send(std::vector<char> && buf);
+
+        // 关闭两端, 已在接收队列中的数据处理完后才调用OnCloseF.
+        void Close();
+
+        bool IsEstab() const { return !closed_; }
+
+    private:
+        void Push(std::vector<char> && buf);
+        void Shutdown();
+        void ReadLoop(OnReceiveF on_receive, OnCloseF on_close);
+
+    private:
+        boost::weak_ptr<InprocSession> peer_;
+        std::atomic<bool> closed_{false};
+        co_mutex mtx_;
+        std::deque<std::vector<char>> queue_;
+        co_chan<bool> signal_{1};
+    };
+    typedef boost::shared_ptr<InprocSession> InprocSessionPtr;
+
+    // server的直接调用入口, client连接时取得, server退出后失效.
+    struct InprocEndpoint
+    {
+        DirectCallF direct_call;
+        std::atomic<bool> closed{false};
+    };
+
+    // inproc://name, 在进程内按名字查找server, 数据不经过内核.
+    class InprocTransportServer : public ITransportServer
+    {
+    public:
+        InprocTransportServer();
+        ~InprocTransportServer();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+
+        virtual boost_ec Listen(std::string const& url);
+        virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
+
+        // 需要在Listen之前设置
+        void SetDirectCall(DirectCallF const& fn);
+
+    private:
+        friend class InprocRegistry;
+
+        // 回调和连接表. 登记表和连接的回调持有它而不是server,
+        // client连接时不需要持有登记表的锁, 连接也可以比server活得更久.
+        struct Core
+        {
+            boost::shared_ptr<InprocEndpoint> endpoint;
+            OnReceiveF on_receive;
+            OnConnectedF on_connect;
+            OnDisconnectedF on_disconnect;
+            co_mutex sessions_mtx;
+            std::set<InprocSessionPtr> sessions;
+            bool closed = false;    // Shutdown后不再接受连接, 由sessions_mtx保护
+        };
+        typedef boost::shared_ptr<Core> CorePtr;
+
+        // 由client连接时调用, 返回client端的session, server已关闭时返回空.
+        static InprocSessionPtr Accept(CorePtr core);
+
+    private:
+        std::string url_;
+        std::string name_;
+        CorePtr core_;
+    };
+
+    class InprocTransportClient : public ITransportClient
+    {
+    public:
+        InprocTransportClient();
+        ~InprocTransportClient();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+
+        virtual boost_ec Connect(std::string const& url);
+        virtual void Send(const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual bool IsEstab();
+        virtual std::string RemoteUrl() const;
+
+        // 跳过序列化直接调用server上的服务, 返回空表示不能直接调用.
+        boost::optional<boost_ec> DirectCall(std::string const& service,
+                std::string const& method, IMessage *request, IMessage *response,
+                TraceContext const& trace);
+
+    private:
+        InprocSessionPtr GetSession();
+
+    private:
+        std::string url_;
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        co_mutex mtx_;
+        InprocSessionPtr sess_;
+        boost::shared_ptr<InprocEndpoint> endpoint_;
+    };
+
+} //namespace ucorf
@@ -0,0 +1,244 @@
+#include "introspect_service.h"
+#include "server_impl.h"
+#include <cstdio>
+#include <cmath>
+
+namespace ucorf
+{
+    // 简单的json拼接, 值之间的逗号根据上一个字符自动补齐.
+    static void AppendSep(std::string & out)
+    {
+        if (!out.empty() && out.back() != '{' && out.back() != '[' && out.back() != ':')
+            out += ',';
+    }
+    static void AppendString(std::string & out, std::string const& str)
+    {
+        AppendSep(out);
+        out += '"';
+        for (char c : str) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if ((unsigned char)c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                        out += buf;
+                    } else
+                        out += c;
+            }
+        }
+        out += '"';
+    }
+    static void AppendKey(std::string & out, const char* key)
+    {
+        AppendString(out, key);
+        out += ':';
+    }
+    static void AppendField(std::string & out, const char* key, std::string const& value)
+    {
+        AppendKey(out, key);
+        AppendString(out, value);
+    }
+    static void AppendField(std::string & out, const char* key, long long value)
+    {
+        AppendKey(out, key);
+        out += std::to_string(value);
+    }
+    static void AppendField(std::string & out, const char* key, unsigned long long value)
+    {
+        AppendKey(out, key);
+        out += std::to_string(value);
+    }
+    static void AppendField(std::string & out, const char* key, double value)
+    {
+        AppendKey(out, key);
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%g", std::isfinite(value) ? value : 0.0);  // json不支持nan/inf
+        out += buf;
+    }
+    static void AppendField(std::string & out, const char* key, bool value)
+    {
+        AppendKey(out, key);
+        out += value ? "true" : "false";
+    }
+    static void AppendBegin(std::string & out, char c)
+    {
+        AppendSep(out);
+        out += c;
+    }
+
+    IntrospectService::IntrospectService(ServerImpl *server)
+        : server_(server)
+    {
+    }
+
+    std::unique_ptr<IMessage> IntrospectService::CallMethod(std::string const& method,
+            const char *request_data, size_t request_bytes)
+    {
+        std::vector<std::string> names = methods();
+        for (std::size_t i = 0; i < names.size(); ++i)
+            if (names[i] == method)
+                return CallMethodByIdx((int)i, request_data, request_bytes);
+        return nullptr;
+    }
+
+    std::vector<std::string> IntrospectService::methods()
+    {
+        return std::vector<std::string>{"ListServices", "Status"};
+    }
+
+    std::unique_ptr<IMessage> IntrospectService::CallMethodByIdx(int method_idx,
+            const char *request_data, size_t request_bytes)
+    {
+        switch (method_idx) {
+            case e_list_services:
+                return std::unique_ptr<IMessage>(new StringMessage(ListServices()));
+            case e_status:
+                return std::unique_ptr<IMessage>(new StringMessage(Status()));
+            default:
+                return nullptr;
+        }
+    }
+
+    std::string IntrospectService::signature(int method_idx)
+    {
+        if (method_idx < 0 || method_idx >= e_method_count) return "";
+        return "json " + methods()[method_idx] + "()";
+    }
+
+    std::string IntrospectService::ListServices()
+    {
+        struct ServiceInfo
+        {
+            IService *service = nullptr;
+            std::map<int, std::string> methods;
+        };
+        std::map<std::string, ServiceInfo> services;
+
+        boost::shared_ptr<const ServerImpl::MethodTable> table =
+            boost::atomic_load(&server_->method_table_);
+        for (auto &kv : table->entries) {
+            ServiceInfo & info = services[kv.first.first.to_string()];
+            info.service = kv.second.srv->service.get();
+            if (kv.second.method_idx >= 0)
+                info.methods[kv.second.method_idx] = kv.first.second.to_string();
+        }
+
+        std::string out;
+        AppendBegin(out, '{');
+        AppendKey(out, "services");
+        AppendBegin(out, '[');
+        for (auto &kv : services) {
+            AppendBegin(out, '{');
+            AppendField(out, "name", kv.first);
+            AppendField(out, "dynamic", kv.second.methods.empty());
+            AppendKey(out, "methods");
+            AppendBegin(out, '[');
+            for (auto &method : kv.second.methods) {
+                AppendBegin(out, '{');
+                AppendField(out, "name", method.second);
+                AppendField(out, "signature", kv.second.service->signature(method.first));
+                out += '}';
+            }
+            out += "]}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    std::string IntrospectService::Status()
+    {
+        typedef unsigned long long ull;
+        std::string out;
+        AppendBegin(out, '{');
+        AppendField(out, "connections", (long long)server_->connections_);
+        AppendField(out, "inflight", (long long)server_->inflight_);
+        AppendField(out, "draining", (bool)server_->draining_);
+
+        AppendKey(out, "scheduler");
+        AppendBegin(out, '{');
+        AppendField(out, "coroutines", (ull)co_sched.TaskCount());
+        AppendField(out, "dispatch_workers", (ull)server_->scheduler_.Workers());
+        AppendField(out, "dispatch_pending", (ull)server_->scheduler_.Pending());
+        out += '}';
+
+        ResponseCache::Stats cache = server_->response_cache_.GetStats();
+        AppendKey(out, "response_cache");
+        AppendBegin(out, '{');
+        AppendField(out, "hits", (ull)cache.hits);
+        AppendField(out, "misses", (ull)cache.misses);
+        AppendField(out, "expired", (ull)cache.expired);
+        AppendField(out, "evictions", (ull)cache.evictions);
+        AppendField(out, "entries", (ull)cache.entries);
+        AppendField(out, "bytes", (ull)cache.bytes);
+        out += '}';
+
+        DatagramStats dgram = server_->GetDatagramStats();
+        AppendKey(out, "datagram");
+        AppendBegin(out, '{');
+        AppendField(out, "rx_packets", (ull)dgram.rx_packets);
+        AppendField(out, "rx_bytes", (ull)dgram.rx_bytes);
+        AppendField(out, "rx_dropped", (ull)dgram.rx_dropped);
+        AppendField(out, "rx_overflow", (ull)dgram.rx_overflow);
+        AppendField(out, "tx_packets", (ull)dgram.tx_packets);
+        AppendField(out, "tx_bytes", (ull)dgram.tx_bytes);
+        AppendField(out, "tx_dropped", (ull)dgram.tx_dropped);
+        out += '}';
+
+        boost::shared_ptr<Option> opt = server_->opt_;
+        AppendKey(out, "option");
+        AppendBegin(out, '{');
+        AppendField(out, "request_wnd_size", (ull)opt->request_wnd_size);
+        AppendField(out, "rcv_timeout_ms", (long long)opt->rcv_timeout_ms);
+        AppendField(out, "priority", std::string(opt->priority == ePriority::low ? "low"
+                    : opt->priority == ePriority::high ? "high" : "normal"));
+        AppendField(out, "dispatch_mode", std::string(
+                    opt->dispatch_mode == eDispatchMode::inline_call ? "inline_call" : "coroutine"));
+        AppendField(out, "max_dispatch_coroutines", (ull)opt->max_dispatch_coroutines);
+        AppendField(out, "max_dispatch_queue_length", (ull)opt->max_dispatch_queue_length);
+        AppendField(out, "overload_target_ms", (long long)opt->overload_target_ms);
+        AppendField(out, "overload_interval_ms", (long long)opt->overload_interval_ms);
+        AppendField(out, "response_cache_bytes", (ull)opt->response_cache_bytes);
+        AppendField(out, "enable_stats", opt->enable_stats);
+        AppendField(out, "enable_introspection", opt->enable_introspection);
+        AppendField(out, "trace_sample_rate", opt->trace_sample_rate);
+        AppendField(out, "header_extensions", opt->header_extensions);
+        AppendField(out, "inproc_direct_call", opt->inproc_direct_call);
+        AppendField(out, "reuseport_listeners", (long long)opt->reuseport_listeners);
+        out += '}';
+
+        AppendKey(out, "methods");
+        AppendBegin(out, '[');
+        for (auto &snap : server_->stats_.GetSnapshot()) {
+            if (!snap.calls && !snap.inflight) continue;
+
+            AppendBegin(out, '{');
+            AppendField(out, "service", snap.service);
+            AppendField(out, "method", snap.method);
+            AppendField(out, "calls", (ull)snap.calls);
+            AppendField(out, "errors", (ull)snap.errors);
+            AppendKey(out, "error_by_code");
+            AppendBegin(out, '{');
+            for (int i = 1; i < MethodStats::e_error_count; ++i)
+                if (snap.error_by_code[i])
+                    AppendField(out, std::to_string(i).c_str(), (ull)snap.error_by_code[i]);
+            out += '}';
+            AppendField(out, "inflight", (long long)snap.inflight);
+            AppendField(out, "bytes_in", (ull)snap.bytes_in);
+            AppendField(out, "bytes_out", (ull)snap.bytes_out);
+            AppendField(out, "avg_us", (ull)snap.AvgLatencyUs());
+            AppendField(out, "p50_us", (ull)snap.Percentile(50));
+            AppendField(out, "p90_us", (ull)snap.Percentile(90));
+            AppendField(out, "p99_us", (ull)snap.Percentile(99));
+            AppendField(out, "p999_us", (ull)snap.Percentile(99.9));
+            out += '}';
+        }
+        out += "]}";
+        return out;
+    }
+
+} //namespace ucorf
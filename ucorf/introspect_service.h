@@ -0,0 +1,46 @@
+#pragma once
+
+#include "service.h"
+
+namespace ucorf
+{
+    class ServerImpl;
+
+    // 每个ServerImpl自动注册的查询服务, 请求包体忽略, 响应为json文本(StringMessage).
+    //   ListServices: 服务列表, 每个服务的方法名和签名.
+    //   Status: 连接数, 处理中的请求数, 协程调度状态, 响应缓存, udp丢包, Option和各方法的调用统计.
+    class IntrospectService : public IService
+    {
+    public:
+        explicit IntrospectService(ServerImpl *server);
+
+        static const char* service_name() { return "ucorf.Introspect"; }
+
+        std::string name() override { return service_name(); }
+
+        std::unique_ptr<IMessage> CallMethod(std::string const& method,
+                const char *request_data, size_t request_bytes) override;
+
+        std::vector<std::string> methods() override;
+
+        std::unique_ptr<IMessage> CallMethodByIdx(int method_idx,
+                const char *request_data, size_t request_bytes) override;
+
+        std::string signature(int method_idx) override;
+
+    private:
+        enum eMethod
+        {
+            e_list_services,
+            e_status,
+            e_method_count,
+        };
+
+        std::string ListServices();
+        std::string Status();
+
+    private:
+        ServerImpl *server_;
+    };
+
+} //namespace ucorf
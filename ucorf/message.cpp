@@ -1,5 +1,6 @@
 #include "message.h"
 #include <boost/pool/object_pool.hpp>
+#include <string.h>
 
 namespace ucorf
 {
@@ -24,6 +25,62 @@ namespace ucorf
         method = mthd;
     }
 
+    void UcorfHead::SetPriority(ePriority prio)
+    {
+        priority = (uint8_t)prio;
+    }
+    ePriority UcorfHead::GetPriority()
+    {
+        return (ePriority)priority;
+    }
+
+    void UcorfHead::SetTraceContext(TraceContext const& ctx)
+    {
+        trace = ctx;
+    }
+    TraceContext UcorfHead::GetTraceContext()
+    {
+        return trace;
+    }
+
+    // 优先级放在calltype字节的第4~5位, 以相对normal的2位有符号偏移存储,
+    // 第7位表示header带有跟踪扩展: method之后是网络字节序的trace_id和span_id各8字节.
+    // 旧版本对端按整个字节比较calltype且不认识跟踪扩展, 收到带这些位的header会解析错误,
+    // 所以只有请求会带这些位(由Option::header_extensions控制), 响应总是不带.
+    static const uint8_t trace_ext_flag = 0x80;
+    static const std::size_t trace_ext_bytes = 16;
+
+    static inline bool HasExtensions(uint8_t calltype)
+    {
+        return calltype == (uint8_t)eHeaderType::request
+            || calltype == (uint8_t)eHeaderType::oneway_request;
+    }
+
+    static inline uint8_t EncodeTypeByte(uint8_t calltype, uint8_t priority, bool has_trace)
+    {
+        if (!HasExtensions(calltype)) return calltype & 0xf;
+        uint8_t offset = (uint8_t)(priority - (uint8_t)ePriority::normal) & 0x3;
+        return (calltype & 0xf) | (offset << 4) | (has_trace ? trace_ext_flag : 0);
+    }
+
+    static inline void EncodeUint64(char* buf, uint64_t value)
+    {
+        *(uint32_t*)buf = htonl((uint32_t)(value >> 32));
+        *(uint32_t*)(buf + 4) = htonl((uint32_t)value);
+    }
+    static inline uint64_t DecodeUint64(const char* buf)
+    {
+        return ((uint64_t)ntohl(*(uint32_t*)buf) << 32) | ntohl(*(uint32_t*)(buf + 4));
+    }
+    static inline uint8_t DecodePriority(uint8_t type_byte)
+    {
+        int offset = (type_byte >> 4) & 0x3;
+        if (offset & 0x2) offset -= 4;
+        int prio = (int)ePriority::normal + offset;
+        if (prio < (int)ePriority::low) prio = (int)ePriority::low;
+        return (uint8_t)prio;
+    }
+
     std::size_t UcorfHead::GetId()
     {
         return callid;
@@ -49,20 +106,27 @@ namespace ucorf
     {
         if (len < ByteSize()) return false;
         *(unsigned char*)buf = magic_code;
-        *(uint8_t*)((char*)buf + 1) = calltype;
+        bool has_trace = trace && HasExtensions(calltype);
+        *(uint8_t*)((char*)buf + 1) = EncodeTypeByte(calltype, priority, has_trace);
         *(uint32_t*)((char*)buf + 2) = htonl(callid);
         *(uint32_t*)((char*)buf + 6) = htonl(body_length);
         *(uint16_t*)((char*)buf + 10) = htons(service.size());
         *(uint16_t*)((char*)buf + 12) = htons(method.size());
         memcpy((char*)buf + 14, service.data(), service.size());
         memcpy((char*)buf + 14 + service.size(), method.data(), method.size());
+        if (has_trace) {
+            char* ext = (char*)buf + 14 + service.size() + method.size();
+            EncodeUint64(ext, trace.trace_id);
+            EncodeUint64(ext + 8, trace.span_id);
+        }
         return true;
     }
     std::size_t UcorfHead::ByteSize()
     {
         return sizeof(unsigned char) + sizeof(calltype) +
             sizeof(callid) + sizeof(body_length) +
-            4 + service.size() + method.size();
+            4 + service.size() + method.size() +
+            ((trace && HasExtensions(calltype)) ? trace_ext_bytes : 0);
     }
     std::size_t UcorfHead::Parse(const void* buf, std::size_t len)
     {
@@ -71,13 +135,65 @@ namespace ucorf
         uint16_t service_len = htons(*(uint16_t*)((char*)buf + 10));
         uint16_t method_len = htons(*(uint16_t*)((char*)buf + 12));
         if ((uint16_t)len < 14 + service_len + method_len) return 0;
+        uint8_t type_byte = *(uint8_t*)((char*)buf + 1);
+        std::size_t ext_len = (type_byte & trace_ext_flag) ? trace_ext_bytes : 0;
+        if (len < 14 + service_len + method_len + ext_len) return 0;
 
-        calltype = *(uint8_t*)((char*)buf + 1);
+        calltype = *(uint8_t*)((char*)buf + 1) & 0xf;
+        priority = DecodePriority(*(uint8_t*)((char*)buf + 1));
         callid = htonl(*(uint32_t*)((char*)buf + 2));
         body_length = htonl(*(uint32_t*)((char*)buf + 6));
         service.assign((char*)buf + 14, service_len);
         method.assign((char*)buf + 14 + service_len, method_len);
-        return 14 + service_len + method_len;
+        if (ext_len) {
+            const char* ext = (const char*)buf + 14 + service_len + method_len;
+            trace.trace_id = DecodeUint64(ext);
+            trace.span_id = DecodeUint64(ext + 8);
+        } else
+            trace = TraceContext();
+        return 14 + service_len + method_len + ext_len;
+    }
+
+    bool StringMessage::Serialize(void* buf, std::size_t len)
+    {
+        if (len < str_.size()) return false;
+        memcpy(buf, str_.data(), str_.size());
+        return true;
+    }
+    std::size_t StringMessage::ByteSize()
+    {
+        return str_.size();
+    }
+    std::size_t StringMessage::Parse(const void* buf, std::size_t len)
+    {
+        str_.assign((const char*)buf, len);
+        return len;
+    }
+
+    bool SerializeFrame(IHeader & header, IMessage & body, std::vector<char> & buf)
+    {
+        // 先给header留出位置, 包体直接编码在后面
+        std::size_t head_len = header.ByteSize();
+        buf.resize(head_len);
+        if (body.SerializeAppend(buf)) {
+            header.SetFollowBytes(buf.size() - head_len);
+            std::size_t real_head_len = header.ByteSize();
+            if (real_head_len > head_len)
+                buf.insert(buf.begin(), real_head_len - head_len, '\0');
+            else if (real_head_len < head_len)
+                buf.erase(buf.begin(), buf.begin() + (head_len - real_head_len));
+            return header.Serialize(&buf[0], real_head_len);
+        }
+
+        std::size_t body_len = body.ByteSize();
+        header.SetFollowBytes(body_len);
+        head_len = header.ByteSize();
+        buf.resize(head_len + body_len);
+        if (!header.Serialize(&buf[0], head_len))
+            return false;
+
+        if (!body_len) return true;
+        return body.SerializeWithCachedSize(&buf[head_len], body_len);
     }
 
     IHeaderPtr UcorfHead::Factory()
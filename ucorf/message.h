@@ -1,6 +1,7 @@
 #pragma once
 
 #include "preheader.h"
+#include <boost/utility/string_ref.hpp>
 
 namespace ucorf
 {
@@ -9,6 +10,27 @@ namespace ucorf
         request,
         oneway_request,
         response,
+        error_response,     // 包体为网络字节序的uint32错误码(eUcorfErrorCode)
+        goaway,             // server即将退出, client不要再往该连接发送新请求
+    };
+
+    // 请求优先级, 过载时优先处理高优先级的请求, 优先拒绝低优先级的请求.
+    enum class ePriority : uint8_t
+    {
+        low,        // 批处理等可延后的请求
+        normal,
+        high,       // 面向用户的交互请求
+    };
+    enum { e_priority_count = (int)ePriority::high + 1 };
+
+    // 调用链跟踪的上下文, trace_id为0表示未采样.
+    // 在请求的header中, span_id是调用方(client端span)的id.
+    struct TraceContext
+    {
+        uint64_t trace_id = 0;
+        uint64_t span_id = 0;
+
+        explicit operator bool() const { return trace_id != 0; }
     };
 
     class IHeader
@@ -22,12 +44,24 @@ namespace ucorf
         virtual void SetService(std::string const& srv) = 0;
         virtual void SetMethod(std::string const& method) = 0;
 
+        virtual void SetPriority(ePriority) {}
+        virtual ePriority GetPriority() { return ePriority::normal; }
+
+        // 不支持跟踪的协议可以不实现
+        virtual void SetTraceContext(TraceContext const&) {}
+        virtual TraceContext GetTraceContext() { return TraceContext(); }
+
         virtual std::size_t GetId() = 0;
         virtual eHeaderType GetType() = 0;
         virtual std::size_t GetFollowBytes() = 0;
         virtual std::string GetService() = 0;
         virtual std::string GetMethod() = 0;
 
+        // server端分发请求时按引用读取服务名和方法名, 避免每个请求拷贝字符串.
+        // 默认实现把GetService()/GetMethod()的结果存入@buf, 返回值在header和@buf有效期间可用.
+        virtual boost::string_ref ServiceRef(std::string & buf) { buf = GetService(); return buf; }
+        virtual boost::string_ref MethodRef(std::string & buf) { buf = GetMethod(); return buf; }
+
         virtual bool Serialize(void* buf, std::size_t len) = 0;
         virtual std::size_t ByteSize() = 0;
         virtual std::size_t Parse(const void* buf, std::size_t len) = 0;
@@ -43,8 +77,41 @@ namespace ucorf
         virtual bool Serialize(void* buf, std::size_t len) = 0;
         virtual std::size_t ByteSize() = 0;
         virtual std::size_t Parse(const void* buf, std::size_t len) = 0;
+
+        // 紧接着ByteSize()调用, 可以复用ByteSize()时计算好的长度(如protobuf的cached size).
+        virtual bool SerializeWithCachedSize(void* buf, std::size_t len)
+        {
+            return Serialize(buf, len);
+        }
+
+        // 长度要编码后才知道的消息(如hprose)可以直接编码追加到buf的末尾, 省去中间缓冲区和一次拷贝.
+        // SerializeFrame优先调用, 返回false表示不支持, 改用ByteSize()和Serialize().
+        virtual bool SerializeAppend(std::vector<char> & buf)
+        {
+            return false;
+        }
     };
 
+    // 不做编解码的原始字节消息, 用于包体为文本(如json)的接口.
+    class StringMessage : public IMessage
+    {
+    public:
+        StringMessage() = default;
+        explicit StringMessage(std::string const& str) : str_(str) {}
+
+        virtual bool Serialize(void* buf, std::size_t len);
+        virtual std::size_t ByteSize();
+        virtual std::size_t Parse(const void* buf, std::size_t len);
+
+        std::string & str() { return str_; }
+
+    private:
+        std::string str_;
+    };
+
+    // 把header和body序列化到同一块发送缓冲区, body的长度只计算一次.
+    bool SerializeFrame(IHeader & header, IMessage & body, std::vector<char> & buf);
+
     struct UcorfHead : public IHeader
     {
     public:
@@ -53,12 +120,18 @@ namespace ucorf
         virtual void SetFollowBytes(std::size_t bytes);
         virtual void SetService(std::string const& srv);
         virtual void SetMethod(std::string const& mthd);
+        virtual void SetPriority(ePriority priority);
+        virtual ePriority GetPriority();
+        virtual void SetTraceContext(TraceContext const& ctx);
+        virtual TraceContext GetTraceContext();
 
         virtual std::size_t GetId();
         virtual eHeaderType GetType();
         virtual std::size_t GetFollowBytes();
         virtual std::string GetService();
         virtual std::string GetMethod();
+        virtual boost::string_ref ServiceRef(std::string &) { return service; }
+        virtual boost::string_ref MethodRef(std::string &) { return method; }
 
         virtual bool Serialize(void* buf, std::size_t len);
         virtual std::size_t ByteSize();
@@ -68,10 +141,12 @@ namespace ucorf
 
         static const unsigned char magic_code = 0xf8;
         uint8_t calltype;
+        uint8_t priority = (uint8_t)ePriority::normal;
         uint32_t callid;
         uint32_t body_length;
         std::string service;
         std::string method;
+        TraceContext trace;     // 采样时以扩展字段附加在method之后
     };
 
 } //namespace ucorf
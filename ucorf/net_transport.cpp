@@ -29,6 +29,10 @@ namespace ucorf
         s_.SetConnectedCb([=](::network::SessionEntry sess)
                 {
                     ucorf_log_debug("new connection");
+                    {
+                        std::unique_lock<co_mutex> lock(sessions_mtx_);
+                        sessions_[sess.get()] = sess;
+                    }
                     cb(boost::any(sess));
                 });
     }
@@ -37,6 +41,10 @@ namespace ucorf
         s_.SetDisconnectedCb([=](::network::SessionEntry sess, ::network::boost_ec const& ec)
                 {
                     ucorf_log_debug("connection disconnect: %s", ec.message().c_str());
+                    {
+                        std::unique_lock<co_mutex> lock(sessions_mtx_);
+                        sessions_.erase(sess.get());
+                    }
                     cb(boost::any(sess), ec);
                 });
     }
@@ -48,7 +56,12 @@ namespace ucorf
             net_opt.max_pack_size_ = 64 * 1024;
             return ;
         }
-        net_opt = boost::any_cast<::network::OptionsUser const&>(opt);
+        const ::network::OptionsUser* user_opt = boost::any_cast<::network::OptionsUser>(&opt);
+        if (!user_opt) {
+            WarnUnknownOption("NetTransportServer", opt);
+            return ;
+        }
+        net_opt = *user_opt;
         s_.SetSndTimeout(net_opt.sndtimeo_);
         s_.SetMaxPackSize(net_opt.max_pack_size_);
     }
@@ -72,6 +85,25 @@ namespace ucorf
     {
         return url_;
     }
+    void NetTransportServer::ForEachSession(boost::function<void(SessId)> const& fn)
+    {
+        // 回调中可能关闭连接, 不能持锁调用.
+        std::vector<::network::SessionEntry> sessions;
+        {
+            std::unique_lock<co_mutex> lock(sessions_mtx_);
+            sessions.reserve(sessions_.size());
+            for (auto &kv : sessions_)
+                sessions.push_back(kv.second);
+        }
+
+        for (auto &sess : sessions)
+            fn(boost::any(sess));
+    }
+    void NetTransportServer::Close(SessId id)
+    {
+        ::network::SessionEntry &sess = ::boost::any_cast<::network::SessionEntry&>(id);
+        sess->Shutdown();
+    }
 
     // client
     NetTransportClient::NetTransportClient()
@@ -117,7 +149,12 @@ namespace ucorf
             net_opt.max_pack_size_ = 64 * 1024;
             return ;
         }
-        net_opt = boost::any_cast<::network::OptionsUser const&>(opt);
+        const ::network::OptionsUser* user_opt = boost::any_cast<::network::OptionsUser>(&opt);
+        if (!user_opt) {
+            WarnUnknownOption("NetTransportClient", opt);
+            return ;
+        }
+        net_opt = *user_opt;
         c_.SetSndTimeout(net_opt.sndtimeo_);
         c_.SetMaxPackSize(net_opt.max_pack_size_);
     }
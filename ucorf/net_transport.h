@@ -22,10 +22,14 @@ namespace ucorf
         virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
         virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
         virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
 
     private:
         ::network::Server s_;
         std::string url_;
+        co_mutex sessions_mtx_;
+        std::unordered_map<void*, ::network::SessionEntry> sessions_;
     };
 
     class NetTransportClient : public ITransportClient
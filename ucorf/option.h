@@ -1,14 +1,69 @@
 #pragma once
 
 #include "preheader.h"
+#include "message.h"
 
 namespace ucorf
 {
+    enum class eDispatchMode
+    {
+        inline_call,    // 在连接的接收协程中直接处理请求, 适合简单快速的接口
+        coroutine,      // 每个请求交由协程池中的协程处理, 同一连接上的请求可并行
+    };
+
     struct Option
     {
         std::size_t request_wnd_size = -1;
         int rcv_timeout_ms = 10000;
         boost::any transport_opt;
+
+        // client端请求的默认优先级, 可以用IServiceStub::SetPriority按调用覆盖.
+        ePriority priority = ePriority::normal;
+
+        // server端请求分发方式, 可以用ServerImpl::SetServiceDispatch按服务覆盖.
+        eDispatchMode dispatch_mode = eDispatchMode::inline_call;
+        std::size_t max_dispatch_coroutines = 1024;
+
+        // coroutine分发模式下每个服务排队中的请求数上限, 超过时直接返回ec_overload, -1表示不限制.
+        std::size_t max_dispatch_queue_length = 65536;
+
+        // server端过载保护(CoDel), 仅作用于coroutine分发模式.
+        // 请求排队时长的最小值在一个interval内持续高于target时进入过载状态,
+        // 过载状态下排队超过2倍target的请求直接返回ec_overload. target为0表示关闭.
+        // 每个优先级单独检测, 过载时低优先级的请求先被拒绝.
+        int overload_target_ms = 0;
+        int overload_interval_ms = 100;
+
+        // server端响应缓存的内存上限, 需要用ServerImpl::EnableResponseCache按方法开启.
+        std::size_t response_cache_bytes = 64 * 1024 * 1024;
+
+        // 按方法统计调用数, 错误数, 耗时分布等, 通过Server/Client::GetStats读取.
+        bool enable_stats = true;
+
+        // server端自动注册查询服务(IntrospectService), 可查询服务列表和运行状态.
+        bool enable_introspection = true;
+
+        // client端发起调用链跟踪的采样率(0~1), 需要先调用Tracer::Start开启导出.
+        // 在被跟踪的server请求中发起的调用总是跟踪, 不受采样率影响.
+        double trace_sample_rate = 0;
+
+        // client端是否在请求header中携带优先级和调用链跟踪上下文(calltype字节的高位和跟踪扩展).
+        // 旧版本的server不认识这些扩展, 会把带优先级的oneway请求当成普通请求, 带跟踪的请求无法解析,
+        // 所以默认关闭, 所有server都升级后再开启. 关闭时server端按normal处理, 跟踪不跨进程传递.
+        bool header_extensions = false;
+
+        // client端调用同进程内以inproc://监听的server时, 跳过序列化直接把请求和响应对象交给服务.
+        // 请求对象由调用方和服务共用(服务对它的修改对调用方可见), 响应对象在调用前清空.
+        // 消息类型与服务的接口不一致(如非protobuf)时仍按正常流程序列化.
+        // 直接调用在调用方协程中执行, 不经过server端的分发协程池和过载保护,
+        // 开启了响应缓存或请求合并的方法不会直接调用.
+        bool inproc_direct_call = false;
+
+        // server端tcp监听socket的个数. 大于1时Listen打开多个SO_REUSEPORT的监听socket,
+        // 每个socket一个accept协程, 由内核在它们之间均衡新连接, 避免大量重连时accept成为瓶颈.
+        // 一般设为libgo的工作线程数. 只对tcp://地址生效, 连接由StreamTransportServer处理, 不经过libgonet,
+        // transport_opt中libgonet的max_pack_size_和sndtimeo_同样生效.
+        int reuseport_listeners = 0;
     };
 
 } //namespace ucorf
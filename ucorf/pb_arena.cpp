@@ -0,0 +1,48 @@
+#include "pb_arena.h"
+
+namespace ucorf
+{
+    PooledArena::PooledArena(std::size_t initial_block_size)
+        : block_(new char[initial_block_size])
+    {
+        ::google::protobuf::ArenaOptions options;
+        options.initial_block = block_.get();
+        options.initial_block_size = initial_block_size;
+        arena_.reset(new ::google::protobuf::Arena(options));
+    }
+
+    void PooledArena::Reset()
+    {
+        arena_->Reset();
+    }
+
+    typedef std::vector<std::unique_ptr<PooledArena>> ArenaList;
+    static ArenaList& ThreadArenaList()
+    {
+        static thread_local ArenaList arenas;
+        return arenas;
+    }
+
+    ArenaPool::ArenaPtr ArenaPool::Acquire()
+    {
+        ArenaList & arenas = ThreadArenaList();
+        if (arenas.empty())
+            return ArenaPtr(new PooledArena(e_initial_block_size));
+
+        ArenaPtr arena(arenas.back().release());
+        arenas.pop_back();
+        return arena;
+    }
+
+    void ArenaPool::Releaser::operator()(PooledArena* arena) const
+    {
+        // 协程可能在其他线程上结束, 归还到当前线程的池中即可.
+        std::unique_ptr<PooledArena> holder(arena);
+        holder->Reset();
+
+        ArenaList & arenas = ThreadArenaList();
+        if (arenas.size() < e_max_cached_per_thread)
+            arenas.push_back(std::move(holder));
+    }
+
+} //namespace ucorf
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "preheader.h"
+#include <memory>
+#include <boost/noncopyable.hpp>
+#include <google/protobuf/arena.h>
+
+namespace ucorf
+{
+    // 带有首块内存的protobuf Arena, Reset后首块内存保留, 复用时无需再分配.
+    class PooledArena : public boost::noncopyable
+    {
+    public:
+        explicit PooledArena(std::size_t initial_block_size);
+
+        ::google::protobuf::Arena* get() { return arena_.get(); }
+
+        void Reset();
+
+    private:
+        std::unique_ptr<char[]> block_;
+        std::unique_ptr<::google::protobuf::Arena> arena_;
+    };
+
+    // 按线程缓存的Arena池. 每个请求借出一个Arena, 请求结束后Reset并归还到当前线程的池中.
+    class ArenaPool
+    {
+    public:
+        enum { e_initial_block_size = 8 * 1024 };
+        enum { e_max_cached_per_thread = 64 };
+
+        struct Releaser
+        {
+            void operator()(PooledArena* arena) const;
+        };
+        typedef std::unique_ptr<PooledArena, Releaser> ArenaPtr;
+
+        static ArenaPtr Acquire();
+    };
+
+} //namespace ucorf
@@ -12,6 +12,11 @@ namespace ucorf
     {
     }
 
+    Pb_Message::Pb_Message(::google::protobuf::Message* msg, ArenaPool::ArenaPtr && arena)
+        : msg_(msg), own_(false), arena_(std::move(arena))
+    {
+    }
+
     Pb_Message::~Pb_Message()
     {
         if (own_ && msg_)
@@ -23,6 +28,13 @@ namespace ucorf
         if (!msg_) return false;
         return msg_->SerializeToArray(buf, len);
     }
+    bool Pb_Message::SerializeWithCachedSize(void* buf, std::size_t len)
+    {
+        if (!msg_) return false;
+        if (len < (std::size_t)msg_->GetCachedSize()) return false;
+        msg_->SerializeWithCachedSizesToArray((::google::protobuf::uint8*)buf);
+        return true;
+    }
     std::size_t Pb_Message::ByteSize()
     {
         if (!msg_) return 0;
@@ -2,6 +2,7 @@
 
 #include "preheader.h"
 #include "message.h"
+#include "pb_arena.h"
 #include <memory>
 #include <google/protobuf/message.h>
 
@@ -16,13 +17,18 @@ namespace ucorf
         Pb_Message() = default;
         Pb_Message(::google::protobuf::Message* msg, bool own = true);
         Pb_Message(std::unique_ptr<::google::protobuf::Message> && msg);
+
+        // msg分配在arena上, arena随Pb_Message析构归还到ArenaPool.
+        Pb_Message(::google::protobuf::Message* msg, ArenaPool::ArenaPtr && arena);
         ~Pb_Message();
 
         virtual bool Serialize(void* buf, std::size_t len);
         virtual std::size_t ByteSize();
         virtual std::size_t Parse(const void* buf, std::size_t len);
-        
+        virtual bool SerializeWithCachedSize(void* buf, std::size_t len);
+
         ::google::protobuf::Message* msg_ = nullptr;
         bool own_ = false;
+        ArenaPool::ArenaPtr arena_;
     };
 } //namespace ucorf
@@ -11,19 +11,102 @@ namespace ucorf
 
         if (!method_descriptor) return nullptr;
 
-        std::unique_ptr<Message> request(GetRequestPrototype(method_descriptor).New());
+        return CallMethodByIdx(method_descriptor->index(), request_data, request_bytes);
+    }
+
+    std::vector<std::string> Pb_Service::methods()
+    {
+        std::vector<std::string> names;
+        for (auto &info : GetMethodInfos())
+            names.push_back(info.descriptor->name());
+        return names;
+    }
+
+    std::unique_ptr<IMessage> Pb_Service::CallMethodByIdx(int method_idx,
+            const char *request_data, size_t request_bytes)
+    {
+        std::vector<MethodInfo> const& infos = GetMethodInfos();
+        if (method_idx < 0 || method_idx >= (int)infos.size()) return nullptr;
+
+        MethodInfo const& info = infos[method_idx];
+        if (use_arena_) {
+            ArenaPool::ArenaPtr arena = ArenaPool::Acquire();
+            Message* request = info.request_prototype->New(arena->get());
+            if (!request->ParseFromArray(request_data, request_bytes))
+                return nullptr;
+
+            Message* response = info.response_prototype->New(arena->get());
+            if (!Call(method_idx, *request, *response))
+                return nullptr;
+
+            return std::unique_ptr<IMessage>(new Pb_Message(response, std::move(arena)));
+        }
+
+        std::unique_ptr<Message> request(info.request_prototype->New());
         if (!request->ParseFromArray(request_data, request_bytes))
             return nullptr;
 
-        std::unique_ptr<Message> response(GetResponsePrototype(method_descriptor).New());
+        std::unique_ptr<Message> response(info.response_prototype->New());
 
-        bool ok = Call(method_descriptor->index(), *request, *response);
+        bool ok = Call(method_idx, *request, *response);
         if (!ok) return nullptr;
 
         std::unique_ptr<IMessage> rsp_msg(new Pb_Message(std::move(response)));
         return std::move(rsp_msg);
     }
 
+    std::string Pb_Service::signature(int method_idx)
+    {
+        std::vector<MethodInfo> const& infos = GetMethodInfos();
+        if (method_idx < 0 || method_idx >= (int)infos.size()) return "";
+
+        const MethodDescriptor* descriptor = infos[method_idx].descriptor;
+        return "rpc " + descriptor->name() + "(" + descriptor->input_type()->full_name()
+            + ") returns (" + descriptor->output_type()->full_name() + ")";
+    }
+
+    bool Pb_Service::SupportDirectCall(int method_idx, IMessage & request, IMessage & response)
+    {
+        std::vector<MethodInfo> const& infos = GetMethodInfos();
+        if (method_idx < 0 || method_idx >= (int)infos.size()) return false;
+
+        Pb_Message *req = dynamic_cast<Pb_Message*>(&request);
+        Pb_Message *rsp = dynamic_cast<Pb_Message*>(&response);
+        if (!req || !rsp || !req->msg_ || !rsp->msg_) return false;
+
+        MethodInfo const& info = infos[method_idx];
+        return req->msg_->GetDescriptor() == info.descriptor->input_type()
+            && rsp->msg_->GetDescriptor() == info.descriptor->output_type();
+    }
+
+    bool Pb_Service::CallMethodDirect(int method_idx, IMessage & request, IMessage & response)
+    {
+        Pb_Message & req = static_cast<Pb_Message&>(request);
+        Pb_Message & rsp = static_cast<Pb_Message&>(response);
+        // 与序列化的流程一致, 服务拿到的是空的响应, 不残留调用方之前的内容
+        rsp.msg_->Clear();
+        return Call(method_idx, *req.msg_, *rsp.msg_);
+    }
+
+    void Pb_Service::EnableArena(bool enable)
+    {
+        use_arena_ = enable;
+    }
+
+    std::vector<Pb_Service::MethodInfo> const& Pb_Service::GetMethodInfos()
+    {
+        std::call_once(method_infos_flag_, [this]{
+                    const ServiceDescriptor* srv_descriptor = GetDescriptor();
+                    for (int i = 0; i < srv_descriptor->method_count(); ++i) {
+                        const MethodDescriptor* method = srv_descriptor->method(i);
+                        MethodInfo info = {method, &GetRequestPrototype(method),
+                            &GetResponsePrototype(method)};
+                        method_infos_.push_back(info);
+                    }
+                });
+        return method_infos_;
+    }
+
     const Message& Pb_Service::GetRequestPrototype(
             const MethodDescriptor* method) const
     {
@@ -40,6 +123,8 @@ namespace ucorf
     {
         Pb_Message req(&request, false);
         Pb_Message rsp(response, false);
+        if (priority_)
+            return c_->Call(name(), method, &req, response ? &rsp : (Pb_Message*)nullptr, *priority_);
         return c_->Call(name(), method, &req, response ? &rsp : (Pb_Message*)nullptr);
     }
 
@@ -4,6 +4,7 @@
 #include "pb_message.h"
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
+#include <mutex>
 
 namespace ucorf
 {
@@ -17,6 +18,23 @@ namespace ucorf
         std::unique_ptr<IMessage> CallMethod(std::string const& method,
                 const char *request_data, size_t request_bytes) override;
 
+        std::vector<std::string> methods() override;
+
+        std::unique_ptr<IMessage> CallMethodByIdx(int method_idx,
+                const char *request_data, size_t request_bytes) override;
+
+        std::string signature(int method_idx) override;
+
+        bool SupportDirectCall(int method_idx, IMessage & request, IMessage & response) override;
+
+        // 请求对象直接交给服务, 不拷贝: 服务对请求的修改对调用方可见.
+        // 响应对象在调用前清空.
+        bool CallMethodDirect(int method_idx, IMessage & request, IMessage & response) override;
+
+        // 请求和响应(包括嵌套的子消息)分配在按线程复用的Arena上, 减少内存分配.
+        // 低于3.14版本的protobuf需要在proto文件中设置option cc_enable_arenas = true.
+        void EnableArena(bool enable = true);
+
         virtual bool Call(int method_idx, Message & request, Message & response) = 0;
 
         virtual const ServiceDescriptor* GetDescriptor() = 0;
@@ -25,6 +43,20 @@ namespace ucorf
                 const MethodDescriptor* method) const;
         const Message& GetResponsePrototype(
                 const MethodDescriptor* method) const;
+
+    private:
+        // 每个方法的描述符和请求/响应的原型, 首次使用时生成.
+        struct MethodInfo
+        {
+            const MethodDescriptor* descriptor;
+            const Message* request_prototype;
+            const Message* response_prototype;
+        };
+        std::vector<MethodInfo> const& GetMethodInfos();
+
+        std::once_flag method_infos_flag_;
+        std::vector<MethodInfo> method_infos_;
+        bool use_arena_ = false;
     };
 
     class Pb_ServiceStub : public IServiceStub
@@ -0,0 +1,121 @@
+#include "request_scheduler.h"
+
+namespace ucorf
+{
+    RequestScheduler::RequestScheduler(std::size_t max_workers)
+        : robin_it_(queues_.end()), max_workers_(max_workers)
+    {
+    }
+
+    void RequestScheduler::SetMaxWorkers(std::size_t max_workers)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        max_workers_ = max_workers;
+    }
+
+    void RequestScheduler::SetQueueLimit(std::string const& queue, std::size_t limit)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        queues_[queue].limit = limit;
+    }
+
+    void RequestScheduler::SetMaxQueueLength(std::size_t max_length)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        max_queue_length_ = max_length;
+    }
+
+    RequestScheduler::QueueId RequestScheduler::GetQueue(std::string const& queue)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return &queues_[queue];
+    }
+
+    bool RequestScheduler::Post(std::string const& queue, Task const& task,
+            ePriority priority)
+    {
+        return Post(GetQueue(queue), task, priority);
+    }
+
+    bool RequestScheduler::Post(QueueId q, Task const& task, ePriority priority)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        if (workers_ < max_workers_ && q->running < q->limit) {
+            ++workers_;
+            ++q->running;
+            lock.unlock();
+            go [=]{ this->Run(q, task); };
+            return true;
+        }
+
+        if (q->pending >= max_queue_length_)
+            return false;
+
+        q->tasks[(int)priority].push_back(task);
+        ++q->pending;
+        ++pending_;
+        return true;
+    }
+
+    std::size_t RequestScheduler::Workers()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return workers_;
+    }
+
+    std::size_t RequestScheduler::Pending()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return pending_;
+    }
+
+    void RequestScheduler::Run(Queue *q, Task task)
+    {
+        for (;;)
+        {
+            task();
+            task = NULL;
+
+            std::unique_lock<co_mutex> lock(mtx_);
+            --q->running;
+            if (!PopRunnable(q, task)) {
+                --workers_;
+                return ;
+            }
+        }
+    }
+
+    bool RequestScheduler::PopRunnable(Queue *& q, Task & task)
+    {
+        if (!pending_ || queues_.empty()) return false;
+
+        // 先取高优先级的请求; 同一优先级内从上次取任务的队列的下一个开始轮询,
+        // 避免某个服务饿死其他服务.
+        for (int prio = e_priority_count - 1; prio >= 0; --prio)
+        {
+            auto it = robin_it_;
+            for (std::size_t i = 0; i < queues_.size(); ++i)
+            {
+                if (it == queues_.end() || ++it == queues_.end())
+                    it = queues_.begin();
+
+                Queue & cand = it->second;
+                std::deque<Task> & tasks = cand.tasks[prio];
+                if (tasks.empty() || cand.running >= cand.limit)
+                    continue;
+
+                task = tasks.front();
+                tasks.pop_front();
+                ++cand.running;
+                --cand.pending;
+                --pending_;
+                q = &cand;
+                robin_it_ = it;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+} //namespace ucorf
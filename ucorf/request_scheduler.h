@@ -0,0 +1,68 @@
+#pragma once
+
+#include "preheader.h"
+#include "message.h"
+#include <deque>
+
+namespace ucorf
+{
+    // 有界协程池: 每个请求交给一个协程处理, 协程处理完后会复用去处理排队中的请求.
+    // 每个队列(服务)可以单独设置并发上限, 排队中的请求按优先级从高到低处理.
+    class RequestScheduler
+    {
+        struct Queue;
+
+    public:
+        typedef boost::function<void()> Task;
+
+        // 队列句柄, 队列创建后不会删除, 句柄在调度器的生命周期内一直有效.
+        typedef Queue* QueueId;
+
+        explicit RequestScheduler(std::size_t max_workers = 1024);
+
+        void SetMaxWorkers(std::size_t max_workers);
+
+        // @limit: 该队列同时处理的请求数上限, -1表示不限制.
+        void SetQueueLimit(std::string const& queue, std::size_t limit);
+
+        // @max_length: 每个队列排队中的请求数上限, -1表示不限制.
+        void SetMaxQueueLength(std::size_t max_length);
+
+        // 查找或创建队列, 返回的句柄可以缓存下来, 分发时不用再按名字查找.
+        QueueId GetQueue(std::string const& queue);
+
+        // 排队的请求数达到上限时不执行@task, 返回false.
+        bool Post(std::string const& queue, Task const& task,
+                ePriority priority = ePriority::normal);
+        bool Post(QueueId q, Task const& task,
+                ePriority priority = ePriority::normal);
+
+        std::size_t Workers();
+        std::size_t Pending();
+
+    private:
+        struct Queue
+        {
+            std::size_t limit = -1;
+            std::size_t running = 0;
+            std::size_t pending = 0;
+            std::deque<Task> tasks[e_priority_count];
+        };
+        typedef std::map<std::string, Queue> QueueMap;
+
+        void Run(Queue *q, Task task);
+
+        // 需在持有mtx_时调用
+        bool PopRunnable(Queue *& q, Task & task);
+
+    private:
+        co_mutex mtx_;
+        QueueMap queues_;
+        QueueMap::iterator robin_it_;
+        std::size_t max_workers_;
+        std::size_t max_queue_length_ = -1;
+        std::size_t workers_ = 0;
+        std::size_t pending_ = 0;
+    };
+
+} //namespace ucorf
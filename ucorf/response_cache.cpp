@@ -0,0 +1,111 @@
+#include "response_cache.h"
+
+namespace ucorf
+{
+    // 每项除key和value以外的估算开销
+    static const std::size_t c_entry_overhead = 96;
+
+    ResponseCache::ResponseCache(std::size_t capacity_bytes)
+        : shard_capacity_(capacity_bytes / e_shard_count)
+    {
+    }
+
+    void ResponseCache::SetCapacity(std::size_t capacity_bytes)
+    {
+        std::size_t capacity = capacity_bytes / e_shard_count;
+        shard_capacity_ = capacity;
+
+        // 缩小时立即淘汰超出的项, 不等到下次Put
+        for (auto &shard : shards_) {
+            std::unique_lock<co_mutex> lock(shard.mtx);
+            while (!shard.lru.empty() && shard.bytes > capacity) {
+                Erase(shard, --shard.lru.end());
+                ++evictions_;
+            }
+        }
+    }
+
+    std::string ResponseCache::MakeKey(std::string const& service, std::string const& method,
+            const char* request_data, std::size_t request_bytes)
+    {
+        std::string key;
+        key.reserve(service.size() + method.size() + request_bytes + 2);
+        key.append(service).append(1, '\0');
+        key.append(method).append(1, '\0');
+        key.append(request_data, request_bytes);
+        return key;
+    }
+
+    ResponseCache::Value ResponseCache::Get(std::string const& key)
+    {
+        std::size_t hash = std::hash<std::string>()(key);
+        Shard & shard = shards_[hash & (e_shard_count - 1)];
+
+        std::unique_lock<co_mutex> lock(shard.mtx);
+        auto it = shard.index.find(hash);
+        if (shard.index.end() == it || it->second->key != key) {
+            ++misses_;
+            return Value();
+        }
+
+        EntryList::iterator entry = it->second;
+        if (entry->expire <= clock_t::now()) {
+            Erase(shard, entry);
+            ++expired_;
+            ++misses_;
+            return Value();
+        }
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+        ++hits_;
+        return entry->value;
+    }
+
+    void ResponseCache::Put(std::string const& key, Value const& value, int ttl_ms)
+    {
+        std::size_t bytes = key.size() + value->size() + c_entry_overhead;
+        std::size_t capacity = shard_capacity_;
+        if (bytes > capacity) return ;
+
+        std::size_t hash = std::hash<std::string>()(key);
+        Shard & shard = shards_[hash & (e_shard_count - 1)];
+
+        std::unique_lock<co_mutex> lock(shard.mtx);
+        auto it = shard.index.find(hash);
+        if (shard.index.end() != it)
+            Erase(shard, it->second);
+
+        while (!shard.lru.empty() && shard.bytes + bytes > capacity) {
+            Erase(shard, --shard.lru.end());
+            ++evictions_;
+        }
+
+        Entry entry = {key, hash, value, clock_t::now() + std::chrono::milliseconds(ttl_ms), bytes};
+        shard.lru.push_front(entry);
+        shard.index[hash] = shard.lru.begin();
+        shard.bytes += bytes;
+    }
+
+    ResponseCache::Stats ResponseCache::GetStats()
+    {
+        Stats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.expired = expired_;
+        stats.evictions = evictions_;
+        for (auto &shard : shards_) {
+            std::unique_lock<co_mutex> lock(shard.mtx);
+            stats.entries += shard.lru.size();
+            stats.bytes += shard.bytes;
+        }
+        return stats;
+    }
+
+    void ResponseCache::Erase(Shard & shard, EntryList::iterator it)
+    {
+        shard.bytes -= it->bytes;
+        shard.index.erase(it->hash);
+        shard.lru.erase(it);
+    }
+
+} //namespace ucorf
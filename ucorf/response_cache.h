@@ -0,0 +1,74 @@
+#pragma once
+
+#include "preheader.h"
+#include <boost/noncopyable.hpp>
+
+namespace ucorf
+{
+    // 幂等接口的响应缓存.
+    // key为(服务名, 方法名, 请求包体), value为序列化后的响应包体.
+    // 按key的hash分片加锁, 每个分片内按LRU淘汰, 过期的项在访问时删除.
+    class ResponseCache : public boost::noncopyable
+    {
+    public:
+        typedef std::chrono::steady_clock clock_t;
+        typedef boost::shared_ptr<const std::string> Value;
+
+        struct Stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t expired = 0;
+            uint64_t evictions = 0;
+            std::size_t entries = 0;
+            std::size_t bytes = 0;
+        };
+
+        explicit ResponseCache(std::size_t capacity_bytes = 64 * 1024 * 1024);
+
+        void SetCapacity(std::size_t capacity_bytes);
+
+        static std::string MakeKey(std::string const& service, std::string const& method,
+                const char* request_data, std::size_t request_bytes);
+
+        // @returns: 未命中时返回空指针.
+        Value Get(std::string const& key);
+
+        void Put(std::string const& key, Value const& value, int ttl_ms);
+
+        Stats GetStats();
+
+    private:
+        // 必须为2的幂
+        enum { e_shard_count = 0x10 };
+
+        struct Entry
+        {
+            std::string key;
+            std::size_t hash;
+            Value value;
+            clock_t::time_point expire;
+            std::size_t bytes;
+        };
+        typedef std::list<Entry> EntryList;
+
+        struct Shard
+        {
+            co_mutex mtx;
+            EntryList lru;      // 头部为最近使用的项
+            std::unordered_map<std::size_t, EntryList::iterator> index;
+            std::size_t bytes = 0;
+        };
+
+        void Erase(Shard & shard, EntryList::iterator it);
+
+    private:
+        Shard shards_[e_shard_count];
+        std::atomic<std::size_t> shard_capacity_;
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+        std::atomic<uint64_t> expired_{0};
+        std::atomic<uint64_t> evictions_{0};
+    };
+
+} //namespace ucorf
@@ -27,11 +27,49 @@ namespace ucorf
         impl_->RemoveService(service_name);
     }
 
+    bool Server::SetServiceDispatch(std::string const& service_name, eDispatchMode mode,
+            std::size_t max_concurrency)
+    {
+        return impl_->SetServiceDispatch(service_name, mode, max_concurrency);
+    }
+
+    bool Server::EnableResponseCache(std::string const& service_name,
+            std::string const& method_name, int ttl_ms)
+    {
+        return impl_->EnableResponseCache(service_name, method_name, ttl_ms);
+    }
+
+    ResponseCache::Stats Server::GetResponseCacheStats()
+    {
+        return impl_->GetResponseCacheStats();
+    }
+
+    bool Server::EnableCoalescing(std::string const& service_name,
+            std::string const& method_name, bool enable)
+    {
+        return impl_->EnableCoalescing(service_name, method_name, enable);
+    }
+
     boost_ec Server::Listen(std::string const& url)
     {
         return impl_->Listen(url);
     }
 
+    bool Server::Drain(int timeout_ms)
+    {
+        return impl_->Drain(timeout_ms);
+    }
+
+    std::vector<MethodStats::Snapshot> Server::GetStats()
+    {
+        return impl_->GetStats();
+    }
+
+    DatagramStats Server::GetDatagramStats()
+    {
+        return impl_->GetDatagramStats();
+    }
+
     Server& Server::BindTransport(std::unique_ptr<ITransportServer> && transport)
     {
         impl_->BindTransport(std::move(transport));
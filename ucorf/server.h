@@ -19,8 +19,25 @@ namespace ucorf
 
         void RemoveService(std::string const& service_name);
 
+        bool SetServiceDispatch(std::string const& service_name, eDispatchMode mode,
+                std::size_t max_concurrency = -1);
+
+        bool EnableResponseCache(std::string const& service_name,
+                std::string const& method_name, int ttl_ms);
+
+        ResponseCache::Stats GetResponseCacheStats();
+
+        bool EnableCoalescing(std::string const& service_name,
+                std::string const& method_name, bool enable);
+
         boost_ec Listen(std::string const& url);
 
+        bool Drain(int timeout_ms);
+
+        std::vector<MethodStats::Snapshot> GetStats();
+
+        DatagramStats GetDatagramStats();
+
         /// --------------------------- extend method ---------------------------
     public:
         Server& BindTransport(std::unique_ptr<ITransportServer> && transport);
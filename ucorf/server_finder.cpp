@@ -40,7 +40,7 @@ namespace ucorf
 
         // single connection.
         mode_ = eMode::single;
-        single_tp_.reset(tp_factory_());
+        single_tp_.reset(NewTransport(url_));
         if (!opt_->transport_opt.empty())
             single_tp_->SetOption(opt_->transport_opt);
         boost::weak_ptr<ITransportClient> weak(single_tp_);
@@ -70,6 +70,13 @@ namespace ucorf
         opt_ = opt;
     }
 
+    ITransportClient* ServerFinder::NewTransport(std::string const& url)
+    {
+        if (tp_factory_)
+            return tp_factory_();
+        return CreateTransportClient(url);
+    }
+
     boost_ec ServerFinder::ReConnect()
     {
         if (mode_ == eMode::zk) {
@@ -99,7 +106,7 @@ namespace ucorf
             if (transports_.count(url)) {
                 tp_group[url].swap(transports_[url]);
             } else {
-                boost::shared_ptr<ITransportClient> tp(tp_factory_());
+                boost::shared_ptr<ITransportClient> tp(NewTransport(url));
                 tp_group[url] = tp;
                 if (!opt_->transport_opt.empty())
                     tp->SetOption(opt_->transport_opt);
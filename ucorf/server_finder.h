@@ -40,6 +40,9 @@ namespace ucorf
                 SessId id, boost_ec const& ec, std::string url,
                 boost::shared_ptr<bool> token, boost::shared_ptr<co_mutex> mutex);
 
+        // 未设置TransportFactory时按url的协议创建
+        ITransportClient* NewTransport(std::string const& url);
+
         void RecursiveConnect(boost::shared_ptr<ITransportClient> sptr, std::string url,
                 boost::shared_ptr<bool> token, boost::shared_ptr<co_mutex> mutex);
 
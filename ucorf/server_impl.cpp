@@ -1,17 +1,24 @@
 #include "server_impl.h"
 #include "message.h"
 #include "service.h"
+#include "introspect_service.h"
 #include "logger.h"
 #include "zookeeper.h"
+#include "inproc_transport.h"
+#include "stream_transport.h"
+#include "datagram_transport.h"
 #include <boost/algorithm/string.hpp>
-#include "net_transport.h"
+#include <boost/functional/hash.hpp>
 
 namespace ucorf
 {
     ServerImpl::ServerImpl()
-        : opt_(new Option), register_(new ZookeeperRegister),
-        head_factory_(&UcorfHead::Factory)
+        : method_table_(new MethodTable), opt_(new Option),
+        register_(new ZookeeperRegister), head_factory_(&UcorfHead::Factory),
+        scheduler_(opt_->max_dispatch_coroutines)
     {
+        scheduler_.SetMaxQueueLength(opt_->max_dispatch_queue_length);
+        RegisterService(boost::make_shared<IntrospectService>(this));
     }
 
     ServerImpl::~ServerImpl()
@@ -20,10 +27,20 @@ namespace ucorf
     }
 
     ServerImpl& ServerImpl::BindTransport(std::unique_ptr<ITransportServer> && transport)
+    {
+        ApplyTransportOption(transport.get());
+        AddTransport(std::move(transport));
+        return *this;
+    }
+
+    void ServerImpl::ApplyTransportOption(ITransportServer *transport)
     {
         if (!opt_->transport_opt.empty())
             transport->SetOption(opt_->transport_opt);
+    }
 
+    void ServerImpl::AddTransport(std::unique_ptr<ITransportServer> && transport)
+    {
         transport->SetReceiveCb(boost::bind(&ServerImpl::OnReceiveData,
                     this, transport.get(), _1, _2, _3));
         transport->SetConnectedCb(boost::bind(&ServerImpl::OnConnected,
@@ -31,14 +48,27 @@ namespace ucorf
         transport->SetDisconnectedCb(boost::bind(&ServerImpl::OnDisconnected,
                     this, transport.get(), _1, _2));
         transports_.push_back(std::move(transport));
-        return *this;
     }
 
     ServerImpl& ServerImpl::SetOption(boost::shared_ptr<Option> opt)
     {
         opt_ = opt;
         for (auto &p:transports_)
-            p->SetOption(opt_);
+            ApplyTransportOption(p.get());
+        scheduler_.SetMaxWorkers(opt_->max_dispatch_coroutines);
+        scheduler_.SetMaxQueueLength(opt_->max_dispatch_queue_length);
+        response_cache_.SetCapacity(opt_->response_cache_bytes);
+        for (auto &kv : services_)
+            for (auto &codel : kv.second->codels) {
+                codel->SetTarget(opt_->overload_target_ms);
+                codel->SetInterval(opt_->overload_interval_ms);
+            }
+
+        bool has_introspection = services_.count(IntrospectService::service_name()) > 0;
+        if (opt_->enable_introspection && !has_introspection)
+            RegisterService(boost::make_shared<IntrospectService>(this));
+        else if (!opt_->enable_introspection && has_introspection)
+            RemoveService(IntrospectService::service_name());
         return *this;
     }
 
@@ -57,8 +87,11 @@ namespace ucorf
 
     bool ServerImpl::RegisterTo(std::string const& url)
     {
+        // 多个SO_REUSEPORT监听的地址相同, 只注册一次
+        std::set<std::string> addrs;
         for (auto &tp : transports_) {
             std::string addr = tp->LocalUrl();
+            if (!addrs.insert(addr).second) continue;
             if (!register_->Register(url, addr))
                 return false;
         }
@@ -69,33 +102,230 @@ namespace ucorf
     bool ServerImpl::RegisterService(boost::shared_ptr<IService> service)
     {
         std::string name = service->name();
-        return services_.insert(std::make_pair(name, service)).second;
+        boost::shared_ptr<ServiceEntry> entry(new ServiceEntry);
+        entry->service = service;
+        entry->queue = scheduler_.GetQueue(name);
+        for (auto &codel : entry->codels)
+            codel.reset(new Codel(opt_->overload_target_ms, opt_->overload_interval_ms));
+        if (!services_.insert(std::make_pair(name, entry)).second)
+            return false;
+
+        RebuildMethodTable();
+        return true;
     }
 
     void ServerImpl::RemoveService(std::string const& service_name)
     {
         services_.erase(service_name);
+        RebuildMethodTable();
+    }
+
+    std::size_t ServerImpl::MethodNameHash::operator()(MethodName const& name) const
+    {
+        std::size_t seed = 0;
+        boost::hash_range(seed, name.first.begin(), name.first.end());
+        boost::hash_combine(seed, name.first.size());
+        boost::hash_range(seed, name.second.begin(), name.second.end());
+        return seed;
+    }
+
+    void ServerImpl::MethodTable::Insert(MethodKey const& key, MethodEntry const& entry)
+    {
+        keys.push_back(key);
+        MethodKey const& stored = keys.back();
+        entries.insert(std::make_pair(MethodName(stored.first, stored.second), entry));
+    }
+
+    ServerImpl::MethodEntry const* ServerImpl::MethodTable::Find(
+            boost::string_ref service, boost::string_ref method) const
+    {
+        auto it = entries.find(MethodName(service, method));
+        return entries.end() == it ? nullptr : &it->second;
+    }
+
+    void ServerImpl::RebuildMethodTable()
+    {
+        boost::shared_ptr<MethodTable> table(new MethodTable);
+        for (auto &kv : services_)
+        {
+            auto insert = [&](MethodKey const& key, int method_idx, bool with_stats) {
+                MethodPolicy policy;
+                auto policy_it = method_policies_.find(key);
+                if (method_policies_.end() != policy_it)
+                    policy = policy_it->second;
+
+                MethodEntry entry = {kv.second, method_idx, policy.cache_ttl_ms, policy.coalesce,
+                    with_stats ? stats_.Get(key.first, key.second) : boost::shared_ptr<MethodStats>()};
+                table->Insert(key, entry);
+            };
+
+            // 声明了方法列表的服务, 方法名为空的项只处理未知的方法, 不统计.
+            std::vector<std::string> methods = kv.second->service->methods();
+            insert(MethodKey(kv.first, ""), -1, methods.empty());
+            for (std::size_t i = 0; i < methods.size(); ++i)
+                insert(MethodKey(kv.first, methods[i]), (int)i, true);
+        }
+
+        boost::shared_ptr<const MethodTable> const_table(table);
+        boost::atomic_store(&method_table_, const_table);
+    }
+
+    bool ServerImpl::SetServiceDispatch(std::string const& service_name, eDispatchMode mode,
+            std::size_t max_concurrency)
+    {
+        auto it = services_.find(service_name);
+        if (services_.end() == it) return false;
+
+        it->second->default_mode = false;
+        it->second->mode = mode;
+        scheduler_.SetQueueLimit(service_name, max_concurrency);
+        return true;
+    }
+
+    bool ServerImpl::EnableResponseCache(std::string const& service_name,
+            std::string const& method_name, int ttl_ms)
+    {
+        return SetMethodPolicy(MethodKey(service_name, method_name),
+                [=](MethodPolicy & policy) { policy.cache_ttl_ms = (std::max)(ttl_ms, 0); });
+    }
+
+    ResponseCache::Stats ServerImpl::GetResponseCacheStats()
+    {
+        return response_cache_.GetStats();
+    }
+
+    bool ServerImpl::EnableCoalescing(std::string const& service_name,
+            std::string const& method_name, bool enable)
+    {
+        return SetMethodPolicy(MethodKey(service_name, method_name),
+                [=](MethodPolicy & policy) { policy.coalesce = enable; });
+    }
+
+    bool ServerImpl::SetMethodPolicy(MethodKey const& key,
+            boost::function<void(MethodPolicy&)> const& modify)
+    {
+        if (!method_table_->Find(key.first, key.second)) return false;
+
+        modify(method_policies_[key]);
+        RebuildMethodTable();
+        return true;
     }
 
     boost_ec ServerImpl::Listen(std::string const& url)
     {
-        std::unique_ptr<ITransportServer> tp(new NetTransportServer);
+        if (opt_->reuseport_listeners > 1 && boost::istarts_with(url, "tcp://"))
+            return ListenReusePort(url, opt_->reuseport_listeners);
+
+        std::unique_ptr<ITransportServer> tp(CreateTransportServer(url));
+        if (InprocTransportServer *inproc = dynamic_cast<InprocTransportServer*>(tp.get()))
+            inproc->SetDirectCall(boost::bind(&ServerImpl::DirectCall, this, _1, _2, _3, _4, _5));
+        // 部分transport(如socket缓冲区大小)需要在Listen前设置
+        ApplyTransportOption(tp.get());
         boost_ec ec = tp->Listen(url);
         if (ec) return ec;
-        BindTransport(std::move(tp));
+        AddTransport(std::move(tp));
+        return boost_ec();
+    }
+
+    boost_ec ServerImpl::ListenReusePort(std::string const& url, int count)
+    {
+        std::vector<std::unique_ptr<ITransportServer>> listeners;
+        std::string listen_url = url;
+        for (int i = 0; i < count; ++i) {
+            // 与libgonet一样遵守transport_opt中的max_pack_size_和sndtimeo_
+            std::unique_ptr<StreamTransportServer> tp(new StreamTransportServer);
+            tp->SetReusePort(true);
+            ApplyTransportOption(tp.get());
+            boost_ec ec = tp->Listen(listen_url);
+            if (ec) {
+                for (auto &p : listeners)
+                    p->Shutdown();
+                return ec;
+            }
+
+            // 端口为0时, 后面的socket监听第一个socket分配到的端口
+            listen_url = tp->LocalUrl();
+            listeners.push_back(std::move(tp));
+        }
+
+        for (auto &tp : listeners)
+            AddTransport(std::move(tp));
         return boost_ec();
     }
 
+    bool ServerImpl::Drain(int timeout_ms)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        auto wait = [&](std::atomic<long> & count) {
+            while (count > 0) {
+                if (std::chrono::steady_clock::now() >= deadline) return false;
+                co_sleep(10);
+            }
+            return true;
+        };
+
+        register_->Unregister();
+        draining_ = true;
+
+        for (auto &tp : transports_) {
+            ITransportServer *p = tp.get();
+            p->ForEachSession([=](SessId sess_id){ this->SendGoAway(p, sess_id); });
+        }
+
+        bool ok = wait(inflight_);
+        if (!ok)
+            ucorf_log_warn("drain timeout, %ld requests still in process", (long)inflight_);
+
+        for (auto &tp : transports_) {
+            ITransportServer *p = tp.get();
+            p->ForEachSession([=](SessId sess_id){ p->Close(sess_id); });
+        }
+        ok = wait(connections_) && ok;
+
+        for (auto &tp : transports_)
+            tp->Shutdown();
+        return ok;
+    }
+
+    std::vector<MethodStats::Snapshot> ServerImpl::GetStats()
+    {
+        return stats_.GetSnapshot();
+    }
+
+    DatagramStats ServerImpl::GetDatagramStats()
+    {
+        DatagramStats stats;
+        for (auto &tp : transports_)
+            if (DatagramTransportServer *dgram = dynamic_cast<DatagramTransportServer*>(tp.get()))
+                stats += dgram->GetStats();
+        return stats;
+    }
+
+    void ServerImpl::SendGoAway(ITransportServer *tp, SessId sess_id)
+    {
+        IHeaderPtr header = head_factory_();
+        header->SetType(eHeaderType::goaway);
+        if (header->GetType() != eHeaderType::goaway) return ;    // 协议不支持
+
+        header->SetId(0);
+        header->SetFollowBytes(0);
+        std::vector<char> buf(header->ByteSize());
+        if (!header->Serialize(&buf[0], buf.size())) return ;
+        tp->Send(sess_id, std::move(buf));
+    }
+
     void ServerImpl::OnConnected(ITransportServer *tp, SessId sess_id)
     {
-        (void)tp;
-        (void)sess_id;
+        ++connections_;
+        if (draining_)
+            tp->Close(sess_id);
     }
     void ServerImpl::OnDisconnected(ITransportServer *tp, SessId sess_id, boost_ec const& ec)
     {
         (void)tp;
         (void)sess_id;
         (void)ec;
+        --connections_;
     }
 
     size_t ServerImpl::OnReceiveData(ITransportServer *tp, SessId sess_id, const char* data, size_t bytes)
@@ -133,28 +363,173 @@ namespace ucorf
 
     bool ServerImpl::DispatchMsg(Session & sess, const char* data, size_t bytes)
     {
-        std::string const& srv_name = sess.header->GetService();
-        auto it = services_.find(srv_name);
-        if (services_.end() == it) return false;
+        boost::shared_ptr<const MethodTable> table = boost::atomic_load(&method_table_);
+        std::string service_buf, method_buf;
+        boost::string_ref service_name = sess.header->ServiceRef(service_buf);
+        boost::string_ref method_name = sess.header->MethodRef(method_buf);
+        MethodEntry const* found = table->Find(service_name, method_name);
+        if (!found) {
+            found = table->Find(service_name, boost::string_ref());
+            if (!found) return false;
+        }
+
+        ++inflight_;
+        MethodEntry const& method = *found;
+        MethodStats::clock_t::time_point start;
+        if (opt_->enable_stats && method.stats) {
+            start = MethodStats::clock_t::now();
+            method.stats->Enter();
+        }
+
+        Span span;
+        TraceContext parent = sess.header->GetTraceContext();
+        if (parent) {
+            sess.header->SetTraceContext(TraceContext());   // 响应不带跟踪扩展
+            Tracer & tracer = Tracer::getInstance();
+            if (tracer.IsEnabled())
+                tracer.BeginSpan(span, eSpanKind::server, parent,
+                        service_name.to_string(), method_name.to_string());
+        }
+
+        std::string req_key;
+        if ((method.cache_ttl_ms > 0 || method.coalesce) &&
+                sess.header->GetType() == eHeaderType::request) {
+            req_key = ResponseCache::MakeKey(service_name.to_string(), method_name.to_string(), data, bytes);
+        }
+
+        if (method.cache_ttl_ms > 0 && !req_key.empty()) {
+            ResponseCache::Value cached = response_cache_.Get(req_key);
+            if (cached) {
+                Reply(sess, eHeaderType::response, cached->data(), cached->size());
+                FinishMsg(method, start, span, eUcorfErrorCode::ec_ok, bytes, cached->size());
+                return true;
+            }
+        }
+
+        ServiceEntry & entry = *method.srv;
+        eDispatchMode mode = entry.default_mode ? opt_->dispatch_mode : entry.mode;
+        if (mode == eDispatchMode::inline_call) {
+            Tracer::Scope scope(span.Context());
+            std::size_t rsp_bytes = 0;
+            eUcorfErrorCode code = ProcessMsg(sess, method, data, bytes, req_key, rsp_bytes);
+            FinishMsg(method, start, span, code, bytes, rsp_bytes);
+            return true;
+        }
+
+        // 接收回调返回后data即失效, 异步处理前需要拷贝一份.
+        boost::shared_ptr<std::vector<char>> body(new std::vector<char>(data, data + bytes));
+        // 每个优先级单独检测排队时长, 高优先级的请求先被处理, 排队时长较短,
+        // 过载时低优先级的请求会先被拒绝.
+        ePriority priority = sess.header->GetPriority();
+        if ((int)priority >= e_priority_count) priority = ePriority::normal;
+        boost::shared_ptr<Codel> codel = entry.codels[(int)priority];
+        auto recv_time = Codel::clock_t::now();
+        bool posted = scheduler_.Post(entry.queue, [=]{
+                    Session s = sess;
+                    if (opt_->overload_target_ms > 0 &&
+                            codel->Overloaded(Codel::clock_t::now() - recv_time)) {
+                        this->ReplyError(s, eUcorfErrorCode::ec_overload);
+                        this->FinishMsg(method, start, span, eUcorfErrorCode::ec_overload, body->size(), 0);
+                        return ;
+                    }
+
+                    Tracer::Scope scope(span.Context());
+                    std::size_t rsp_bytes = 0;
+                    eUcorfErrorCode code = this->ProcessMsg(s, method,
+                            body->data(), body->size(), req_key, rsp_bytes);
+                    this->FinishMsg(method, start, span, code, body->size(), rsp_bytes);
+                }, priority);
+        if (!posted) {
+            ReplyError(sess, eUcorfErrorCode::ec_overload);
+            FinishMsg(method, start, span, eUcorfErrorCode::ec_overload, bytes, 0);
+        }
+        return true;
+    }
+
+    boost::optional<boost_ec> ServerImpl::DirectCall(std::string const& service_name,
+            std::string const& method_name, IMessage *request, IMessage *response,
+            TraceContext const& trace)
+    {
+        if (draining_ || !request || !response) return boost::none;
 
-        auto &service = it->second;
-        std::unique_ptr<IMessage> response(service->CallMethod(sess.header->GetMethod(), data, bytes));
-        if (!response) return true;
+        boost::shared_ptr<const MethodTable> table = boost::atomic_load(&method_table_);
+        MethodEntry const* found = table->Find(service_name, method_name);
+        if (!found) return boost::none;
+
+        MethodEntry const& method = *found;
+        IService *service = method.srv->service.get();
+        if (method.method_idx < 0 || method.cache_ttl_ms > 0 || method.coalesce ||
+                !service->SupportDirectCall(method.method_idx, *request, *response))
+            return boost::none;
+
+        ++inflight_;
+        MethodStats::clock_t::time_point start;
+        if (opt_->enable_stats && method.stats) {
+            start = MethodStats::clock_t::now();
+            method.stats->Enter();
+        }
+
+        Span span;
+        Tracer & tracer = Tracer::getInstance();
+        if (trace && tracer.IsEnabled())
+            tracer.BeginSpan(span, eSpanKind::server, trace, service_name, method_name);
+
+        bool ok;
+        {
+            Tracer::Scope scope(span.Context());
+            ok = service->CallMethodDirect(method.method_idx, *request, *response);
+        }
+
+        eUcorfErrorCode code = ok ? eUcorfErrorCode::ec_ok : eUcorfErrorCode::ec_call_error;
+        FinishMsg(method, start, span, code, 0, 0);
+        return boost::optional<boost_ec>(ok ? boost_ec() : MakeUcorfErrorCode(code));
+    }
+
+    eUcorfErrorCode ServerImpl::ProcessMsg(Session & sess, MethodEntry const& method,
+            const char* data, size_t bytes, std::string const& req_key,
+            std::size_t & rsp_bytes)
+    {
+        if (method.coalesce && !req_key.empty()) {
+            bool shared = false;
+            ResponseCache::Value body = flight_.Do(req_key,
+                    [&]{ return this->CallAndSerialize(sess, method, data, bytes); },
+                    &shared);
+            if (!body) return eUcorfErrorCode::ec_call_error;
+
+            if (method.cache_ttl_ms > 0 && !shared)
+                response_cache_.Put(req_key, body, method.cache_ttl_ms);
+            Reply(sess, eHeaderType::response, body->data(), body->size());
+            rsp_bytes = body->size();
+            return eUcorfErrorCode::ec_ok;
+        }
+
+        IService *service = method.srv->service.get();
+        std::unique_ptr<IMessage> response(method.method_idx >= 0
+                ? service->CallMethodByIdx(method.method_idx, data, bytes)
+                : service->CallMethod(sess.header->GetMethod(), data, bytes));
+        if (!response) {
+            return sess.header->GetType() == eHeaderType::oneway_request
+                ? eUcorfErrorCode::ec_ok : eUcorfErrorCode::ec_call_error;
+        }
 
         // reply
         if (sess.header->GetType() != eHeaderType::oneway_request) {
             sess.header->SetType(eHeaderType::response);
-            sess.header->SetFollowBytes(response->ByteSize());
             std::vector<char> buf;
-            buf.resize(sess.header->ByteSize() + response->ByteSize());
-            sess.header->Serialize(&buf[0], sess.header->ByteSize());
-            if (!response->Serialize(&buf[sess.header->ByteSize()], response->ByteSize())) {
+            if (!SerializeFrame(*sess.header, *response, buf)) {
                 ucorf_log_warn("response serialize error. srv=%s, method=%s, msgid=%llu",
                         sess.header->GetService().c_str(), sess.header->GetMethod().c_str(),
                         (unsigned long long)sess.header->GetId());
-                return true;
+                return eUcorfErrorCode::ec_parse_error;
+            }
+
+            if (method.cache_ttl_ms > 0 && !req_key.empty()) {
+                std::size_t body_len = sess.header->GetFollowBytes();
+                ResponseCache::Value value(new std::string(&buf[buf.size() - body_len], body_len));
+                response_cache_.Put(req_key, value, method.cache_ttl_ms);
             }
 
+            rsp_bytes = buf.size();
             sess.transport->Send(sess.sess, std::move(buf), [sess](boost_ec const& ec) {
                     if (ec)
                         ucorf_log_warn("response send error: %s. srv=%s, method=%s, msgid=%llu",
@@ -162,8 +537,61 @@ namespace ucorf
                             sess.header->GetMethod().c_str(), (unsigned long long)sess.header->GetId());
                     });
         }
+        return eUcorfErrorCode::ec_ok;
+    }
 
-        return true;
+    void ServerImpl::FinishMsg(MethodEntry const& method, MethodStats::clock_t::time_point start,
+            Span const& span, eUcorfErrorCode code, std::size_t req_bytes, std::size_t rsp_bytes)
+    {
+        --inflight_;
+        if (span)
+            Tracer::getInstance().EndSpan(span, (int)code);
+        if (start == MethodStats::clock_t::time_point()) return ;
+
+        MethodStats::Traffic traffic;
+        traffic.in = req_bytes;
+        traffic.out = rsp_bytes;
+        method.stats->Leave(MethodStats::clock_t::now() - start, code, traffic);
+    }
+
+    ResponseCache::Value ServerImpl::CallAndSerialize(Session & sess, MethodEntry const& method,
+            const char* data, size_t bytes)
+    {
+        IService *service = method.srv->service.get();
+        std::unique_ptr<IMessage> response(method.method_idx >= 0
+                ? service->CallMethodByIdx(method.method_idx, data, bytes)
+                : service->CallMethod(sess.header->GetMethod(), data, bytes));
+        if (!response) return ResponseCache::Value();
+
+        boost::shared_ptr<std::string> body(new std::string(response->ByteSize(), '\0'));
+        if (!body->empty() && !response->SerializeWithCachedSize(&(*body)[0], body->size())) {
+            ucorf_log_warn("response serialize error. srv=%s, method=%s, msgid=%llu",
+                    sess.header->GetService().c_str(), sess.header->GetMethod().c_str(),
+                    (unsigned long long)sess.header->GetId());
+            return ResponseCache::Value();
+        }
+        return body;
+    }
+
+    void ServerImpl::ReplyError(Session & sess, eUcorfErrorCode code)
+    {
+        if (sess.header->GetType() == eHeaderType::oneway_request) return ;
+
+        uint32_t body = htonl((uint32_t)code);
+        Reply(sess, eHeaderType::error_response, &body, sizeof(body));
+    }
+
+    void ServerImpl::Reply(Session & sess, eHeaderType type, const void* body, std::size_t bytes)
+    {
+        sess.header->SetType(type);
+        sess.header->SetFollowBytes(bytes);
+        std::size_t head_len = sess.header->ByteSize();
+        std::vector<char> buf;
+        buf.resize(head_len + bytes);
+        sess.header->Serialize(&buf[0], head_len);
+        if (bytes)
+            memcpy(&buf[head_len], body, bytes);
+        sess.transport->Send(sess.sess, std::move(buf));
     }
 
 } //namespace ucorf
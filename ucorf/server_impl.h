@@ -5,6 +5,16 @@
 #include "message.h"
 #include "option.h"
 #include "server_register.h"
+#include "request_scheduler.h"
+#include "codel.h"
+#include "error.h"
+#include "response_cache.h"
+#include "single_flight.h"
+#include "stats.h"
+#include "tracer.h"
+#include "datagram_transport.h"
+#include <boost/optional.hpp>
+#include <deque>
 
 namespace ucorf
 {
@@ -18,6 +28,8 @@ namespace ucorf
     class IService;
     class ServerImpl
     {
+        friend class IntrospectService;
+
     public:
         typedef boost::function<IMessage*(std::string const&, std::string const&)> MessageFactory;
 
@@ -32,8 +44,37 @@ namespace ucorf
 
         void RemoveService(std::string const& service_name);
 
+        // 设置单个服务的请求分发方式, 覆盖Option中的dispatch_mode.
+        // @max_concurrency: coroutine模式下该服务同时处理的请求数上限, -1表示不限制.
+        bool SetServiceDispatch(std::string const& service_name, eDispatchMode mode,
+                std::size_t max_concurrency = -1);
+
+        // 开启幂等方法的响应缓存, 相同的请求包体在ttl内直接返回缓存的响应,
+        // 不再解析请求和调用服务. ttl_ms为0表示关闭.
+        bool EnableResponseCache(std::string const& service_name,
+                std::string const& method_name, int ttl_ms);
+
+        ResponseCache::Stats GetResponseCacheStats();
+
+        // 合并并发的相同请求(服务名, 方法名, 请求包体都相同),
+        // 只调用一次服务, 所有请求共享同一个响应.
+        bool EnableCoalescing(std::string const& service_name,
+                std::string const& method_name, bool enable);
+
+        // Option::reuseport_listeners大于1时, tcp地址打开多个SO_REUSEPORT监听.
         boost_ec Listen(std::string const& url);
 
+        // 平滑退出: 先从注册中心注销, 拒绝新连接, 通知client不再发来新请求,
+        // 等待处理中的请求完成后关闭所有连接.
+        // @returns: 在timeout_ms内完成返回true, 超时则强制关闭.
+        bool Drain(int timeout_ms);
+
+        // 各方法的调用统计, Option::enable_stats开启时记录.
+        std::vector<MethodStats::Snapshot> GetStats();
+
+        // udp://监听的收发和丢包统计, 多个udp监听时为总和.
+        DatagramStats GetDatagramStats();
+
         /// --------------------------- extend method ---------------------------
     public:
         ServerImpl& BindTransport(std::unique_ptr<ITransportServer> && transport);
@@ -48,15 +89,111 @@ namespace ucorf
 
         bool DispatchMsg(Session & sess, const char* data, size_t bytes);
 
+        void ReplyError(Session & sess, eUcorfErrorCode code);
+
+        void Reply(Session & sess, eHeaderType type, const void* body, std::size_t bytes);
+
+        void SendGoAway(ITransportServer *tp, SessId sess_id);
+
+        // 同进程内的client跳过序列化直接调用服务, 返回空表示不能直接调用.
+        boost::optional<boost_ec> DirectCall(std::string const& service_name,
+                std::string const& method_name, IMessage *request, IMessage *response,
+                TraceContext const& trace);
+
+    private:
+        struct ServiceEntry
+        {
+            boost::shared_ptr<IService> service;
+            bool default_mode = true;
+            eDispatchMode mode = eDispatchMode::inline_call;
+            RequestScheduler::QueueId queue = nullptr;  // 注册时查好, 分发时不再按名字查找
+            boost::shared_ptr<Codel> codels[e_priority_count];
+        };
+        typedef std::map<std::string, boost::shared_ptr<ServiceEntry>> ServiceMap;
+
+        // 分发表, 注册服务时生成, 之后只读.
+        // 每个服务都有一个方法名为空的项, 用于按方法名动态分发的服务和未知的方法.
+        struct MethodEntry
+        {
+            boost::shared_ptr<ServiceEntry> srv;
+            int method_idx;     // IService::methods()中的下标, -1表示按方法名分发
+            int cache_ttl_ms;   // 响应缓存时长, 0表示不缓存
+            bool coalesce;      // 是否合并并发的相同请求
+            boost::shared_ptr<MethodStats> stats;   // 可能为空
+        };
+        typedef std::pair<std::string, std::string> MethodKey;
+
+        // 分发表的key指向keys中保存的字符串, 查找时不需要为每个请求拷贝服务名和方法名.
+        typedef std::pair<boost::string_ref, boost::string_ref> MethodName;
+        struct MethodNameHash
+        {
+            std::size_t operator()(MethodName const& name) const;
+        };
+        struct MethodTable
+        {
+            std::deque<MethodKey> keys;
+            std::unordered_map<MethodName, MethodEntry, MethodNameHash> entries;
+
+            void Insert(MethodKey const& key, MethodEntry const& entry);
+
+            // 找不到返回nullptr
+            MethodEntry const* Find(boost::string_ref service, boost::string_ref method) const;
+        };
+
+        // 按方法设置的处理策略
+        struct MethodPolicy
+        {
+            int cache_ttl_ms = 0;
+            bool coalesce = false;
+        };
+        typedef std::map<MethodKey, MethodPolicy> PolicyMap;
+
+        void RebuildMethodTable();
+
+        // 打开@count个监听同一地址的SO_REUSEPORT socket
+        boost_ec ListenReusePort(std::string const& url, int count);
+
+        // Option::transport_opt只在这里设置给transport: Listen时在监听前设置,
+        // BindTransport传入的transport在绑定时设置, SetOption时重新设置给已有的transport.
+        void ApplyTransportOption(ITransportServer *transport);
+
+        // 设置回调并加入transports_, 不设置选项.
+        void AddTransport(std::unique_ptr<ITransportServer> && transport);
+
+        bool SetMethodPolicy(MethodKey const& key,
+                boost::function<void(MethodPolicy&)> const& modify);
+
+        // @req_key: 请求的唯一标识, 开启了缓存或合并的方法才非空.
+        // @rsp_bytes: 返回响应的字节数.
+        eUcorfErrorCode ProcessMsg(Session & sess, MethodEntry const& method,
+                const char* data, size_t bytes, std::string const& req_key,
+                std::size_t & rsp_bytes);
+
+        // 请求处理完毕, @start为空表示未开启统计, @span为空表示未跟踪.
+        void FinishMsg(MethodEntry const& method, MethodStats::clock_t::time_point start,
+                Span const& span, eUcorfErrorCode code, std::size_t req_bytes, std::size_t rsp_bytes);
+
+        // 调用服务并序列化响应包体, 无响应时返回空指针.
+        ResponseCache::Value CallAndSerialize(Session & sess, MethodEntry const& method,
+                const char* data, size_t bytes);
+
     private:
-        typedef std::map<std::string, boost::shared_ptr<IService>> ServiceMap;
         typedef std::list<std::unique_ptr<ITransportServer>> TransportList;
 
         ServiceMap services_;
+        boost::shared_ptr<const MethodTable> method_table_;
+        PolicyMap method_policies_;
+        ResponseCache response_cache_;
+        SingleFlight<ResponseCache::Value> flight_;
+        StatsRegistry stats_;
         boost::shared_ptr<Option> opt_;
         boost::shared_ptr<IServerRegister> register_;
         HeaderFactory head_factory_;
         TransportList transports_;
+        RequestScheduler scheduler_;
+        std::atomic<bool> draining_{false};
+        std::atomic<long> inflight_{0};
+        std::atomic<long> connections_{0};
     };
 
 } //namespace ucorf
@@ -2,6 +2,7 @@
 
 #include "preheader.h"
 #include "message.h"
+#include <boost/optional.hpp>
 
 namespace ucorf
 {
@@ -15,6 +16,34 @@ namespace ucorf
 
         virtual std::unique_ptr<IMessage> CallMethod(std::string const& method,
                 const char *request_data, size_t request_bytes) = 0;
+
+        // 服务提供的方法列表, 注册到Server时用于预先生成分发表.
+        // 返回空表示按方法名动态分发; 返回非空时需要实现CallMethodByIdx.
+        virtual std::vector<std::string> methods() { return std::vector<std::string>(); }
+
+        // @method_idx: methods()中的下标.
+        virtual std::unique_ptr<IMessage> CallMethodByIdx(int method_idx,
+                const char *request_data, size_t request_bytes)
+        {
+            return nullptr;
+        }
+
+        // 方法的签名(参数和返回值类型), 用于查询服务提供的接口.
+        // @method_idx: methods()中的下标.
+        virtual std::string signature(int method_idx) { return ""; }
+
+        // 同进程内直接调用(跳过序列化), 请求和响应的类型与方法一致时返回true.
+        // @method_idx: methods()中的下标.
+        virtual bool SupportDirectCall(int method_idx, IMessage & request, IMessage & response)
+        {
+            return false;
+        }
+
+        // SupportDirectCall返回true时才会被调用, 返回false表示调用失败.
+        virtual bool CallMethodDirect(int method_idx, IMessage & request, IMessage & response)
+        {
+            return false;
+        }
     };
 
     class Client;
@@ -27,8 +56,13 @@ namespace ucorf
 
         virtual std::string name() = 0;
 
+        // 设置通过该stub发起的调用的优先级, 未设置时使用Client的Option::priority.
+        // 需要开启Option::header_extensions才会发送给server.
+        void SetPriority(ePriority priority) { priority_ = priority; }
+
     protected:
         Client * c_;
+        boost::optional<ePriority> priority_;
     };
 
 } //namespace ucorf
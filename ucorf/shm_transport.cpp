@@ -0,0 +1,579 @@
+#include "shm_transport.h"
+#include "stream_transport.h"
+#include "logger.h"
+#include <boost/algorithm/string.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace ucorf
+{
+    static const std::string shm_prefix = "shm://";
+    static const uint32_t shm_magic = 0x75736d31;   // "usm1"
+
+    // 一个方向的环形缓冲区的控制信息, 读写位置只增不减, 对缓冲区大小取模得到偏移.
+    struct ShmRingCtrl
+    {
+        std::atomic<uint64_t> head;         // 写端写入位置
+        char pad1[56];
+        std::atomic<uint64_t> tail;         // 读端读取位置
+        char pad2[56];
+        std::atomic<uint32_t> sleeping;     // 读端阻塞在socket上, 需要唤醒
+        char pad3[60];
+    };
+
+    // 共享内存布局: [一页控制区][client->server数据区][server->client数据区]
+    struct ShmSegment
+    {
+        uint32_t magic;
+        uint32_t reserved;
+        uint64_t ring_bytes;
+        char pad[48];
+        ShmRingCtrl rings[2];
+    };
+
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    static std::size_t PageBytes()
+    {
+        return (std::size_t)::sysconf(_SC_PAGESIZE);
+    }
+
+    static bool ParseShmAddress(std::string const& url, sockaddr_storage & addr, socklen_t & addr_len)
+    {
+        if (!boost::istarts_with(url, shm_prefix)) return false;
+        std::string name = url.substr(shm_prefix.size());
+        if (name.empty()) return false;
+        return ParseStreamAddress("unix://@ucorf.shm." + name, addr, addr_len);
+    }
+
+    // session
+    ShmSession::ShmSession(int sock, bool is_server, ShmTransportOption const& opt)
+        : sock_(sock), is_server_(is_server), opt_(opt)
+    {
+    }
+
+    ShmSession::~ShmSession()
+    {
+        for (auto ring : rings_)
+            if (ring)
+                ::munmap(ring, ring_bytes_ * 2);
+        if (seg_)
+            ::munmap(seg_, PageBytes());
+        ::close(sock_);
+    }
+
+    boost_ec ShmSession::Map(int memfd, std::size_t ring_bytes, bool init)
+    {
+        static_assert(sizeof(ShmSegment) <= 4096, "ShmSegment must fit in one page");
+
+        std::size_t page = PageBytes();
+        if (ring_bytes < page || ring_bytes % page || (ring_bytes & (ring_bytes - 1)))
+            return MakeSysErrorCode(EINVAL);
+
+        struct stat st;
+        if (::fstat(memfd, &st) < 0)
+            return MakeSysErrorCode(errno);
+        if ((std::size_t)st.st_size < page + ring_bytes * 2)
+            return MakeSysErrorCode(EINVAL);
+
+        void* ctrl = ::mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (ctrl == MAP_FAILED)
+            return MakeSysErrorCode(errno);
+        seg_ = (ShmSegment*)ctrl;
+        ring_bytes_ = ring_bytes;
+
+        // 数据区映射两次, 跨越尾部的读写也是连续的.
+        for (int i = 0; i < 2; ++i) {
+            void* base = ::mmap(nullptr, ring_bytes * 2, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base == MAP_FAILED)
+                return MakeSysErrorCode(errno);
+            rings_[i] = (char*)base;
+
+            off_t offset = page + ring_bytes * i;
+            for (int j = 0; j < 2; ++j) {
+                void* p = ::mmap((char*)base + ring_bytes * j, ring_bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, memfd, offset);
+                if (p == MAP_FAILED)
+                    return MakeSysErrorCode(errno);
+            }
+        }
+
+        if (init) {
+            seg_->magic = shm_magic;
+            seg_->ring_bytes = ring_bytes;
+        } else if (seg_->magic != shm_magic || seg_->ring_bytes != ring_bytes) {
+            return MakeSysErrorCode(EPROTO);
+        }
+        return boost_ec();
+    }
+
+    void ShmSession::Start(OnReceiveF const& on_receive, OnCloseF const& on_close)
+    {
+        ShmSessionPtr self = shared_from_this();
+        go [=]{ self->ReadLoop(on_receive, on_close); };
+    }
+
+    bool ShmSession::WaitData(uint64_t seen)
+    {
+        ShmRingCtrl & ctrl = seg_->rings[is_server_ ? 0 : 1];
+        if (ctrl.head.load(std::memory_order_acquire) != seen) return true;
+
+        if (opt_.busy_poll_us > 0) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(opt_.busy_poll_us);
+            do {
+                co_yield;
+                if (ctrl.head.load(std::memory_order_acquire) != seen) return true;
+            } while (std::chrono::steady_clock::now() < deadline && !closed_);
+        }
+
+        for (;;) {
+            // 与Notify中的写端配对: 先标记睡眠再检查数据, 写端先写数据再检查标记.
+            ctrl.sleeping.store(1);
+            if (ctrl.head.load() != seen) {
+                ctrl.sleeping.store(0);
+                return true;
+            }
+
+            char buf[64];
+            ssize_t n = ::read(sock_, buf, sizeof(buf));
+            if (n > 0) {
+                if (ctrl.head.load(std::memory_order_acquire) != seen) return true;
+                continue;
+            }
+
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+    }
+
+    void ShmSession::ReadLoop(OnReceiveF on_receive, OnCloseF on_close)
+    {
+        ShmRingCtrl & ctrl = seg_->rings[is_server_ ? 0 : 1];
+        const char* data = rings_[is_server_ ? 0 : 1];
+        uint64_t mask = ring_bytes_ - 1;
+        uint64_t tail = ctrl.tail.load(std::memory_order_relaxed);
+        uint64_t seen = tail;
+        bool alive = true;
+        boost_ec ec;
+        for (;;)
+        {
+            uint64_t head = ctrl.head.load(std::memory_order_acquire);
+            if (head == seen) {
+                // 对端断开后把缓冲区中剩余的数据处理完再退出
+                if (!alive) break;
+                alive = WaitData(seen);
+                if (!alive) ec = MakeSysErrorCode(ECONNRESET);
+                continue;
+            }
+
+            // head由对端写入, 不可信: 超出缓冲区大小的数据会读到双重映射之外
+            if (head < tail || head - tail > ring_bytes_) {
+                ucorf_log_warn("shm ring corrupted: head=%llu tail=%llu",
+                        (unsigned long long)head, (unsigned long long)tail);
+                ec = MakeSysErrorCode(EBADMSG);
+                break;
+            }
+
+            seen = head;
+            std::size_t consume = on_receive(data + (tail & mask), head - tail);
+            if (consume == (std::size_t)-1) {
+                ec = MakeSysErrorCode(EBADMSG);
+                break;
+            }
+
+            tail += consume;
+            ctrl.tail.store(tail, std::memory_order_release);
+        }
+
+        closed_ = true;
+        ::shutdown(sock_, SHUT_RDWR);
+        on_close(ec);
+    }
+
+    boost_ec ShmSession::Send(const void* data, size_t bytes)
+    {
+        if (bytes > ring_bytes_)
+            return MakeSysErrorCode(EMSGSIZE);
+
+        ShmRingCtrl & ctrl = seg_->rings[is_server_ ? 1 : 0];
+        char* ring = rings_[is_server_ ? 1 : 0];
+        {
+            std::unique_lock<co_mutex> lock(send_mtx_);
+            uint64_t head = ctrl.head.load(std::memory_order_relaxed);
+            int spins = 0;
+            while (head + bytes - ctrl.tail.load(std::memory_order_acquire) > ring_bytes_) {
+                if (closed_)
+                    return MakeSysErrorCode(ENOTCONN);
+
+                // 缓冲区满, 等待对端读取
+                if (++spins < 64)
+                    co_yield;
+                else
+                    co_sleep(1);
+            }
+
+            if (closed_)
+                return MakeSysErrorCode(ENOTCONN);
+
+            memcpy(ring + (head & (ring_bytes_ - 1)), data, bytes);
+            ctrl.head.store(head + bytes);
+        }
+
+        Notify();
+        return boost_ec();
+    }
+
+    void ShmSession::Notify()
+    {
+        ShmRingCtrl & ctrl = seg_->rings[is_server_ ? 1 : 0];
+        if (ctrl.sleeping.load() && ctrl.sleeping.exchange(0)) {
+            // socket缓冲区满说明对端还有未读的唤醒字节, 丢弃也不会漏掉唤醒.
+            char c = 0;
+            ::send(sock_, &c, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+    }
+
+    void ShmSession::Close()
+    {
+        ::shutdown(sock_, SHUT_RDWR);
+    }
+
+    // server
+    ShmTransportServer::ShmTransportServer()
+    {
+        ucorf_log_debug("ShmTransportServer construct.");
+    }
+    ShmTransportServer::~ShmTransportServer()
+    {
+        ucorf_log_debug("ShmTransportServer destruct.");
+        Shutdown();
+    }
+
+    void ShmTransportServer::Shutdown()
+    {
+        int fd = listen_fd_.exchange(-1);
+        if (fd >= 0) {
+            ::shutdown(fd, SHUT_RDWR);
+            ::close(fd);
+        }
+
+        std::set<ShmSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(sessions_mtx_);
+            sessions = sessions_;
+        }
+        for (auto &sess : sessions)
+            sess->Close();
+    }
+    void ShmTransportServer::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void ShmTransportServer::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void ShmTransportServer::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+    void ShmTransportServer::SetOption(boost::any const& opt)
+    {
+        if (const ShmTransportOption* shm_opt = boost::any_cast<ShmTransportOption>(&opt))
+            opt_ = *shm_opt;
+        else if (!opt.empty())
+            WarnUnknownOption("ShmTransportServer", opt);
+    }
+
+    boost_ec ShmTransportServer::Listen(std::string const& url)
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseShmAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        if (::bind(fd, (sockaddr*)&addr, addr_len) < 0 || ::listen(fd, 1024) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        url_ = url;
+        listen_fd_ = fd;
+        go [=]{ this->AcceptLoop(fd); };
+        return boost_ec();
+    }
+
+    void ShmTransportServer::AcceptLoop(int listen_fd)
+    {
+        while (listen_fd_ == listen_fd)
+        {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                if (listen_fd_ != listen_fd) break;
+
+                ucorf_log_error("accept on %s error: %s", url_.c_str(), strerror(errno));
+                co_sleep(10);
+                continue;
+            }
+
+            go [=]{ this->OnAccept(fd); };
+        }
+    }
+
+    void ShmTransportServer::OnAccept(int fd)
+    {
+        ShmSessionPtr sess(new ShmSession(fd, true, opt_));
+
+        // 握手: client发送缓冲区大小和memfd, server映射成功后回复一个字节.
+        uint64_t ring_bytes = 0;
+        iovec iov;
+        iov.iov_base = &ring_bytes;
+        iov.iov_len = sizeof(ring_bytes);
+        char cbuf[CMSG_SPACE(sizeof(int))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        timeval tv;
+        tv.tv_sec = opt_.handshake_timeout_ms / 1000;
+        tv.tv_usec = (opt_.handshake_timeout_ms % 1000) * 1000;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        ssize_t n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        // 之后的read用于等待唤醒, 不能超时
+        tv.tv_sec = tv.tv_usec = 0;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int memfd = -1;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+        if (n != sizeof(ring_bytes) || memfd < 0) {
+            ucorf_log_warn("shm handshake on %s error: %s", url_.c_str(),
+                    n < 0 ? strerror(errno) : "bad request");
+            if (memfd >= 0) ::close(memfd);
+            return ;
+        }
+
+        boost_ec ec = sess->Map(memfd, ring_bytes, false);
+        ::close(memfd);
+        if (ec) {
+            ucorf_log_warn("shm map on %s error: %s", url_.c_str(), ec.message().c_str());
+            return ;
+        }
+
+        char ok = 1;
+        if (::send(fd, &ok, 1, MSG_NOSIGNAL) != 1) return ;
+
+        {
+            std::unique_lock<co_mutex> lock(sessions_mtx_);
+            sessions_.insert(sess);
+        }
+
+        ucorf_log_debug("new shm connection");
+        if (on_connect_)
+            on_connect_(SessId(sess));
+
+        sess->Start([=](const char* data, size_t bytes) {
+                    return this->on_receive_(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("shm connection disconnect: %s", ec.message().c_str());
+                    {
+                        std::unique_lock<co_mutex> lock(this->sessions_mtx_);
+                        this->sessions_.erase(sess);
+                    }
+                    if (this->on_disconnect_)
+                        this->on_disconnect_(SessId(sess), ec);
+                });
+    }
+
+    void ShmTransportServer::Send(SessId id, const void* data, size_t bytes, OnSndF const& cb)
+    {
+        ShmSessionPtr &sess = ::boost::any_cast<ShmSessionPtr&>(id);
+        boost_ec ec = sess->Send(data, bytes);
+        if (cb) cb(ec);
+    }
+    void ShmTransportServer::Send(SessId id, std::vector<char> && buf, OnSndF const& cb)
+    {
+        Send(id, buf.data(), buf.size(), cb);
+    }
+    std::string ShmTransportServer::LocalUrl() const
+    {
+        return url_;
+    }
+    void ShmTransportServer::ForEachSession(boost::function<void(SessId)> const& fn)
+    {
+        std::set<ShmSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(sessions_mtx_);
+            sessions = sessions_;
+        }
+
+        for (auto &sess : sessions)
+            fn(SessId(sess));
+    }
+    void ShmTransportServer::Close(SessId id)
+    {
+        ShmSessionPtr &sess = ::boost::any_cast<ShmSessionPtr&>(id);
+        sess->Close();
+    }
+
+    // client
+    ShmTransportClient::ShmTransportClient()
+    {
+        ucorf_log_debug("ShmTransportClient construct.");
+    }
+    ShmTransportClient::~ShmTransportClient()
+    {
+        ucorf_log_debug("ShmTransportClient destruct.");
+        Shutdown();
+    }
+
+    void ShmTransportClient::Shutdown()
+    {
+        ShmSessionPtr sess = GetSession();
+        if (sess)
+            sess->Close();
+    }
+    void ShmTransportClient::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void ShmTransportClient::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void ShmTransportClient::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+    void ShmTransportClient::SetOption(boost::any const& opt)
+    {
+        if (const ShmTransportOption* shm_opt = boost::any_cast<ShmTransportOption>(&opt))
+            opt_ = *shm_opt;
+        else if (!opt.empty())
+            WarnUnknownOption("ShmTransportClient", opt);
+    }
+
+    boost_ec ShmTransportClient::Connect(std::string const& url)
+    {
+        url_ = url;
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseShmAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        if (::connect(fd, (sockaddr*)&addr, addr_len) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        ShmSessionPtr sess(new ShmSession(fd, false, opt_));
+        int memfd = (int)::syscall(SYS_memfd_create, "ucorf-shm", MFD_CLOEXEC);
+        if (memfd < 0)
+            return MakeSysErrorCode(errno);
+
+        uint64_t ring_bytes = opt_.ring_bytes;
+        boost_ec ec;
+        if (::ftruncate(memfd, PageBytes() + ring_bytes * 2) < 0)
+            ec = MakeSysErrorCode(errno);
+        else
+            ec = sess->Map(memfd, ring_bytes, true);
+
+        if (!ec) {
+            iovec iov;
+            iov.iov_base = &ring_bytes;
+            iov.iov_len = sizeof(ring_bytes);
+            char cbuf[CMSG_SPACE(sizeof(int))];
+            memset(cbuf, 0, sizeof(cbuf));
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = cbuf;
+            msg.msg_controllen = sizeof(cbuf);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+            char ok = 0;
+            if (::sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(ring_bytes))
+                ec = MakeSysErrorCode(errno);
+            else if (::read(fd, &ok, 1) != 1 || ok != 1)
+                ec = MakeSysErrorCode(ECONNREFUSED);
+        }
+        ::close(memfd);
+        if (ec) return ec;
+
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            sess_ = sess;
+        }
+
+        ucorf_log_debug("shm connect sucess");
+        if (on_connect_)
+            on_connect_(SessId(sess));
+
+        sess->Start([=](const char* data, size_t bytes) {
+                    return this->on_receive_(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("shm disconnect because: %s", ec.message().c_str());
+                    if (this->on_disconnect_)
+                        this->on_disconnect_(SessId(sess), ec);
+                });
+        return boost_ec();
+    }
+    void ShmTransportClient::Send(const void* data, size_t bytes, OnSndF const& cb)
+    {
+        ShmSessionPtr sess = GetSession();
+        boost_ec ec = sess ? sess->Send(data, bytes) : MakeSysErrorCode(ENOTCONN);
+        if (cb) cb(ec);
+    }
+    void ShmTransportClient::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        Send(buf.data(), buf.size(), cb);
+    }
+    bool ShmTransportClient::IsEstab()
+    {
+        ShmSessionPtr sess = GetSession();
+        return sess && sess->IsEstab();
+    }
+    std::string ShmTransportClient::RemoteUrl() const
+    {
+        return url_;
+    }
+
+    ShmSessionPtr ShmTransportClient::GetSession()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return sess_;
+    }
+
+} //namespace ucorf
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "preheader.h"
+#include "transport.h"
+#include <set>
+#include <boost/enable_shared_from_this.hpp>
+
+namespace ucorf
+{
+    // 通过Option::transport_opt设置
+    struct ShmTransportOption
+    {
+        // 每个方向的环形缓冲区大小, 必须是页大小的整数倍且为2的幂, 以client端的设置为准.
+        // 单个数据包不能超过此大小.
+        std::size_t ring_bytes = 1024 * 1024;
+
+        // 缓冲区为空时在阻塞等待之前忙轮询的时长(微秒), 以CPU换延迟. 0表示不轮询.
+        int busy_poll_us = 0;
+
+        // server端等待client握手请求的超时(毫秒), 避免不发送数据的连接一直占用协程. 0表示不超时.
+        int handshake_timeout_ms = 3000;
+    };
+
+    struct ShmSegment;
+
+    // 同机进程间的共享内存连接.
+    // client创建memfd, 通过unix domain socket(SCM_RIGHTS)传给server, 之后两个方向各用一个
+    // 单生产者单消费者的环形缓冲区传递数据包. 数据区映射两次, 跨越尾部的数据在地址上也是连续的,
+    // 读端可以直接把缓冲区交给OnReceiveF, 无需拷贝.
+    // 这个socket同时作为唤醒通道: 读端没有数据时标记睡眠并阻塞在read上, 写端看到标记后写一个字节唤醒;
+    // 对端退出时read返回0, 据此检测断线.
+    class ShmSession : public boost::enable_shared_from_this<ShmSession>
+    {
+    public:
+        typedef ITransport::OnSndF OnSndF;
+        typedef boost::function<size_t(const char*, size_t)> OnReceiveF;
+        typedef boost::function<void(boost_ec const&)> OnCloseF;
+
+        ShmSession(int sock, bool is_server, ShmTransportOption const& opt);
+        ~ShmSession();
+
+        // 映射共享内存. @init: 由client端初始化控制区.
+        boost_ec Map(int memfd, std::size_t ring_bytes, bool init);
+
+        void Start(OnReceiveF const& on_receive, OnCloseF const& on_close);
+
+        // 数据直接写入环形缓冲区, 缓冲区满时等待对端读取.
+        boost_ec Send(const void* data, size_t bytes);
+
+        void Close();
+
+        bool IsEstab() const { return !closed_; }
+
+        int sock() const { return sock_; }
+
+    private:
+        void ReadLoop(OnReceiveF on_receive, OnCloseF on_close);
+
+        // 等待rx缓冲区中head不再等于seen. 返回false表示连接已断开.
+        bool WaitData(uint64_t seen);
+
+        void Notify();
+
+    private:
+        int sock_;
+        bool is_server_;
+        ShmTransportOption opt_;
+        std::atomic<bool> closed_{false};
+        co_mutex send_mtx_;
+
+        ShmSegment* seg_ = nullptr;
+        std::size_t ring_bytes_ = 0;
+        char* rings_[2] = {nullptr, nullptr};
+    };
+    typedef boost::shared_ptr<ShmSession> ShmSessionPtr;
+
+    // shm://name, 在abstract namespace的unix domain socket上交换共享内存.
+    class ShmTransportServer : public ITransportServer
+    {
+    public:
+        ShmTransportServer();
+        ~ShmTransportServer();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Listen(std::string const& url);
+        virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
+
+    private:
+        void AcceptLoop(int listen_fd);
+        void OnAccept(int fd);
+
+    private:
+        std::string url_;
+        ShmTransportOption opt_;
+        std::atomic<int> listen_fd_{-1};
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        co_mutex sessions_mtx_;
+        std::set<ShmSessionPtr> sessions_;
+    };
+
+    class ShmTransportClient : public ITransportClient
+    {
+    public:
+        ShmTransportClient();
+        ~ShmTransportClient();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Connect(std::string const& url);
+        virtual void Send(const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual bool IsEstab();
+        virtual std::string RemoteUrl() const;
+
+    private:
+        ShmSessionPtr GetSession();
+
+    private:
+        std::string url_;
+        ShmTransportOption opt_;
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        co_mutex mtx_;
+        ShmSessionPtr sess_;
+    };
+
+} //namespace ucorf
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "preheader.h"
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace ucorf
+{
+    // 合并并发的相同调用: 同一个key同时只有一个协程执行fn,
+    // 其他协程等待并共享它的结果.
+    // R需要可默认构造和拷贝, 一般使用shared_ptr.
+    // fn抛出异常时异常传给执行的协程, 等待的协程得到默认构造的R, 调用方需要把它当作失败处理.
+    template <typename R>
+    class SingleFlight : public boost::noncopyable
+    {
+    public:
+        typedef boost::function<R()> Func;
+
+        // @shared: 返回true表示结果来自其他协程的调用.
+        R Do(std::string const& key, Func const& fn, bool *shared = nullptr)
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            auto it = calls_.find(key);
+            if (calls_.end() != it) {
+                co_chan<R> waiter(1);
+                it->second.push_back(waiter);
+                lock.unlock();
+
+                R result;
+                waiter >> result;
+                if (shared) *shared = true;
+                return result;
+            }
+
+            calls_[key];
+            lock.unlock();
+
+            // 无论fn是否抛出异常, 都要删除key并唤醒等待者
+            struct Finisher
+            {
+                SingleFlight * self;
+                std::string const& key;
+                R result;
+
+                ~Finisher() { self->Finish(key, result); }
+            } finisher{this, key, R()};
+
+            finisher.result = fn();
+            if (shared) *shared = false;
+            return finisher.result;
+        }
+
+    private:
+        void Finish(std::string const& key, R const& result)
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            auto it = calls_.find(key);
+            Waiters waiters;
+            waiters.swap(it->second);
+            calls_.erase(it);
+            lock.unlock();
+
+            for (auto &waiter : waiters)
+                waiter.TryPush(result);
+        }
+
+        typedef std::vector<co_chan<R>> Waiters;
+
+        co_mutex mtx_;
+        std::unordered_map<std::string, Waiters> calls_;
+    };
+
+} //namespace ucorf
@@ -0,0 +1,224 @@
+#include "stats.h"
+#include <cmath>
+#include <cstdio>
+
+namespace ucorf
+{
+    uint64_t MethodStats::Snapshot::Percentile(double p) const
+    {
+        uint64_t total = 0;
+        for (auto count : buckets)
+            total += count;
+        if (!total) return 0;
+
+        uint64_t rank = (uint64_t)std::ceil(total * p / 100);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return BucketUpperBound(i);
+        }
+        return BucketUpperBound(buckets.size() - 1);
+    }
+
+    uint64_t MethodStats::Snapshot::AvgLatencyUs() const
+    {
+        return calls ? latency_sum_us / calls : 0;
+    }
+
+    double MethodStats::Snapshot::Qps(Snapshot const& prev) const
+    {
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                time - prev.time).count();
+        if (seconds <= 0) return 0;
+        return (calls - prev.calls) / seconds;
+    }
+
+    std::string MethodStats::Snapshot::ToString() const
+    {
+        char buf[512];
+        snprintf(buf, sizeof(buf), "%s.%s calls=%llu errors=%llu wnd_full=%llu overload=%llu "
+                "inflight=%lld avg=%lluus p50=%lluus p99=%lluus p999=%lluus in=%llu out=%llu",
+                service.c_str(), method.c_str(),
+                (unsigned long long)calls, (unsigned long long)errors,
+                (unsigned long long)error_by_code[(int)eUcorfErrorCode::ec_req_wnd_full],
+                (unsigned long long)error_by_code[(int)eUcorfErrorCode::ec_overload],
+                (long long)inflight, (unsigned long long)AvgLatencyUs(),
+                (unsigned long long)Percentile(50), (unsigned long long)Percentile(99),
+                (unsigned long long)Percentile(99.9),
+                (unsigned long long)bytes_in, (unsigned long long)bytes_out);
+        return buf;
+    }
+
+    MethodStats::Shard::Shard()
+    {
+        for (auto &count : errors)
+            count = 0;
+        for (auto &count : buckets)
+            count = 0;
+    }
+
+    MethodStats::MethodStats(std::string const& service, std::string const& method)
+        : service_(service), method_(method), shards_(new Shard[e_shard_count])
+    {
+    }
+
+    MethodStats::Shard & MethodStats::LocalShard()
+    {
+        static std::atomic<std::size_t> s_next{0};
+        static thread_local std::size_t idx = s_next++ & (e_shard_count - 1);
+        return shards_[idx];
+    }
+
+    void MethodStats::Enter()
+    {
+        LocalShard().inflight.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MethodStats::Leave(clock_t::duration latency, eUcorfErrorCode code, Traffic const& traffic)
+    {
+        int idx = (int)code;
+        if (idx < 0 || idx >= e_error_count - 1) idx = e_error_count - 1;
+        Leave(latency, idx, traffic);
+    }
+
+    void MethodStats::Leave(clock_t::duration latency, boost_ec const& ec, Traffic const& traffic)
+    {
+        int idx = 0;
+        if (ec) {
+            idx = e_error_count - 1;
+            if (ec.category() == GetUcorfErrorCategory() && ec.value() > 0 && ec.value() < e_error_count - 1)
+                idx = ec.value();
+        }
+        Leave(latency, idx, traffic);
+    }
+
+    void MethodStats::Leave(clock_t::duration latency, int error_idx, Traffic const& traffic)
+    {
+        const auto relaxed = std::memory_order_relaxed;
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        Shard & shard = LocalShard();
+        shard.inflight.fetch_sub(1, relaxed);
+        shard.calls.fetch_add(1, relaxed);
+        if (error_idx)
+            shard.errors[error_idx].fetch_add(1, relaxed);
+        if (traffic.in)
+            shard.bytes_in.fetch_add(traffic.in, relaxed);
+        if (traffic.out)
+            shard.bytes_out.fetch_add(traffic.out, relaxed);
+        shard.latency_sum_us.fetch_add(us, relaxed);
+        shard.buckets[BucketIndex(us)].fetch_add(1, relaxed);
+    }
+
+    MethodStats::Snapshot MethodStats::GetSnapshot() const
+    {
+        const auto relaxed = std::memory_order_relaxed;
+        Snapshot snap;
+        snap.service = service_;
+        snap.method = method_;
+        snap.time = clock_t::now();
+        snap.buckets.resize(e_bucket_count);
+        for (int i = 0; i < e_shard_count; ++i) {
+            Shard const& shard = shards_[i];
+            snap.calls += shard.calls.load(relaxed);
+            for (int j = 1; j < e_error_count; ++j) {
+                uint64_t count = shard.errors[j].load(relaxed);
+                snap.error_by_code[j] += count;
+                snap.errors += count;
+            }
+            snap.bytes_in += shard.bytes_in.load(relaxed);
+            snap.bytes_out += shard.bytes_out.load(relaxed);
+            snap.inflight += shard.inflight.load(relaxed);
+            snap.latency_sum_us += shard.latency_sum_us.load(relaxed);
+            for (int j = 0; j < e_bucket_count; ++j)
+                snap.buckets[j] += shard.buckets[j].load(relaxed);
+        }
+        return snap;
+    }
+
+    std::size_t MethodStats::BucketIndex(uint64_t us)
+    {
+        const uint64_t max_value = ((uint64_t)1 << e_max_value_bits) - 1;
+        if (us > max_value) us = max_value;
+        if (us < 2 * e_sub_bucket_count) return (std::size_t)us;
+
+        int msb = 63 - __builtin_clzll(us);
+        int shift = msb - e_sub_bucket_bits;
+        return (shift + 1) * e_sub_bucket_count + ((us >> shift) - e_sub_bucket_count);
+    }
+
+    uint64_t MethodStats::BucketUpperBound(std::size_t idx)
+    {
+        if (idx < 2 * e_sub_bucket_count) return idx;
+
+        int shift = (int)(idx / e_sub_bucket_count) - 1;
+        uint64_t sub = idx % e_sub_bucket_count;
+        return ((e_sub_bucket_count + sub + 1) << shift) - 1;
+    }
+
+    StatsRegistry::StatsRegistry()
+        : stats_(new StatsMap)
+    {
+        static std::atomic<uint64_t> s_next_id{1};
+        id_ = s_next_id++;
+    }
+
+    boost::shared_ptr<MethodStats> StatsRegistry::Get(std::string const& service, std::string const& method)
+    {
+        Key key(service, method);
+        boost::shared_ptr<const StatsMap> stats = boost::atomic_load(&stats_);
+        auto it = stats->find(key);
+        if (stats->end() != it) return it->second;
+
+        std::unique_lock<co_mutex> lock(mtx_);
+        stats = boost::atomic_load(&stats_);
+        it = stats->find(key);
+        if (stats->end() != it) return it->second;
+
+        boost::shared_ptr<StatsMap> new_stats(new StatsMap(*stats));
+        boost::shared_ptr<MethodStats> entry(new MethodStats(service, method));
+        new_stats->insert(std::make_pair(key, entry));
+        boost::shared_ptr<const StatsMap> const_stats(new_stats);
+        boost::atomic_store(&stats_, const_stats);
+        return entry;
+    }
+
+    MethodStats* StatsRegistry::Lookup(std::string const& service, std::string const& method)
+    {
+        // 直接映射的线程缓存, 冲突时覆盖.
+        struct CacheSlot
+        {
+            uint64_t registry_id = 0;
+            std::string service;
+            std::string method;
+            MethodStats* stats = nullptr;
+        };
+        enum { e_cache_slots = 64 };
+        static thread_local CacheSlot slots[e_cache_slots];
+
+        std::hash<std::string> hasher;
+        std::size_t h = hasher(service) * 31 + hasher(method);
+        CacheSlot & slot = slots[h & (e_cache_slots - 1)];
+        if (slot.registry_id == id_ && slot.method == method && slot.service == service)
+            return slot.stats;
+
+        boost::shared_ptr<MethodStats> entry = Get(service, method);
+        slot.registry_id = id_;
+        slot.service = service;
+        slot.method = method;
+        slot.stats = entry.get();
+        return slot.stats;
+    }
+
+    std::vector<MethodStats::Snapshot> StatsRegistry::GetSnapshot()
+    {
+        boost::shared_ptr<const StatsMap> stats = boost::atomic_load(&stats_);
+        std::vector<MethodStats::Snapshot> result;
+        result.reserve(stats->size());
+        for (auto &kv : *stats)
+            result.push_back(kv.second->GetSnapshot());
+        return result;
+    }
+
+} //namespace ucorf
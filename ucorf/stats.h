@@ -0,0 +1,127 @@
+#pragma once
+
+#include "preheader.h"
+#include "error.h"
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace ucorf
+{
+    // 单个方法的调用统计: 调用数, 按错误码分类的错误数, 收发字节数,
+    // 处理中的请求数和耗时分布.
+    // 计数分散在多个分片上, 每个线程固定写一个分片, 只做relaxed原子加;
+    // 读取时再汇总所有分片, 因此记录的开销很小, 可以常开.
+    class MethodStats : public boost::noncopyable
+    {
+    public:
+        typedef std::chrono::steady_clock clock_t;
+
+        // 耗时按对数-线性分桶(同HdrHistogram), 单位微秒:
+        // 小于16us时每1us一个桶, 之后每个2的幂区间等分为8个桶, 相对误差不超过12.5%.
+        enum { e_sub_bucket_bits = 3 };
+        enum { e_sub_bucket_count = 1 << e_sub_bucket_bits };
+        enum { e_max_value_bits = 32 };     // 最大约71分钟, 更长的计入最后一个桶
+        enum { e_bucket_count = (e_max_value_bits - e_sub_bucket_bits + 1) * e_sub_bucket_count };
+
+        // 错误码ec_ok~ec_overload各占一项, 最后一项为非ucorf的错误(如系统错误).
+        enum { e_error_count = (int)eUcorfErrorCode::ec_overload + 2 };
+
+        // 一次调用的收发字节数
+        struct Traffic
+        {
+            std::size_t in = 0;
+            std::size_t out = 0;
+        };
+
+        struct Snapshot
+        {
+            std::string service;
+            std::string method;
+            clock_t::time_point time;
+            uint64_t calls = 0;
+            uint64_t errors = 0;
+            uint64_t error_by_code[e_error_count] = {};
+            uint64_t bytes_in = 0;
+            uint64_t bytes_out = 0;
+            int64_t inflight = 0;
+            uint64_t latency_sum_us = 0;
+            std::vector<uint64_t> buckets;
+
+            // @p: 百分位, 0~100. 返回所在桶的上界(us).
+            uint64_t Percentile(double p) const;
+
+            uint64_t AvgLatencyUs() const;
+
+            // 与较早的快照prev相比的每秒调用数
+            double Qps(Snapshot const& prev) const;
+
+            std::string ToString() const;
+        };
+
+        MethodStats(std::string const& service, std::string const& method);
+
+        // 请求开始处理
+        void Enter();
+
+        // 请求处理完毕
+        void Leave(clock_t::duration latency, eUcorfErrorCode code, Traffic const& traffic);
+        void Leave(clock_t::duration latency, boost_ec const& ec, Traffic const& traffic);
+
+        Snapshot GetSnapshot() const;
+
+        static std::size_t BucketIndex(uint64_t us);
+        static uint64_t BucketUpperBound(std::size_t idx);
+
+    private:
+        // 必须为2的幂. 每个分片约2KB, 一个方法共约16KB.
+        enum { e_shard_count = 0x8 };
+
+        struct Shard
+        {
+            std::atomic<uint64_t> calls{0};
+            std::atomic<uint64_t> errors[e_error_count];
+            std::atomic<uint64_t> bytes_in{0};
+            std::atomic<uint64_t> bytes_out{0};
+            std::atomic<int64_t> inflight{0};
+            std::atomic<uint64_t> latency_sum_us{0};
+            std::atomic<uint64_t> buckets[e_bucket_count];
+            char pad[64];       // 避免与相邻分片伪共享
+
+            Shard();
+        };
+
+        void Leave(clock_t::duration latency, int error_idx, Traffic const& traffic);
+
+        Shard & LocalShard();
+
+    private:
+        std::string service_;
+        std::string method_;
+        std::unique_ptr<Shard[]> shards_;
+    };
+
+    // 按(服务名, 方法名)索引的统计集合, 写时复制, 查找不加锁.
+    class StatsRegistry : public boost::noncopyable
+    {
+    public:
+        StatsRegistry();
+
+        // 不存在时创建
+        boost::shared_ptr<MethodStats> Get(std::string const& service, std::string const& method);
+
+        // 同Get, 但先查每个线程的缓存, 命中时不加锁也不分配内存, 适合每次调用都查找的场景.
+        // 统计项不会被删除, 返回的指针在StatsRegistry析构前一直有效.
+        MethodStats* Lookup(std::string const& service, std::string const& method);
+
+        std::vector<MethodStats::Snapshot> GetSnapshot();
+
+    private:
+        typedef std::pair<std::string, std::string> Key;
+        typedef std::map<Key, boost::shared_ptr<MethodStats>> StatsMap;
+
+        co_mutex mtx_;
+        boost::shared_ptr<const StatsMap> stats_;
+        uint64_t id_;       // 区分线程缓存中不同实例的项
+    };
+
+} //namespace ucorf
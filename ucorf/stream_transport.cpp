@@ -0,0 +1,603 @@
+#include "stream_transport.h"
+#include "logger.h"
+#include <libgonet/network.h>
+#include <boost/algorithm/string.hpp>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ucorf
+{
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    // session
+    StreamSession::StreamSession(int fd, StreamTransportOption const& opt)
+        : fd_(fd), opt_(opt)
+    {
+        if (opt_.sndtimeo_ms > 0) {
+            timeval tv;
+            tv.tv_sec = opt_.sndtimeo_ms / 1000;
+            tv.tv_usec = (opt_.sndtimeo_ms % 1000) * 1000;
+            ::setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+    }
+
+    StreamSession::~StreamSession()
+    {
+        ::close(fd_);
+    }
+
+    void StreamSession::Start(OnReceiveF const& on_receive, OnCloseF const& on_close)
+    {
+        StreamSessionPtr self = shared_from_this();
+        go [=]{ self->ReadLoop(on_receive, on_close); };
+    }
+
+    void StreamSession::ReadLoop(OnReceiveF on_receive, OnCloseF on_close)
+    {
+        std::vector<char> buf((std::min<std::size_t>)(64 * 1024, opt_.max_pack_size));
+        std::size_t len = 0;
+        boost_ec ec;
+        for (;;)
+        {
+            if (len == buf.size()) {
+                // 缓冲区中只剩一个不完整的包
+                if (len >= opt_.max_pack_size) {
+                    ucorf_log_warn("stream session(fd=%d) packet exceeds max_pack_size(%u)",
+                            fd_, (unsigned)opt_.max_pack_size);
+                    ec = MakeSysErrorCode(EMSGSIZE);
+                    break;
+                }
+                buf.resize((std::min<std::size_t>)(buf.size() * 2, opt_.max_pack_size));
+            }
+
+            ssize_t n = ::read(fd_, &buf[len], buf.size() - len);
+            if (n == 0) {
+                ec = MakeSysErrorCode(ECONNRESET);
+                break;
+            } else if (n < 0) {
+                if (errno == EINTR) continue;
+                ec = MakeSysErrorCode(errno);
+                break;
+            }
+
+            len += n;
+            std::size_t consume = on_receive(&buf[0], len);
+            if (consume == (std::size_t)-1) {
+                ec = MakeSysErrorCode(EBADMSG);
+                break;
+            }
+
+            if (consume) {
+                if (consume < len)
+                    memmove(&buf[0], &buf[consume], len - consume);
+                len -= consume;
+            }
+        }
+
+        closed_ = true;
+        ::shutdown(fd_, SHUT_RDWR);
+        on_close(ec);
+    }
+
+    void StreamSession::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        if (closed_) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        std::unique_lock<co_mutex> lock(mtx_);
+        if (queued_bytes_ + buf.size() > opt_.max_send_queue_bytes) {
+            // 对端长时间不读, 不再继续堆积
+            lock.unlock();
+            ucorf_log_warn("stream session(fd=%d) send queue exceeds max_send_queue_bytes(%llu), drop %u bytes",
+                    fd_, (unsigned long long)opt_.max_send_queue_bytes, (unsigned)buf.size());
+            if (cb) cb(MakeSysErrorCode(ENOBUFS));
+            return ;
+        }
+
+        queued_bytes_ += buf.size();
+        send_queue_.push_back(Packet());
+        send_queue_.back().buf.swap(buf);
+        send_queue_.back().cb = cb;
+        if (writing_) return ;
+
+        writing_ = true;
+        lock.unlock();
+
+        StreamSessionPtr self = shared_from_this();
+        go [=]{ self->WriteLoop(); };
+    }
+
+    static boost_ec WriteAll(int fd, std::vector<iovec> & iov)
+    {
+        std::size_t idx = 0;
+        while (idx < iov.size())
+        {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov[idx];
+            msg.msg_iovlen = (std::min<std::size_t>)(iov.size() - idx, IOV_MAX);
+            ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return MakeSysErrorCode(errno);
+            }
+
+            while (n > 0) {
+                if ((std::size_t)n >= iov[idx].iov_len) {
+                    n -= iov[idx].iov_len;
+                    ++idx;
+                } else {
+                    iov[idx].iov_base = (char*)iov[idx].iov_base + n;
+                    iov[idx].iov_len -= n;
+                    n = 0;
+                }
+            }
+        }
+        return boost_ec();
+    }
+
+    void StreamSession::WriteLoop()
+    {
+        // 每次最多合并发送的包数
+        const std::size_t max_batch = 64;
+        std::vector<Packet> batch;
+        std::vector<iovec> iov;
+        for (;;)
+        {
+            batch.clear();
+            iov.clear();
+            {
+                std::unique_lock<co_mutex> lock(mtx_);
+                if (send_queue_.empty()) {
+                    writing_ = false;
+                    if (closing_)
+                        ::shutdown(fd_, SHUT_RDWR);
+                    return ;
+                }
+
+                while (!send_queue_.empty() && batch.size() < max_batch) {
+                    queued_bytes_ -= send_queue_.front().buf.size();
+                    batch.push_back(std::move(send_queue_.front()));
+                    send_queue_.pop_front();
+                }
+            }
+
+            for (auto &pkt : batch) {
+                if (pkt.buf.empty()) continue;
+                iovec v;
+                v.iov_base = &pkt.buf[0];
+                v.iov_len = pkt.buf.size();
+                iov.push_back(v);
+            }
+
+            boost_ec ec = closed_ ? MakeSysErrorCode(ENOTCONN) : WriteAll(fd_, iov);
+            if (ec && !closed_) {
+                ucorf_log_warn("stream session(fd=%d) write error: %s", fd_, ec.message().c_str());
+                closed_ = true;
+                ::shutdown(fd_, SHUT_RDWR);
+            }
+
+            for (auto &pkt : batch)
+                if (pkt.cb) pkt.cb(ec);
+        }
+    }
+
+    void StreamSession::Close(bool immediately)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        if (immediately || (!writing_ && send_queue_.empty())) {
+            lock.unlock();
+            ::shutdown(fd_, SHUT_RDWR);
+            return ;
+        }
+
+        closing_ = true;
+    }
+
+    bool ParseInetAddress(std::string const& host_port, sockaddr_storage & addr, socklen_t & addr_len)
+    {
+        std::size_t pos = host_port.find_last_of(':');
+        if (pos == std::string::npos) return false;
+
+        std::string host = host_port.substr(0, pos);
+        std::string port = host_port.substr(pos + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        addrinfo *result = nullptr;
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+            return false;
+
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, result->ai_addr, result->ai_addrlen);
+        addr_len = result->ai_addrlen;
+        ::freeaddrinfo(result);
+        return true;
+    }
+
+    std::string BoundInetUrl(std::string const& url, int fd)
+    {
+        std::size_t pos = url.find_last_of(':');
+        if (pos == std::string::npos || url.compare(pos + 1, std::string::npos, "0") != 0)
+            return url;
+
+        sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        if (::getsockname(fd, (sockaddr*)&addr, &addr_len) < 0) return url;
+
+        int port = (addr.ss_family == AF_INET6) ? ntohs(((sockaddr_in6*)&addr)->sin6_port)
+            : ntohs(((sockaddr_in*)&addr)->sin_port);
+        return url.substr(0, pos + 1) + std::to_string(port);
+    }
+
+    bool GetStreamTransportOption(boost::any const& any_opt, StreamTransportOption & opt)
+    {
+        if (const StreamTransportOption* stream_opt = boost::any_cast<StreamTransportOption>(&any_opt)) {
+            opt = *stream_opt;
+            return true;
+        }
+
+        if (const ::network::OptionsUser* net_opt = boost::any_cast<::network::OptionsUser>(&any_opt)) {
+            opt.max_pack_size = net_opt->max_pack_size_;
+            opt.sndtimeo_ms = net_opt->sndtimeo_;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool ParseStreamAddress(std::string const& url, sockaddr_storage & addr, socklen_t & addr_len)
+    {
+        static const std::string tcp_prefix = "tcp://";
+        if (boost::istarts_with(url, tcp_prefix))
+            return ParseInetAddress(url.substr(tcp_prefix.size()), addr, addr_len);
+
+        static const std::string unix_prefix = "unix://";
+        if (!boost::istarts_with(url, unix_prefix)) return false;
+
+        std::string path = url.substr(unix_prefix.size());
+        sockaddr_un *un = (sockaddr_un*)&addr;
+        memset(&addr, 0, sizeof(addr));
+        un->sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) return false;
+
+        if (path[0] == '@') {
+            // abstract namespace: sun_path[0]为'\0', 不在文件系统中创建文件
+            memcpy(un->sun_path + 1, path.data() + 1, path.size() - 1);
+            addr_len = offsetof(sockaddr_un, sun_path) + path.size();
+        } else {
+            memcpy(un->sun_path, path.c_str(), path.size() + 1);
+            addr_len = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+        }
+        return true;
+    }
+
+    // server
+    StreamTransportServer::StreamTransportServer()
+        : core_(boost::make_shared<Core>())
+    {
+        ucorf_log_debug("StreamTransportServer construct.");
+    }
+    StreamTransportServer::~StreamTransportServer()
+    {
+        ucorf_log_debug("StreamTransportServer destruct.");
+        Shutdown();
+    }
+
+    void StreamTransportServer::Shutdown()
+    {
+        int fd = core_->listen_fd.exchange(-1);
+        if (fd >= 0) {
+            ::shutdown(fd, SHUT_RDWR);
+            ::close(fd);
+            if (!unlink_path_.empty())
+                ::unlink(unlink_path_.c_str());
+        }
+
+        std::set<StreamSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            sessions = core_->sessions;
+        }
+        for (auto &sess : sessions)
+            sess->Close(true);
+    }
+    void StreamTransportServer::SetReceiveCb(OnReceiveF const& cb)
+    {
+        core_->on_receive = cb;
+    }
+    void StreamTransportServer::SetConnectedCb(OnConnectedF const& cb)
+    {
+        core_->on_connect = cb;
+    }
+    void StreamTransportServer::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        core_->on_disconnect = cb;
+    }
+    void StreamTransportServer::SetOption(boost::any const& opt)
+    {
+        if (!GetStreamTransportOption(opt, core_->opt) && !opt.empty())
+            WarnUnknownOption("StreamTransportServer", opt);
+    }
+
+    // 删除上次运行残留的unix socket文件. 如果还有进程在监听(能连上)则不删除, 返回EADDRINUSE.
+    static boost_ec RemoveStaleSocket(sockaddr_un const& un, socklen_t addr_len)
+    {
+        struct stat st;
+        if (::stat(un.sun_path, &st) < 0)
+            return boost_ec();      // 不存在, 由bind报告其他错误
+        if (!S_ISSOCK(st.st_mode))
+            return MakeSysErrorCode(EADDRINUSE);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+        int res = ::connect(fd, (sockaddr const*)&un, addr_len);
+        int err = errno;
+        ::close(fd);
+        if (res == 0)
+            return MakeSysErrorCode(EADDRINUSE);
+        if (err != ECONNREFUSED)
+            return boost_ec();      // 无法判断, 交给bind报告错误
+
+        ::unlink(un.sun_path);
+        return boost_ec();
+    }
+
+    boost_ec StreamTransportServer::Listen(std::string const& url)
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseStreamAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        if (addr.ss_family == AF_UNIX) {
+            sockaddr_un *un = (sockaddr_un*)&addr;
+            if (un->sun_path[0] != '\0') {
+                boost_ec ec = RemoveStaleSocket(*un, addr_len);
+                if (ec) {
+                    ucorf_log_error("listen on %s: %s", url.c_str(), ec.message().c_str());
+                    ::close(fd);
+                    return ec;
+                }
+            }
+        } else {
+            int on = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (reuse_port_ && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+                boost_ec ec = MakeSysErrorCode(errno);
+                ::close(fd);
+                return ec;
+            }
+        }
+
+        if (::bind(fd, (sockaddr*)&addr, addr_len) < 0 || ::listen(fd, 1024) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        // bind成功后socket文件归本server所有, 退出时删除
+        if (addr.ss_family == AF_UNIX && ((sockaddr_un*)&addr)->sun_path[0] != '\0')
+            unlink_path_ = ((sockaddr_un*)&addr)->sun_path;
+
+        core_->url = (addr.ss_family == AF_UNIX) ? url : BoundInetUrl(url, fd);
+        core_->listen_fd = fd;
+        CorePtr core = core_;
+        go [=]{ AcceptLoop(core, fd); };
+        return boost_ec();
+    }
+
+    void StreamTransportServer::AcceptLoop(CorePtr core, int listen_fd)
+    {
+        while (core->listen_fd == listen_fd)
+        {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                if (core->listen_fd != listen_fd) break;
+
+                ucorf_log_error("accept on %s error: %s", core->url.c_str(), strerror(errno));
+                co_sleep(10);
+                continue;
+            }
+
+            OnAccept(core, fd);
+        }
+    }
+
+    static void SetNoDelay(int fd)
+    {
+        sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        if (::getsockname(fd, (sockaddr*)&addr, &addr_len) < 0 || addr.ss_family == AF_UNIX)
+            return ;
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    void StreamTransportServer::OnAccept(CorePtr core, int fd)
+    {
+        SetNoDelay(fd);
+        StreamSessionPtr sess(new StreamSession(fd, core->opt));
+        {
+            std::unique_lock<co_mutex> lock(core->sessions_mtx);
+            core->sessions.insert(sess);
+        }
+
+        ucorf_log_debug("new connection");
+        if (core->on_connect)
+            core->on_connect(SessId(sess));
+
+        sess->Start([=](const char* data, size_t bytes) {
+                    return core->on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("connection disconnect: %s", ec.message().c_str());
+                    {
+                        std::unique_lock<co_mutex> lock(core->sessions_mtx);
+                        core->sessions.erase(sess);
+                    }
+                    if (core->on_disconnect)
+                        core->on_disconnect(SessId(sess), ec);
+                });
+    }
+
+    void StreamTransportServer::Send(SessId id, const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(id, std::move(buf), cb);
+    }
+    void StreamTransportServer::Send(SessId id, std::vector<char> && buf, OnSndF const& cb)
+    {
+        StreamSessionPtr &sess = ::boost::any_cast<StreamSessionPtr&>(id);
+        sess->Send(std::move(buf), cb);
+    }
+    std::string StreamTransportServer::LocalUrl() const
+    {
+        return core_->url;
+    }
+    void StreamTransportServer::ForEachSession(boost::function<void(SessId)> const& fn)
+    {
+        std::set<StreamSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            sessions = core_->sessions;
+        }
+
+        for (auto &sess : sessions)
+            fn(SessId(sess));
+    }
+    void StreamTransportServer::Close(SessId id)
+    {
+        StreamSessionPtr &sess = ::boost::any_cast<StreamSessionPtr&>(id);
+        sess->Close();
+    }
+
+    // client
+    StreamTransportClient::StreamTransportClient()
+    {
+        ucorf_log_debug("StreamTransportClient construct.");
+    }
+    StreamTransportClient::~StreamTransportClient()
+    {
+        ucorf_log_debug("StreamTransportClient destruct.");
+        Shutdown();
+    }
+
+    void StreamTransportClient::Shutdown()
+    {
+        StreamSessionPtr sess = GetSession();
+        if (sess)
+            sess->Close(true);
+    }
+    void StreamTransportClient::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void StreamTransportClient::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void StreamTransportClient::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+    void StreamTransportClient::SetOption(boost::any const& opt)
+    {
+        if (!GetStreamTransportOption(opt, opt_) && !opt.empty())
+            WarnUnknownOption("StreamTransportClient", opt);
+    }
+
+    boost_ec StreamTransportClient::Connect(std::string const& url)
+    {
+        url_ = url;
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseStreamAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        if (::connect(fd, (sockaddr*)&addr, addr_len) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        SetNoDelay(fd);
+        StreamSessionPtr sess(new StreamSession(fd, opt_));
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            sess_ = sess;
+        }
+
+        ucorf_log_debug("connect sucess");
+        if (on_connect_)
+            on_connect_(SessId(sess));
+
+        // 连接可能比client活得更久, 回调按值持有
+        OnReceiveF on_receive = on_receive_;
+        OnDisconnectedF on_disconnect = on_disconnect_;
+        sess->Start([=](const char* data, size_t bytes) {
+                    return on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("disconnect because: %s", ec.message().c_str());
+                    if (on_disconnect)
+                        on_disconnect(SessId(sess), ec);
+                });
+        return boost_ec();
+    }
+    void StreamTransportClient::Send(const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(std::move(buf), cb);
+    }
+    void StreamTransportClient::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        StreamSessionPtr sess = GetSession();
+        if (!sess) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        sess->Send(std::move(buf), cb);
+    }
+    bool StreamTransportClient::IsEstab()
+    {
+        StreamSessionPtr sess = GetSession();
+        return sess && sess->IsEstab();
+    }
+    std::string StreamTransportClient::RemoteUrl() const
+    {
+        return url_;
+    }
+
+    StreamSessionPtr StreamTransportClient::GetSession()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return sess_;
+    }
+
+} //namespace ucorf
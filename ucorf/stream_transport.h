@@ -0,0 +1,164 @@
+#pragma once
+
+#include "preheader.h"
+#include "transport.h"
+#include <deque>
+#include <set>
+#include <boost/enable_shared_from_this.hpp>
+#include <sys/socket.h>
+
+namespace ucorf
+{
+    // 通过ITransport::SetOption设置, 也接受libgonet的::network::OptionsUser(max_pack_size_, sndtimeo_).
+    struct StreamTransportOption
+    {
+        // 单个包的上限, 接收缓冲区中不完整的包超过此大小时断开连接.
+        std::size_t max_pack_size = 64 * 1024;
+
+        // 发送超时(毫秒), 0表示不超时. 超时后断开连接.
+        int sndtimeo_ms = 0;
+
+        // 每个连接发送队列中排队的字节数上限, 超过后新的数据直接丢弃(回调ENOBUFS), -1表示不限制.
+        std::size_t max_send_queue_bytes = 64 * 1024 * 1024;
+    };
+
+    // 基于fd的流式连接, 读写使用被libgo hook的阻塞系统调用, 在协程中会自动切换.
+    // 每个连接一个接收协程; 发送时排队, 由发送协程用writev批量写出.
+    class StreamSession : public boost::enable_shared_from_this<StreamSession>
+    {
+    public:
+        typedef ITransport::OnSndF OnSndF;
+        typedef boost::function<size_t(const char*, size_t)> OnReceiveF;
+        typedef boost::function<void(boost_ec const&)> OnCloseF;
+
+        StreamSession(int fd, StreamTransportOption const& opt);
+        ~StreamSession();
+
+        // 启动接收协程. @on_close: 连接断开时调用一次.
+        void Start(OnReceiveF const& on_receive, OnCloseF const& on_close);
+
+        void Send(std::vector<char> && buf, OnSndF const& cb);
+
+        // 已排队的数据发送完毕后关闭连接. @immediately: 立即关闭, 丢弃未发送的数据.
+        void Close(bool immediately = false);
+
+        bool IsEstab() const { return !closed_; }
+
+        int fd() const { return fd_; }
+
+    private:
+        struct Packet
+        {
+            std::vector<char> buf;
+            OnSndF cb;
+        };
+
+        void ReadLoop(OnReceiveF on_receive, OnCloseF on_close);
+        void WriteLoop();
+
+    private:
+        int fd_;
+        StreamTransportOption opt_;
+        std::atomic<bool> closed_{false};
+        co_mutex mtx_;
+        std::deque<Packet> send_queue_;
+        std::size_t queued_bytes_ = 0;
+        bool writing_ = false;
+        bool closing_ = false;
+    };
+    typedef boost::shared_ptr<StreamSession> StreamSessionPtr;
+
+    // 解析流式socket的地址, 目前支持:
+    //   unix:///path/to/socket
+    //   unix://@name          (abstract namespace)
+    //   tcp://ip:port         (ipv6地址需要用[]括起来)
+    bool ParseStreamAddress(std::string const& url, sockaddr_storage & addr, socklen_t & addr_len);
+
+    // 解析ip:port, ipv6地址需要用[]括起来
+    bool ParseInetAddress(std::string const& host_port, sockaddr_storage & addr, socklen_t & addr_len);
+
+    // 从ITransport::SetOption的参数中取出StreamTransportOption. @returns: 参数类型不支持时返回false.
+    bool GetStreamTransportOption(boost::any const& any_opt, StreamTransportOption & opt);
+
+    // 监听的url, 端口为0(由系统分配)时换成实际绑定的端口, 主机部分保持用户配置的写法.
+    std::string BoundInetUrl(std::string const& url, int fd);
+
+    class StreamTransportServer : public ITransportServer
+    {
+    public:
+        StreamTransportServer();
+        ~StreamTransportServer();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Listen(std::string const& url);
+        virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
+
+        // tcp监听socket开启SO_REUSEPORT, 多个server可以监听同一端口, 由内核均衡新连接. 需在Listen前设置.
+        void SetReusePort(bool on) { reuse_port_ = on; }
+
+    private:
+        // 选项, 回调和连接表. accept协程和连接的回调持有它而不是server,
+        // 连接可以比server活得更久.
+        struct Core
+        {
+            std::string url;
+            StreamTransportOption opt;
+            std::atomic<int> listen_fd{-1};
+            OnReceiveF on_receive;
+            OnConnectedF on_connect;
+            OnDisconnectedF on_disconnect;
+            co_mutex sessions_mtx;
+            std::set<StreamSessionPtr> sessions;
+        };
+        typedef boost::shared_ptr<Core> CorePtr;
+
+        static void AcceptLoop(CorePtr core, int listen_fd);
+        static void OnAccept(CorePtr core, int fd);
+
+    private:
+        CorePtr core_;
+        std::string unlink_path_;   // 退出时删除的socket文件
+        bool reuse_port_ = false;
+    };
+
+    class StreamTransportClient : public ITransportClient
+    {
+    public:
+        StreamTransportClient();
+        ~StreamTransportClient();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Connect(std::string const& url);
+        virtual void Send(const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual bool IsEstab();
+        virtual std::string RemoteUrl() const;
+
+    private:
+        StreamSessionPtr GetSession();
+
+    private:
+        std::string url_;
+        StreamTransportOption opt_;
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        co_mutex mtx_;
+        StreamSessionPtr sess_;
+    };
+
+} //namespace ucorf
@@ -0,0 +1,275 @@
+#include "tracer.h"
+#include "logger.h"
+#include <random>
+#include <cstdio>
+#include <string.h>
+
+namespace ucorf
+{
+    TraceContext Span::Context() const
+    {
+        TraceContext ctx;
+        ctx.trace_id = trace_id;
+        ctx.span_id = span_id;
+        return ctx;
+    }
+
+    // 单生产者(所属线程)单消费者(导出线程)的环形缓冲区
+    struct Tracer::Ring
+    {
+        // 必须为2的幂
+        enum { e_capacity = 1024 };
+
+        std::atomic<uint64_t> head{0};      // 生产者写入位置
+        char pad1[64];
+        std::atomic<uint64_t> tail{0};      // 消费者读取位置
+        char pad2[64];
+        Span spans[e_capacity];
+
+        bool Push(Span const& span)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) >= e_capacity)
+                return false;
+
+            spans[h & (e_capacity - 1)] = span;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    static uint64_t RandomU64()
+    {
+        static thread_local uint64_t s = 0;
+        if (!s) {
+            std::random_device rd;
+            s = ((uint64_t)rd() << 32) ^ rd() ^
+                (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+            if (!s) s = 0x9e3779b97f4a7c15ULL;
+        }
+
+        // xorshift64*
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545f4914f6cdd1dULL;
+    }
+
+    static uint64_t NewId()
+    {
+        uint64_t id;
+        do {
+            id = RandomU64();
+        } while (!id);
+        return id;
+    }
+
+    static void CopyName(char* dst, std::size_t size, std::string const& src)
+    {
+        std::size_t len = (std::min)(size - 1, src.size());
+        memcpy(dst, src.data(), len);
+        dst[len] = '\0';
+    }
+
+    Tracer& Tracer::getInstance()
+    {
+        static Tracer obj;
+        return obj;
+    }
+
+    Tracer::Tracer()
+    {
+    }
+
+    Tracer::~Tracer()
+    {
+        Stop();
+    }
+
+    bool Tracer::Start(std::string const& file, int flush_interval_ms)
+    {
+        Stop();
+
+        std::unique_lock<std::mutex> lock(export_mtx_);
+        fp_ = fopen(file.c_str(), "a");
+        if (!fp_) {
+            ucorf_log_error("open trace file %s error: %s", file.c_str(), strerror(errno));
+            return false;
+        }
+
+        exporting_ = true;
+        exporter_ = std::thread([=]{ this->ExportLoop(flush_interval_ms); });
+        enabled_ = true;
+        return true;
+    }
+
+    void Tracer::Stop()
+    {
+        enabled_ = false;
+
+        std::unique_lock<std::mutex> lock(export_mtx_);
+        if (!fp_) return ;
+
+        exporting_ = false;
+        if (exporter_.joinable())
+            exporter_.join();
+        Export(fp_);
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+
+    bool Tracer::Sample(double rate)
+    {
+        if (rate <= 0) return false;
+        if (rate >= 1) return true;
+        return RandomU64() < (uint64_t)(rate * 18446744073709551616.0);
+    }
+
+    void Tracer::BeginSpan(Span & span, eSpanKind kind, TraceContext const& parent,
+            std::string const& service, std::string const& method)
+    {
+        span.trace_id = parent ? parent.trace_id : NewId();
+        span.parent_id = parent ? parent.span_id : 0;
+        span.span_id = NewId();
+        span.kind = kind;
+        span.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        span.begin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        CopyName(span.service, sizeof(span.service), service);
+        CopyName(span.method, sizeof(span.method), method);
+    }
+
+    void Tracer::EndSpan(Span const& span, int error)
+    {
+        if (!span || !IsEnabled()) return ;
+
+        Span done = span;
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        done.duration_us = (now_ns - span.begin_ns) / 1000;
+        done.error = error;
+        if (!LocalRing().Push(done))
+            ++dropped_;
+    }
+
+    Tracer::Ring & Tracer::LocalRing()
+    {
+        static thread_local Ring* ring = nullptr;
+        if (!ring) {
+            boost::shared_ptr<Ring> new_ring(new Ring);
+            std::unique_lock<std::mutex> lock(rings_mtx_);
+            rings_.push_back(new_ring);
+            ring = new_ring.get();
+        }
+        return *ring;
+    }
+
+    TraceContext Tracer::Current()
+    {
+        if (active_scopes_.load(std::memory_order_relaxed) <= 0)
+            return TraceContext();
+
+        uint64_t task_id = co_sched.GetCurrentTaskID();
+        if (!task_id) return TraceContext();
+
+        ContextShard & shard = context_shards_[task_id & (e_context_shard_count - 1)];
+        std::unique_lock<co_mutex> lock(shard.mtx);
+        auto it = shard.contexts.find(task_id);
+        if (shard.contexts.end() == it) return TraceContext();
+        return it->second;
+    }
+
+    void Tracer::SetContext(uint64_t task_id, TraceContext const& ctx)
+    {
+        ContextShard & shard = context_shards_[task_id & (e_context_shard_count - 1)];
+        std::unique_lock<co_mutex> lock(shard.mtx);
+        if (ctx)
+            shard.contexts[task_id] = ctx;
+        else
+            shard.contexts.erase(task_id);
+    }
+
+    Tracer::Scope::Scope(TraceContext const& ctx)
+    {
+        if (!ctx) return ;
+
+        task_id_ = co_sched.GetCurrentTaskID();
+        if (!task_id_) return ;
+
+        Tracer & tracer = Tracer::getInstance();
+        prev_ = tracer.Current();
+        ++tracer.active_scopes_;
+        tracer.SetContext(task_id_, ctx);
+    }
+
+    Tracer::Scope::~Scope()
+    {
+        if (!task_id_) return ;
+
+        Tracer & tracer = Tracer::getInstance();
+        tracer.SetContext(task_id_, prev_);
+        --tracer.active_scopes_;
+    }
+
+    void Tracer::ExportLoop(int flush_interval_ms)
+    {
+        while (exporting_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(flush_interval_ms));
+            Export(fp_);
+        }
+    }
+
+    // 输出json字符串值, 转义引号、反斜杠和控制字符
+    static void WriteJsonString(FILE* fp, const char* str)
+    {
+        fputc('"', fp);
+        for (; *str; ++str) {
+            unsigned char c = *str;
+            switch (c) {
+                case '"': fputs("\\\"", fp); break;
+                case '\\': fputs("\\\\", fp); break;
+                case '\n': fputs("\\n", fp); break;
+                case '\r': fputs("\\r", fp); break;
+                case '\t': fputs("\\t", fp); break;
+                default:
+                    if (c < 0x20)
+                        fprintf(fp, "\\u%04x", c);
+                    else
+                        fputc(c, fp);
+            }
+        }
+        fputc('"', fp);
+    }
+
+    void Tracer::Export(FILE* fp)
+    {
+        std::vector<boost::shared_ptr<Ring>> rings;
+        {
+            std::unique_lock<std::mutex> lock(rings_mtx_);
+            rings = rings_;
+        }
+
+        for (auto &ring : rings) {
+            uint64_t t = ring->tail.load(std::memory_order_relaxed);
+            uint64_t h = ring->head.load(std::memory_order_acquire);
+            for (; t < h; ++t) {
+                Span const& span = ring->spans[t & (Ring::e_capacity - 1)];
+                // service和method来自请求, 需要转义
+                fprintf(fp, "{\"trace_id\":\"%016llx\",\"span_id\":\"%016llx\",\"parent_id\":\"%016llx\","
+                        "\"kind\":\"%s\",\"service\":",
+                        (unsigned long long)span.trace_id, (unsigned long long)span.span_id,
+                        (unsigned long long)span.parent_id,
+                        span.kind == eSpanKind::client ? "client" : "server");
+                WriteJsonString(fp, span.service);
+                fputs(",\"method\":", fp);
+                WriteJsonString(fp, span.method);
+                fprintf(fp, ",\"start_us\":%lld,\"duration_us\":%lld,\"error\":%d}\n",
+                        (long long)span.start_us, (long long)span.duration_us, (int)span.error);
+            }
+            ring->tail.store(h, std::memory_order_release);
+        }
+        fflush(fp);
+    }
+
+} //namespace ucorf
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "preheader.h"
+#include "message.h"
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <boost/noncopyable.hpp>
+
+namespace ucorf
+{
+    enum class eSpanKind : uint8_t
+    {
+        client,
+        server,
+    };
+
+    // 一次调用的跟踪记录, 定长以便直接放入环形缓冲区.
+    struct Span
+    {
+        uint64_t trace_id = 0;      // 0表示未采样
+        uint64_t span_id = 0;
+        uint64_t parent_id = 0;
+        int64_t start_us = 0;       // unix时间戳
+        int64_t duration_us = 0;
+        int64_t begin_ns = 0;       // steady_clock, 用于计算耗时
+        int32_t error = 0;
+        eSpanKind kind = eSpanKind::client;
+        char service[32] = {};
+        char method[32] = {};
+
+        explicit operator bool() const { return trace_id != 0; }
+
+        TraceContext Context() const;
+    };
+
+    // 调用链跟踪.
+    // client端按采样率发起跟踪, trace_id和span_id通过header的扩展字段传给server,
+    // server端处理请求期间发起的调用自动成为子span.
+    // span写入当前线程的单生产者单消费者环形缓冲区, 由后台线程批量导出为json lines.
+    // 未开启或未采样的请求只有几次原子读的开销.
+    class Tracer : public boost::noncopyable
+    {
+    public:
+        static Tracer& getInstance();
+
+        // 开始把span导出到文件(追加写). 开启后client端才会按Option::trace_sample_rate采样.
+        bool Start(std::string const& file, int flush_interval_ms = 100);
+        void Stop();
+
+        bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+        // 按采样率决定是否开始一个新的调用链, @rate: 0~1
+        static bool Sample(double rate);
+
+        // @parent: 为空时开始一个新的调用链.
+        void BeginSpan(Span & span, eSpanKind kind, TraceContext const& parent,
+                std::string const& service, std::string const& method);
+
+        // @error: 错误码, 0表示成功.
+        void EndSpan(Span const& span, int error);
+
+        // 当前协程的跟踪上下文, 在其中发起的调用作为它的子span.
+        TraceContext Current();
+
+        // 在当前协程中设置跟踪上下文, 析构时还原. ctx为空时不做任何事.
+        class Scope : public boost::noncopyable
+        {
+        public:
+            explicit Scope(TraceContext const& ctx);
+            ~Scope();
+
+        private:
+            uint64_t task_id_ = 0;
+            TraceContext prev_;
+        };
+
+        // 缓冲区满时丢弃的span数
+        uint64_t Dropped() const { return dropped_; }
+
+    private:
+        Tracer();
+        ~Tracer();
+
+        struct Ring;
+        Ring & LocalRing();
+
+        void ExportLoop(int flush_interval_ms);
+        void Export(FILE* fp);
+
+        // 当前协程的上下文, 按协程id分片.
+        // 必须为2的幂
+        enum { e_context_shard_count = 0x10 };
+        struct ContextShard
+        {
+            co_mutex mtx;
+            std::unordered_map<uint64_t, TraceContext> contexts;
+        };
+        void SetContext(uint64_t task_id, TraceContext const& ctx);
+
+    private:
+        std::atomic<bool> enabled_{false};
+        std::atomic<long> active_scopes_{0};
+        std::atomic<uint64_t> dropped_{0};
+        ContextShard context_shards_[e_context_shard_count];
+
+        std::mutex rings_mtx_;
+        std::vector<boost::shared_ptr<Ring>> rings_;
+
+        std::mutex export_mtx_;
+        FILE* fp_ = nullptr;
+        std::atomic<bool> exporting_{false};
+        std::thread exporter_;
+    };
+
+} //namespace ucorf
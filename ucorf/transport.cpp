@@ -0,0 +1,64 @@
+#include "transport.h"
+#include "net_transport.h"
+#include "stream_transport.h"
+#include "shm_transport.h"
+#include "inproc_transport.h"
+#include "datagram_transport.h"
+#include "logger.h"
+#include <boost/algorithm/string.hpp>
+
+namespace ucorf
+{
+    static bool IsStreamUrl(std::string const& url)
+    {
+        return boost::istarts_with(url, "unix://");
+    }
+
+    static bool IsShmUrl(std::string const& url)
+    {
+        return boost::istarts_with(url, "shm://");
+    }
+
+    static bool IsInprocUrl(std::string const& url)
+    {
+        return boost::istarts_with(url, "inproc://");
+    }
+
+    static bool IsDatagramUrl(std::string const& url)
+    {
+        return boost::istarts_with(url, "udp://");
+    }
+
+    ITransportServer* CreateTransportServer(std::string const& url)
+    {
+        if (IsStreamUrl(url))
+            return new StreamTransportServer;
+        if (IsShmUrl(url))
+            return new ShmTransportServer;
+        if (IsInprocUrl(url))
+            return new InprocTransportServer;
+        if (IsDatagramUrl(url))
+            return new DatagramTransportServer;
+        return new NetTransportServer;
+    }
+
+    ITransportClient* CreateTransportClient(std::string const& url)
+    {
+        if (IsStreamUrl(url))
+            return new StreamTransportClient;
+        if (IsShmUrl(url))
+            return new ShmTransportClient;
+        if (IsInprocUrl(url))
+            return new InprocTransportClient;
+        if (IsDatagramUrl(url))
+            return new DatagramTransportClient;
+        return new NetTransportClient;
+    }
+
+    void WarnUnknownOption(const char* transport, boost::any const& opt)
+    {
+        ucorf_log_warn("%s ignores transport option of unknown type %s",
+                transport, opt.type().name());
+    }
+
+} //namespace ucorf
@@ -30,6 +30,12 @@ namespace ucorf
         virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL) = 0;
         virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL) = 0;
         virtual std::string LocalUrl() const = 0;
+
+        // 遍历当前的所有连接, 平滑退出时使用. 默认不支持.
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn) {}
+
+        // 已排队的数据发送完毕后关闭连接.
+        virtual void Close(SessId id) {}
     };
 
     class ITransportClient : public ITransport
@@ -42,4 +48,12 @@ namespace ucorf
         virtual std::string RemoteUrl() const = 0;
     };
 
+    // 按url的协议创建transport: unix://使用StreamTransport, shm://使用ShmTransport,
+    // inproc://使用InprocTransport, udp://使用DatagramTransport, 其余交给libgonet.
+    ITransportServer* CreateTransportServer(std::string const& url);
+    ITransportClient* CreateTransportClient(std::string const& url);
+
+    // SetOption收到不认识的选项类型时调用, 记录警告后忽略该选项.
+    void WarnUnknownOption(const char* transport, boost::any const& opt);
+
 } //namespace ucorf
@@ -0,0 +1,344 @@
+#include "uring.h"
+#include "logger.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+namespace ucorf
+{
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    template <typename T>
+    static T* RingPtr(void* ring, unsigned offset)
+    {
+        return (T*)((char*)ring + offset);
+    }
+
+    // 当前线程是否为收割线程
+    static thread_local bool t_in_reaper = false;
+
+    IoUring::IoUring(UringOption const& opt)
+        : opt_(opt)
+    {
+        if (!Setup() || !SetupBuffers()) {
+            ucorf_log_error("io_uring setup error: %s", error_.message().c_str());
+            if (ring_fd_ >= 0) {
+                ::close(ring_fd_);
+                ring_fd_ = -1;
+            }
+            return ;
+        }
+
+        reaper_ = std::thread([this]{ this->ReapLoop(); });
+    }
+
+    IoUring::~IoUring()
+    {
+        if (reaper_.joinable()) {
+            stop_ = true;
+            // 提交一个空操作唤醒收割线程
+            Submit([](io_uring_sqe & sqe){ sqe.opcode = IORING_OP_NOP; }, CompletionF());
+            reaper_.join();
+        }
+
+        if (ring_fd_ >= 0)
+            ::close(ring_fd_);
+        if (buffers_)
+            ::munmap(buffers_, (std::size_t)opt_.buffer_count * opt_.buffer_size);
+        if (buf_ring_)
+            ::munmap(buf_ring_, buf_ring_bytes_);
+        if (sqes_)
+            ::munmap(sqes_, sqes_bytes_);
+        if (cq_ring_ && cq_ring_ != sq_ring_)
+            ::munmap(cq_ring_, cq_ring_bytes_);
+        if (sq_ring_)
+            ::munmap(sq_ring_, sq_ring_bytes_);
+    }
+
+    boost::shared_ptr<IoUring> IoUring::Default()
+    {
+        static boost::shared_ptr<IoUring> obj(new IoUring);
+        return obj;
+    }
+
+    bool IoUring::Setup()
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = opt_.entries * 4;
+        if (opt_.sq_poll) {
+            p.flags |= IORING_SETUP_SQPOLL;
+            p.sq_thread_idle = 1000;
+        }
+
+        int fd = (int)::syscall(__NR_io_uring_setup, opt_.entries, &p);
+        if (fd < 0) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+        ring_fd_ = fd;
+        features_ = p.features;
+
+        sq_ring_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = features_ & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_ring_bytes_ = cq_ring_bytes_ = (std::max)(sq_ring_bytes_, cq_ring_bytes_);
+
+        void* sq = ::mmap(nullptr, sq_ring_bytes_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+        sq_ring_ = sq;
+
+        if (single_mmap) {
+            cq_ring_ = sq_ring_;
+        } else {
+            void* cq = ::mmap(nullptr, cq_ring_bytes_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) {
+                error_ = MakeSysErrorCode(errno);
+                return false;
+            }
+            cq_ring_ = cq;
+        }
+
+        sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = ::mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+        sqes_ = (io_uring_sqe*)sqes;
+
+        sq_head_ = RingPtr<unsigned>(sq_ring_, p.sq_off.head);
+        sq_tail_ = RingPtr<unsigned>(sq_ring_, p.sq_off.tail);
+        sq_flags_ = RingPtr<unsigned>(sq_ring_, p.sq_off.flags);
+        sq_mask_ = *RingPtr<unsigned>(sq_ring_, p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        // sqe数组与提交队列一一对应
+        unsigned* array = RingPtr<unsigned>(sq_ring_, p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i)
+            array[i] = i;
+
+        cq_head_ = RingPtr<unsigned>(cq_ring_, p.cq_off.head);
+        cq_tail_ = RingPtr<unsigned>(cq_ring_, p.cq_off.tail);
+        cq_mask_ = *RingPtr<unsigned>(cq_ring_, p.cq_off.ring_mask);
+        cqes_ = RingPtr<void>(cq_ring_, p.cq_off.cqes);
+        return true;
+    }
+
+    bool IoUring::SetupBuffers()
+    {
+        unsigned count = opt_.buffer_count;
+        if (!count || count > 32768 || (count & (count - 1)) || !opt_.buffer_size) {
+            error_ = MakeSysErrorCode(EINVAL);
+            return false;
+        }
+
+        buf_ring_bytes_ = count * sizeof(io_uring_buf);
+        void* ring = ::mmap(nullptr, buf_ring_bytes_, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+        buf_ring_ = ring;
+
+        void* buffers = ::mmap(nullptr, (std::size_t)count * opt_.buffer_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers == MAP_FAILED) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+        buffers_ = (char*)buffers;
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)buf_ring_;
+        reg.ring_entries = count;
+        reg.bgid = BufferGroup();
+        if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            error_ = MakeSysErrorCode(errno);
+            return false;
+        }
+
+        for (unsigned i = 0; i < count; ++i)
+            ReleaseBuffer((uint16_t)i);
+        return true;
+    }
+
+    void IoUring::ReleaseBuffer(uint16_t bid)
+    {
+        io_uring_buf_ring* ring = (io_uring_buf_ring*)buf_ring_;
+        // 缓冲区数组从环的起始地址开始(C++下内核头文件中bufs的偏移不正确, 不能直接用ring->bufs),
+        // 第一个元素的resv与ring->tail共用内存, 只能逐个字段赋值.
+        io_uring_buf* buf = (io_uring_buf*)buf_ring_ + (buf_tail_ & (opt_.buffer_count - 1));
+        buf->addr = (uint64_t)Buffer(bid);
+        buf->len = opt_.buffer_size;
+        buf->bid = bid;
+        ++buf_tail_;
+        __atomic_store_n(&ring->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+
+    int IoUring::Enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        ++enters_;
+        int r = (int)::syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0);
+        return r < 0 ? -errno : r;
+    }
+
+    uint64_t IoUring::Submit(FillF const& fill, CompletionF const& cb)
+    {
+        if (ring_fd_ < 0) return 0;
+
+        Op* op = new Op;
+        op->cb = cb;
+        {
+            std::unique_lock<std::mutex> lock(sq_mtx_);
+            for (;;) {
+                unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+                if (*sq_tail_ - head < sq_entries_) break;
+
+                // 提交队列满, 先提交已有的再重试
+                lock.unlock();
+                Flush();
+                if (co_sched.IsCoroutine())
+                    co_yield;
+                else
+                    std::this_thread::yield();
+                lock.lock();
+            }
+
+            unsigned tail = *sq_tail_;
+            io_uring_sqe & sqe = sqes_[tail & sq_mask_];
+            memset(&sqe, 0, sizeof(sqe));
+            fill(sqe);
+            sqe.user_data = (uint64_t)op;
+            __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        }
+
+        ++submitted_;
+        // 从0变为非0的提交者负责调用io_uring_enter, 之后的提交者直接返回, 由它一并提交.
+        if (unsubmitted_.fetch_add(1) != 0)
+            return (uint64_t)op;
+
+        // 收割线程中的提交(重新提交recv, 取消等)在它下一次等待完成时一并提交
+        if (t_in_reaper)
+            return (uint64_t)op;
+
+        // 协程中先让出一次, 同一轮调度中其他协程的提交合并到同一次io_uring_enter
+        if (co_sched.IsCoroutine())
+            co_yield;
+        Flush();
+        return (uint64_t)op;
+    }
+
+    void IoUring::Flush()
+    {
+        if (opt_.sq_poll) {
+            unsubmitted_ = 0;
+            if (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+                Enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+            return ;
+        }
+
+        // 同一时刻只有一个线程调用io_uring_enter, 期间其他线程的提交由它一并带上.
+        for (;;) {
+            if (flushing_.exchange(true)) return;
+            unsigned n = unsubmitted_.exchange(0);
+            if (n) {
+                int r = Enter(n, 0, 0);
+                if (r < 0 && r != -EINTR && r != -EAGAIN && r != -EBUSY) {
+                    ucorf_log_error("io_uring_enter error: %s", strerror(-r));
+                } else if (r >= 0 && (unsigned)r < n) {
+                    unsubmitted_ += n - r;
+                }
+            }
+            flushing_ = false;
+            if (!unsubmitted_) return;
+        }
+    }
+
+    void IoUring::Cancel(uint64_t op_id)
+    {
+        if (!op_id) return ;
+        Submit([=](io_uring_sqe & sqe){
+                    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe.addr = op_id;
+                }, CompletionF());
+    }
+
+    void IoUring::ReapLoop()
+    {
+        t_in_reaper = true;
+        io_uring_cqe* cqes = (io_uring_cqe*)cqes_;
+        std::vector<io_uring_cqe> batch;
+        while (!stop_)
+        {
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                // 等待完成的同时提交未提交的操作, 只需一次io_uring_enter
+                unsigned n = 0;
+                if (opt_.sq_poll)
+                    Flush();
+                else
+                    n = unsubmitted_.exchange(0);
+                int r = Enter(n, 1, IORING_ENTER_GETEVENTS);
+                if (r >= 0 && (unsigned)r < n) {
+                    unsubmitted_ += n - r;
+                } else if (r < 0) {
+                    if (n) unsubmitted_ += n;
+                    if (r != -EINTR && r != -EAGAIN && r != -EBUSY) {
+                        ucorf_log_error("io_uring wait error: %s", strerror(-r));
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                }
+                continue;
+            }
+
+            // 先拷出完成事件并归还完成队列, 回调中提交操作时内核可以继续写入完成事件
+            batch.clear();
+            for (; head != tail; ++head)
+                batch.push_back(cqes[head & cq_mask_]);
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+            for (auto & cqe : batch) {
+                Op* op = (Op*)cqe.user_data;
+                ++completions_;
+                if (!op) continue;
+
+                if (op->cb)
+                    op->cb(cqe.res, cqe.flags);
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                    delete op;
+            }
+
+            // 还有完成事件要处理时先提交回调中的操作, 避免被持续到来的完成事件推迟
+            if (unsubmitted_ && *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+                Flush();
+        }
+    }
+
+    IoUring::Stats IoUring::GetStats() const
+    {
+        Stats stats;
+        stats.enters = enters_;
+        stats.submitted = submitted_;
+        stats.completions = completions_;
+        return stats;
+    }
+
+} //namespace ucorf
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "preheader.h"
+#include <mutex>
+#include <thread>
+#include <boost/noncopyable.hpp>
+
+struct io_uring_sqe;
+
+namespace ucorf
+{
+    struct UringOption
+    {
+        unsigned entries = 1024;            // 提交队列长度, 完成队列为其4倍
+        unsigned buffer_count = 1024;       // 注册给内核的接收缓冲区个数, 必须为2的幂
+        unsigned buffer_size = 16 * 1024;   // 每个接收缓冲区的大小
+        bool sq_poll = false;               // 由内核线程轮询提交队列, 提交时不需要系统调用
+    };
+
+    // io_uring的简单封装(直接使用系统调用, 不依赖liburing).
+    // 多个协程/线程共享提交队列, 提交时加锁. 协程中提交时先让出一次, 同一轮调度中的提交
+    // 合并为一次io_uring_enter; 完成回调中的提交与收割线程下一次等待合并为一次io_uring_enter.
+    // 完成队列由一个后台线程收割, 回调在该线程中执行, 只能做唤醒协程等轻量的工作.
+    // 接收使用注册到内核的缓冲区环(provided buffer ring), 配合multishot recv一次提交多次完成.
+    class IoUring : public boost::noncopyable
+    {
+    public:
+        // @res: 同cqe.res, 负数为-errno. @flags: 同cqe.flags.
+        typedef boost::function<void(int res, uint32_t flags)> CompletionF;
+        typedef boost::function<void(io_uring_sqe & sqe)> FillF;
+
+        explicit IoUring(UringOption const& opt = UringOption());
+        ~IoUring();
+
+        // 进程内共享的默认实例
+        static boost::shared_ptr<IoUring> Default();
+
+        // 内核不支持或权限不足时初始化失败
+        bool IsOk() const { return ring_fd_ >= 0; }
+        boost_ec GetError() const { return error_; }
+
+        // 提交一个操作, 返回操作标识, 用于Cancel. 失败返回0.
+        // multishot的操作每次完成都会调用@cb, 直到cqe.flags中没有IORING_CQE_F_MORE.
+        uint64_t Submit(FillF const& fill, CompletionF const& cb);
+
+        void Cancel(uint64_t op_id);
+
+        // 接收缓冲区
+        uint16_t BufferGroup() const { return 0; }
+        const char* Buffer(uint16_t bid) const { return buffers_ + (std::size_t)bid * opt_.buffer_size; }
+
+        // 把缓冲区还给内核, 只能在完成回调中调用.
+        void ReleaseBuffer(uint16_t bid);
+
+        struct Stats
+        {
+            uint64_t enters = 0;        // io_uring_enter系统调用次数(含收割)
+            uint64_t submitted = 0;     // 提交的操作数
+            uint64_t completions = 0;   // 收割的完成事件数
+        };
+        Stats GetStats() const;
+
+    private:
+        struct Op
+        {
+            CompletionF cb;
+        };
+
+        bool Setup();
+        bool SetupBuffers();
+        int Enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+        void Flush();
+        void ReapLoop();
+
+    private:
+        UringOption opt_;
+        int ring_fd_ = -1;
+        boost_ec error_;
+        uint32_t features_ = 0;
+
+        // 提交队列
+        std::mutex sq_mtx_;
+        void* sq_ring_ = nullptr;
+        std::size_t sq_ring_bytes_ = 0;
+        unsigned* sq_head_ = nullptr;
+        unsigned* sq_tail_ = nullptr;
+        unsigned* sq_flags_ = nullptr;
+        unsigned sq_mask_ = 0;
+        unsigned sq_entries_ = 0;
+        io_uring_sqe* sqes_ = nullptr;
+        std::size_t sqes_bytes_ = 0;
+        std::atomic<unsigned> unsubmitted_{0};
+        std::atomic<bool> flushing_{false};
+
+        // 完成队列
+        void* cq_ring_ = nullptr;
+        std::size_t cq_ring_bytes_ = 0;
+        unsigned* cq_head_ = nullptr;
+        unsigned* cq_tail_ = nullptr;
+        unsigned cq_mask_ = 0;
+        void* cqes_ = nullptr;
+
+        // 接收缓冲区环
+        void* buf_ring_ = nullptr;
+        std::size_t buf_ring_bytes_ = 0;
+        char* buffers_ = nullptr;
+        uint16_t buf_tail_ = 0;
+
+        std::atomic<bool> stop_{false};
+        std::thread reaper_;
+
+        std::atomic<uint64_t> enters_{0};
+        std::atomic<uint64_t> submitted_{0};
+        std::atomic<uint64_t> completions_{0};
+    };
+
+} //namespace ucorf
@@ -0,0 +1,578 @@
+#include "uring_transport.h"
+#include "stream_transport.h"
+#include "logger.h"
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+
+namespace ucorf
+{
+    static boost_ec MakeSysErrorCode(int err)
+    {
+        return boost_ec(err, boost::system::system_category());
+    }
+
+    // 接收队列的上限, 超过时暂停接收. 取消生效前内核已经收进注册缓冲区的数据仍会进入队列,
+    // 所以积压最多为此上限加上注册缓冲区的总大小(UringOption::buffer_count * buffer_size).
+    static const std::size_t kInboxHighWater = 256 * 1024;
+
+    // session
+    UringSession::UringSession(boost::shared_ptr<IoUring> ring, int fd, StreamTransportOption const& opt)
+        : ring_(ring), fd_(fd), opt_(opt)
+    {
+    }
+
+    UringSession::~UringSession()
+    {
+        ::close(fd_);
+    }
+
+    void UringSession::Start(OnReceiveF const& on_receive, OnCloseF const& on_close)
+    {
+        UringSessionPtr self = shared_from_this();
+        go [=]{ self->ReadLoop(on_receive, on_close); };
+        {
+            std::unique_lock<std::mutex> lock(in_mtx_);
+            recv_armed_ = true;
+        }
+        ArmRecv();
+    }
+
+    void UringSession::ArmRecv()
+    {
+        int fd = fd_;
+        uint16_t group = ring_->BufferGroup();
+        UringSessionPtr self = shared_from_this();
+        boost::shared_ptr<RecvOp> op(new RecvOp);
+        uint64_t id = ring_->Submit([=](io_uring_sqe & sqe) {
+                    sqe.opcode = IORING_OP_RECV;
+                    sqe.fd = fd;
+                    sqe.ioprio = IORING_RECV_MULTISHOT;
+                    sqe.flags = IOSQE_BUFFER_SELECT;
+                    sqe.buf_group = group;
+                }, [=](int res, uint32_t flags) { self->OnRecv(op.get(), res, flags); });
+
+        // 完成回调可能先于这里执行, 此时id为0, 由之后的完成事件再取消
+        op->id = id;
+        if (!id) OnRecv(op.get(), -ENOSYS, 0);
+    }
+
+    void UringSession::OnRecv(RecvOp* op, int res, uint32_t flags)
+    {
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            bool paused = false;
+            {
+                std::unique_lock<std::mutex> lock(in_mtx_);
+                const char* data = ring_->Buffer(bid);
+                inbox_.insert(inbox_.end(), data, data + res);
+                if (inbox_.size() >= kInboxHighWater)
+                    recv_paused_ = true;
+                paused = recv_paused_;
+            }
+            ring_->ReleaseBuffer(bid);
+            signal_.TryPush(true);
+
+            if (flags & IORING_CQE_F_MORE) {
+                // 积压过多, 取消recv, 不再从socket读取
+                if (paused && !op->cancelled && op->id) {
+                    op->cancelled = true;
+                    ring_->Cancel(op->id);
+                }
+                return ;
+            }
+
+            // multishot被内核终止(如缓冲区用尽)
+            OnRecvEnd();
+            return ;
+        }
+
+        // 缓冲区用尽, 被取消, 或提交该请求的线程已退出(内核会取消其未完成的请求)
+        if ((res == -ENOBUFS || res == -ECANCELED) && !closed_) {
+            OnRecvEnd();
+            return ;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(in_mtx_);
+            in_eof_ = true;
+            in_ec_ = MakeSysErrorCode(res < 0 ? -res : ECONNRESET);
+        }
+        signal_.TryPush(true);
+    }
+
+    void UringSession::OnRecvEnd()
+    {
+        {
+            std::unique_lock<std::mutex> lock(in_mtx_);
+            recv_armed_ = false;
+            if (recv_paused_ || closed_) return ;
+            recv_armed_ = true;
+        }
+        ArmRecv();
+    }
+
+    void UringSession::ReadLoop(OnReceiveF on_receive, OnCloseF on_close)
+    {
+        std::vector<char> pending;
+        boost_ec ec;
+        for (;;)
+        {
+            bool signal = false;
+            signal_ >> signal;
+
+            bool eof = false;
+            {
+                std::unique_lock<std::mutex> lock(in_mtx_);
+                if (pending.empty())
+                    pending.swap(inbox_);
+                else {
+                    pending.insert(pending.end(), inbox_.begin(), inbox_.end());
+                    inbox_.clear();
+                }
+                eof = in_eof_;
+                ec = in_ec_;
+            }
+
+            if (!pending.empty()) {
+                std::size_t consume = on_receive(&pending[0], pending.size());
+                if (consume == (std::size_t)-1) {
+                    ec = MakeSysErrorCode(EBADMSG);
+                    break;
+                }
+                pending.erase(pending.begin(), pending.begin() + consume);
+
+                // 剩下的是一个不完整的包
+                if (pending.size() >= opt_.max_pack_size) {
+                    ucorf_log_warn("uring session(fd=%d) packet exceeds max_pack_size(%u)",
+                            fd_, (unsigned)opt_.max_pack_size);
+                    ec = MakeSysErrorCode(EMSGSIZE);
+                    break;
+                }
+            }
+
+            // 积压已处理完, 恢复接收
+            bool resume = false;
+            {
+                std::unique_lock<std::mutex> lock(in_mtx_);
+                if (recv_paused_ && !eof && inbox_.size() + pending.size() < kInboxHighWater) {
+                    recv_paused_ = false;
+                    resume = !recv_armed_;
+                    recv_armed_ = true;
+                }
+            }
+            if (resume)
+                ArmRecv();
+
+            if (eof) break;
+        }
+
+        closed_ = true;
+        ::shutdown(fd_, SHUT_RDWR);
+        on_close(ec);
+    }
+
+    void UringSession::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        if (closed_) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        std::unique_lock<co_mutex> lock(mtx_);
+        send_queue_.push_back(Packet());
+        send_queue_.back().buf.swap(buf);
+        send_queue_.back().cb = cb;
+        if (writing_) return ;
+
+        writing_ = true;
+        lock.unlock();
+
+        UringSessionPtr self = shared_from_this();
+        go [=]{ self->WriteLoop(); };
+    }
+
+    boost_ec UringSession::WriteAll(std::vector<iovec> & iov)
+    {
+        std::size_t idx = 0;
+        while (idx < iov.size())
+        {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov[idx];
+            msg.msg_iovlen = (std::min<std::size_t>)(iov.size() - idx, IOV_MAX);
+
+            // msg和iov在当前协程的栈上, 等待完成期间一直有效.
+            int fd = fd_;
+            msghdr *pmsg = &msg;
+            co_chan<int> done(1);
+            uint64_t op = ring_->Submit([=](io_uring_sqe & sqe) {
+                        sqe.opcode = IORING_OP_SENDMSG;
+                        sqe.fd = fd;
+                        sqe.addr = (uint64_t)pmsg;
+                        sqe.len = 1;
+                        sqe.msg_flags = MSG_NOSIGNAL;
+                    }, [=](int res, uint32_t) { done.TryPush(res); });
+            if (!op) return MakeSysErrorCode(ENOSYS);
+
+            int n = 0;
+            done >> n;
+            if (n < 0) {
+                if (n == -EINTR || n == -EAGAIN) continue;
+                return MakeSysErrorCode(-n);
+            }
+
+            while (n > 0) {
+                if ((std::size_t)n >= iov[idx].iov_len) {
+                    n -= iov[idx].iov_len;
+                    ++idx;
+                } else {
+                    iov[idx].iov_base = (char*)iov[idx].iov_base + n;
+                    iov[idx].iov_len -= n;
+                    n = 0;
+                }
+            }
+        }
+        return boost_ec();
+    }
+
+    void UringSession::WriteLoop()
+    {
+        // 每次最多合并发送的包数
+        const std::size_t max_batch = 64;
+        std::vector<Packet> batch;
+        std::vector<iovec> iov;
+        for (;;)
+        {
+            batch.clear();
+            iov.clear();
+            {
+                std::unique_lock<co_mutex> lock(mtx_);
+                if (send_queue_.empty()) {
+                    writing_ = false;
+                    if (closing_)
+                        ::shutdown(fd_, SHUT_RDWR);
+                    return ;
+                }
+
+                while (!send_queue_.empty() && batch.size() < max_batch) {
+                    batch.push_back(std::move(send_queue_.front()));
+                    send_queue_.pop_front();
+                }
+            }
+
+            for (auto &pkt : batch) {
+                if (pkt.buf.empty()) continue;
+                iovec v;
+                v.iov_base = &pkt.buf[0];
+                v.iov_len = pkt.buf.size();
+                iov.push_back(v);
+            }
+
+            boost_ec ec = closed_ ? MakeSysErrorCode(ENOTCONN) : WriteAll(iov);
+            if (ec && !closed_) {
+                ucorf_log_warn("uring session(fd=%d) write error: %s", fd_, ec.message().c_str());
+                closed_ = true;
+                ::shutdown(fd_, SHUT_RDWR);
+            }
+
+            for (auto &pkt : batch)
+                if (pkt.cb) pkt.cb(ec);
+        }
+    }
+
+    void UringSession::Close(bool immediately)
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        if (immediately || (!writing_ && send_queue_.empty())) {
+            lock.unlock();
+            ::shutdown(fd_, SHUT_RDWR);
+            return ;
+        }
+
+        closing_ = true;
+    }
+
+    // server
+    UringTransportServer::UringTransportServer(boost::shared_ptr<IoUring> ring)
+        : ring_(ring), core_(boost::make_shared<Core>())
+    {
+        core_->ring = ring;
+        ucorf_log_debug("UringTransportServer construct.");
+    }
+    UringTransportServer::~UringTransportServer()
+    {
+        ucorf_log_debug("UringTransportServer destruct.");
+        Shutdown();
+    }
+
+    void UringTransportServer::Shutdown()
+    {
+        if (listening_.exchange(false)) {
+            // 等待accept操作结束后再关闭fd, 避免回调访问已析构的对象
+            if (accept_op_) {
+                ring_->Cancel(accept_op_);
+                bool done = false;
+                accept_done_ >> done;
+            }
+            ::close(listen_fd_);
+            listen_fd_ = -1;
+        }
+
+        std::set<UringSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            sessions = core_->sessions;
+        }
+        for (auto &sess : sessions)
+            sess->Close(true);
+    }
+    void UringTransportServer::SetReceiveCb(OnReceiveF const& cb)
+    {
+        core_->on_receive = cb;
+    }
+    void UringTransportServer::SetConnectedCb(OnConnectedF const& cb)
+    {
+        core_->on_connect = cb;
+    }
+    void UringTransportServer::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        core_->on_disconnect = cb;
+    }
+    void UringTransportServer::SetOption(boost::any const& opt)
+    {
+        if (!GetStreamTransportOption(opt, core_->opt) && !opt.empty())
+            WarnUnknownOption("UringTransportServer", opt);
+    }
+
+    boost_ec UringTransportServer::Listen(std::string const& url)
+    {
+        if (!ring_->IsOk())
+            return ring_->GetError();
+
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseStreamAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (::bind(fd, (sockaddr*)&addr, addr_len) < 0 || ::listen(fd, 1024) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        url_ = url;
+        listen_fd_ = fd;
+        listening_ = true;
+        ArmAccept();
+        return boost_ec();
+    }
+
+    void UringTransportServer::ArmAccept()
+    {
+        // Shutdown等待accept操作结束, 回调中可以访问this; 新连接的处理只持有core.
+        int fd = listen_fd_;
+        CorePtr core = core_;
+        accept_op_ = ring_->Submit([=](io_uring_sqe & sqe) {
+                    sqe.opcode = IORING_OP_ACCEPT;
+                    sqe.fd = fd;
+                    sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+                    sqe.accept_flags = SOCK_CLOEXEC;
+                }, [this, core](int res, uint32_t flags) {
+                    if (res >= 0) {
+                        int fd = res;
+                        go [=]{ OnAccept(core, fd); };
+                    } else if (res != -ECANCELED) {
+                        ucorf_log_error("accept on %s error: %s", this->url_.c_str(), strerror(-res));
+                    }
+
+                    if (flags & IORING_CQE_F_MORE) return ;
+                    if (this->listening_)
+                        this->ArmAccept();
+                    else
+                        this->accept_done_.TryPush(true);
+                });
+    }
+
+    void UringTransportServer::OnAccept(CorePtr core, int fd)
+    {
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        UringSessionPtr sess(new UringSession(core->ring, fd, core->opt));
+        {
+            std::unique_lock<co_mutex> lock(core->sessions_mtx);
+            core->sessions.insert(sess);
+        }
+
+        ucorf_log_debug("new connection");
+        if (core->on_connect)
+            core->on_connect(SessId(sess));
+
+        sess->Start([=](const char* data, size_t bytes) {
+                    return core->on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("connection disconnect: %s", ec.message().c_str());
+                    {
+                        std::unique_lock<co_mutex> lock(core->sessions_mtx);
+                        core->sessions.erase(sess);
+                    }
+                    if (core->on_disconnect)
+                        core->on_disconnect(SessId(sess), ec);
+                });
+    }
+
+    void UringTransportServer::Send(SessId id, const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(id, std::move(buf), cb);
+    }
+    void UringTransportServer::Send(SessId id, std::vector<char> && buf, OnSndF const& cb)
+    {
+        UringSessionPtr &sess = ::boost::any_cast<UringSessionPtr&>(id);
+        sess->Send(std::move(buf), cb);
+    }
+    std::string UringTransportServer::LocalUrl() const
+    {
+        return url_;
+    }
+    void UringTransportServer::ForEachSession(boost::function<void(SessId)> const& fn)
+    {
+        std::set<UringSessionPtr> sessions;
+        {
+            std::unique_lock<co_mutex> lock(core_->sessions_mtx);
+            sessions = core_->sessions;
+        }
+
+        for (auto &sess : sessions)
+            fn(SessId(sess));
+    }
+    void UringTransportServer::Close(SessId id)
+    {
+        UringSessionPtr &sess = ::boost::any_cast<UringSessionPtr&>(id);
+        sess->Close();
+    }
+
+    // client
+    UringTransportClient::UringTransportClient(boost::shared_ptr<IoUring> ring)
+        : ring_(ring)
+    {
+        ucorf_log_debug("UringTransportClient construct.");
+    }
+    UringTransportClient::~UringTransportClient()
+    {
+        ucorf_log_debug("UringTransportClient destruct.");
+        Shutdown();
+    }
+
+    void UringTransportClient::Shutdown()
+    {
+        UringSessionPtr sess = GetSession();
+        if (sess)
+            sess->Close(true);
+    }
+    void UringTransportClient::SetReceiveCb(OnReceiveF const& cb)
+    {
+        on_receive_ = cb;
+    }
+    void UringTransportClient::SetConnectedCb(OnConnectedF const& cb)
+    {
+        on_connect_ = cb;
+    }
+    void UringTransportClient::SetDisconnectedCb(OnDisconnectedF const& cb)
+    {
+        on_disconnect_ = cb;
+    }
+    void UringTransportClient::SetOption(boost::any const& opt)
+    {
+        if (!GetStreamTransportOption(opt, opt_) && !opt.empty())
+            WarnUnknownOption("UringTransportClient", opt);
+    }
+
+    boost_ec UringTransportClient::Connect(std::string const& url)
+    {
+        url_ = url;
+        if (!ring_->IsOk())
+            return ring_->GetError();
+
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!ParseStreamAddress(url, addr, addr_len))
+            return MakeSysErrorCode(EINVAL);
+
+        int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return MakeSysErrorCode(errno);
+
+        if (::connect(fd, (sockaddr*)&addr, addr_len) < 0) {
+            boost_ec ec = MakeSysErrorCode(errno);
+            ::close(fd);
+            return ec;
+        }
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        UringSessionPtr sess(new UringSession(ring_, fd, opt_));
+        {
+            std::unique_lock<co_mutex> lock(mtx_);
+            sess_ = sess;
+        }
+
+        ucorf_log_debug("connect sucess");
+        if (on_connect_)
+            on_connect_(SessId(sess));
+
+        // 连接可能比client活得更久, 回调按值捕获
+        OnReceiveF on_receive = on_receive_;
+        OnDisconnectedF on_disconnect = on_disconnect_;
+        sess->Start([=](const char* data, size_t bytes) {
+                    return on_receive(SessId(sess), data, bytes);
+                }, [=](boost_ec const& ec) {
+                    ucorf_log_debug("disconnect because: %s", ec.message().c_str());
+                    if (on_disconnect)
+                        on_disconnect(SessId(sess), ec);
+                });
+        return boost_ec();
+    }
+    void UringTransportClient::Send(const void* data, size_t bytes, OnSndF const& cb)
+    {
+        std::vector<char> buf((const char*)data, (const char*)data + bytes);
+        Send(std::move(buf), cb);
+    }
+    void UringTransportClient::Send(std::vector<char> && buf, OnSndF const& cb)
+    {
+        UringSessionPtr sess = GetSession();
+        if (!sess) {
+            if (cb) cb(MakeSysErrorCode(ENOTCONN));
+            return ;
+        }
+
+        sess->Send(std::move(buf), cb);
+    }
+    bool UringTransportClient::IsEstab()
+    {
+        UringSessionPtr sess = GetSession();
+        return sess && sess->IsEstab();
+    }
+    std::string UringTransportClient::RemoteUrl() const
+    {
+        return url_;
+    }
+
+    UringSessionPtr UringTransportClient::GetSession()
+    {
+        std::unique_lock<co_mutex> lock(mtx_);
+        return sess_;
+    }
+
+} //namespace ucorf
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "preheader.h"
+#include "transport.h"
+#include "uring.h"
+#include "stream_transport.h"
+#include <deque>
+#include <set>
+#include <boost/enable_shared_from_this.hpp>
+#include <sys/uio.h>
+
+namespace ucorf
+{
+    // 基于io_uring的tcp连接.
+    // 接收使用一次提交、多次完成的multishot recv, 数据在收割线程中从注册缓冲区拷贝到接收队列,
+    // 由连接的接收协程处理; 接收队列积压过多时取消recv, 接收协程处理完后再重新提交, 由TCP流控让对端减速.
+    // 发送时排队, 由发送协程合并为一次sendmsg提交.
+    class UringSession : public boost::enable_shared_from_this<UringSession>
+    {
+    public:
+        typedef ITransport::OnSndF OnSndF;
+        typedef boost::function<size_t(const char*, size_t)> OnReceiveF;
+        typedef boost::function<void(boost_ec const&)> OnCloseF;
+
+        UringSession(boost::shared_ptr<IoUring> ring, int fd, StreamTransportOption const& opt);
+        ~UringSession();
+
+        void Start(OnReceiveF const& on_receive, OnCloseF const& on_close);
+
+        void Send(std::vector<char> && buf, OnSndF const& cb);
+
+        // 已排队的数据发送完毕后关闭连接. @immediately: 立即关闭, 丢弃未发送的数据.
+        void Close(bool immediately = false);
+
+        bool IsEstab() const { return !closed_; }
+
+    private:
+        struct Packet
+        {
+            std::vector<char> buf;
+            OnSndF cb;
+        };
+
+        // 一次提交的multishot recv
+        struct RecvOp
+        {
+            std::atomic<uint64_t> id{0};
+            bool cancelled = false;     // 只在收割线程中访问
+        };
+
+        // 在收割线程中调用
+        void ArmRecv();
+        void OnRecv(RecvOp* op, int res, uint32_t flags);
+        void OnRecvEnd();
+
+        void ReadLoop(OnReceiveF on_receive, OnCloseF on_close);
+        void WriteLoop();
+        boost_ec WriteAll(std::vector<iovec> & iov);
+
+    private:
+        boost::shared_ptr<IoUring> ring_;
+        int fd_;
+        StreamTransportOption opt_;
+        std::atomic<bool> closed_{false};
+
+        // 接收队列, 收割线程和接收协程共用
+        std::mutex in_mtx_;
+        std::vector<char> inbox_;
+        bool recv_armed_ = false;   // 有进行中的recv
+        bool recv_paused_ = false;  // 接收队列超过上限, 等接收协程取走后再恢复
+        bool in_eof_ = false;
+        boost_ec in_ec_;
+        co_chan<bool> signal_{1};
+
+        co_mutex mtx_;
+        std::deque<Packet> send_queue_;
+        bool writing_ = false;
+        bool closing_ = false;
+    };
+    typedef boost::shared_ptr<UringSession> UringSessionPtr;
+
+    // 地址格式同StreamTransportServer(tcp://ip:port或unix://path), SetOption同样接受StreamTransportOption,
+    // 目前只有max_pack_size生效. 通过ServerImpl::BindTransport或Client的TransportFactory使用:
+    //   std::unique_ptr<ITransportServer> tp(new UringTransportServer);
+    //   tp->Listen("tcp://127.0.0.1:8080");
+    //   server.BindTransport(std::move(tp));
+    //   client.SetTransportFactory([]{ return (ITransportClient*)new UringTransportClient; });
+    class UringTransportServer : public ITransportServer
+    {
+    public:
+        explicit UringTransportServer(boost::shared_ptr<IoUring> ring = IoUring::Default());
+        ~UringTransportServer();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Listen(std::string const& url);
+        virtual void Send(SessId id, const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(SessId id, std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual std::string LocalUrl() const;
+        virtual void ForEachSession(boost::function<void(SessId)> const& fn);
+        virtual void Close(SessId id);
+
+    private:
+        // 选项, 回调和连接表. accept协程和连接的回调持有它而不是server,
+        // 连接可以比server活得更久.
+        struct Core
+        {
+            boost::shared_ptr<IoUring> ring;
+            StreamTransportOption opt;
+            OnReceiveF on_receive;
+            OnConnectedF on_connect;
+            OnDisconnectedF on_disconnect;
+            co_mutex sessions_mtx;
+            std::set<UringSessionPtr> sessions;
+        };
+        typedef boost::shared_ptr<Core> CorePtr;
+
+        void ArmAccept();
+        static void OnAccept(CorePtr core, int fd);
+
+    private:
+        boost::shared_ptr<IoUring> ring_;
+        CorePtr core_;
+        std::string url_;
+        int listen_fd_ = -1;
+        std::atomic<bool> listening_{false};
+        std::atomic<uint64_t> accept_op_{0};
+        co_chan<bool> accept_done_{1};
+    };
+
+    class UringTransportClient : public ITransportClient
+    {
+    public:
+        explicit UringTransportClient(boost::shared_ptr<IoUring> ring = IoUring::Default());
+        ~UringTransportClient();
+
+        virtual void Shutdown();
+        virtual void SetReceiveCb(OnReceiveF const&);
+        virtual void SetConnectedCb(OnConnectedF const&);
+        virtual void SetDisconnectedCb(OnDisconnectedF const&);
+        virtual void SetOption(boost::any const& opt);
+
+        virtual boost_ec Connect(std::string const& url);
+        virtual void Send(const void* data, size_t bytes, OnSndF const& cb = NULL);
+        virtual void Send(std::vector<char> && buf, OnSndF const& cb = NULL);
+        virtual bool IsEstab();
+        virtual std::string RemoteUrl() const;
+
+    private:
+        UringSessionPtr GetSession();
+
+    private:
+        boost::shared_ptr<IoUring> ring_;
+        std::string url_;
+        StreamTransportOption opt_;
+        OnReceiveF on_receive_;
+        OnConnectedF on_connect_;
+        OnDisconnectedF on_disconnect_;
+        co_mutex mtx_;
+        UringSessionPtr sess_;
+    };
+
+} //namespace ucorf
@@ -334,19 +334,44 @@ retry:
         result.second = url.substr(path_begin, -1);
         return result;
     }
+    // zookeeper节点名中不能含有'/', unix socket路径中的'/'和'%'需要转义
+    static std::string EscapeNodeAddr(std::string const& addr)
+    {
+        std::string out;
+        for (char c : addr) {
+            if (c == '%') out += "%25";
+            else if (c == '/') out += "%2F";
+            else out += c;
+        }
+        return out;
+    }
+    static std::string UnescapeNodeAddr(std::string const& addr)
+    {
+        std::string out;
+        for (std::size_t i = 0; i < addr.size(); ++i) {
+            if (addr[i] == '%' && i + 2 < addr.size()) {
+                std::string hex = addr.substr(i + 1, 2);
+                if (hex == "25") { out += '%'; i += 2; continue; }
+                if (hex == "2F" || hex == "2f") { out += '/'; i += 2; continue; }
+            }
+            out += addr[i];
+        }
+        return out;
+    }
     std::string ZookeeperClientMgr::Url2ZookeeperNode(std::string url)
     {
-        static ::boost::regex re("((.*)://)?([^/]+)");
-        boost::smatch result;
-        bool ok = boost::regex_match(url, result, re);
-        if (!ok) {
-            return "";
+        std::string proto, addr;
+        std::size_t pos = url.find("://");
+        if (pos == std::string::npos) {
+            addr = url;
+        } else {
+            proto = url.substr(0, pos);
+            addr = url.substr(pos + 3);
         }
 
-        std::string proto = result[2].str();
+        if (addr.empty()) return "";
         if (proto.empty()) proto = "TCP";
-        std::string addr = result[3];
-        return addr + ":" + proto;
+        return EscapeNodeAddr(addr) + ":" + proto;
     }
     std::string ZookeeperClientMgr::ZookeeperNode2Url(std::string node)
     {
@@ -354,7 +379,7 @@ retry:
         if (pos == std::string::npos) return "";
 
         std::string proto = node.substr(pos + 1, -1);
-        std::string addr = node.substr(0, pos);
+        std::string addr = UnescapeNodeAddr(node.substr(0, pos));
         return proto + "://" + addr;
     }
 